@@ -0,0 +1,817 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <charconv>
+#include <tuple>
+#include <unordered_map>
+
+#include <LeptonMath/Matrix.h>
+
+#include <SoftwareRenderer/RenderPipeline.h>
+#include <SoftwareRenderer/VertexShader.h>
+#include <SoftwareRenderer/FragmentShader.h>
+#include <SoftwareRenderer/WideFragmentShader.h>
+#include <SoftwareRenderer/GeometryShader.h>
+#include <SoftwareRenderer/ColorBuffer.h>
+#include <SoftwareRenderer/ModelLoader.h>
+#include <SoftwareRenderer/MeshOptimizer.h>
+#include <SoftwareRenderer/MeshCluster.h>
+#include <SoftwareRenderer/MeshSimplifier.h>
+#include <SoftwareRenderer/Texture.h>
+
+// Headless benchmark: renders the example models offscreen along a fixed camera path
+// and prints one CSV row per configuration. Hierarchical Z and, with a float depth buffer, the depth pre-pass must not
+// change the image. Runs which differ only in those are compared by a hash of their frames and a mismatch fails the bench.
+// Quantized depth formats let several triangles reach the same depth value. Forward shading keeps the first of them
+// and the equal depth pass of the pre-pass the last, and the batch modes on several threads keep the one flushed first,
+// so these images are only compared where the order of the triangles at a pixel is fixed.
+static const char* USAGE =
+	"Usage: SoftwareRenderer_bench [--models a,b] [--resolutions 640x360,1920x1080] [--threads 1,2,4]\n"
+	"                              [--rasterization tiles,batches,atomic] [--rasterizer scanline,halfspace] [--depth float32,unorm16,unorm24]\n"
+	"                              [--hiz off,on] [--modes triangle,wireframe] [--optimize off,on] [--culling off,on] [--lod off,on]\n"
+	"                              [--instances 1,64] [--shading forward,deferred]\n"
+	"                              [--prepass off,on] [--varyings default,declared] [--shaders virtual,inline,wide]\n"
+	"                              [--lighting phong,normal] [--textures off,on,bc1,bc3]\n"
+	"                              [--frames n] [--warmup n] [--model-dir dir] [--output file] [--help]\n"
+	"A thread count of 0 picks the hardware concurrency, the CSV records the resolved count.\n"
+	"Runs which differ only in --hiz, or in --prepass with float32 depth, have to render the same image,\n"
+	"otherwise the bench exits with status 1. Quantized depth with batches on several threads is not compared.\n"
+	"The wide shaders and the half-space rasterizer use 8 AVX2 lanes only when configured with -DSR_ENABLE_AVX2=ON.\n";
+
+static std::atomic<uint64_t> shadedFragments = 0;
+
+class BenchVertexShader : public sr::VertexShader {
+private:
+	lm::Matrix4x4f projectionMatrix{};
+	lm::Matrix4x4f transformationMatrix{};
+	bool instanced = false;
+	bool declaredVaryings = false;
+	bool texCoords = false;
+public:
+	void main() override {
+		auto in_position = sr::vec4(this->getVertexAttribute<3>(0), 1.0f);
+		if (this->instanced) {
+			// Instance attribute 0: offset and uniform scale
+			auto instance = this->getInstanceAttribute<4>(0);
+			in_position = sr::vec4(instance.getW() * in_position.getXYZ() + instance.getXYZ(), 1.0f);
+		}
+		in_position = this->transformationMatrix * in_position;
+		in_position = in_position - sr::vec4({ 0, 0, 1.25f, 0 }); // the rotated unit cube stays behind the near plane
+
+		auto in_normal = sr::vec4(this->getVertexAttribute<3>(1), 0);
+		in_normal = this->transformationMatrix * in_normal;
+
+		out_position = this->projectionMatrix * in_position;
+		if (this->declaredVaryings) this->setVarying<3>(0, in_normal.getXYZ());
+		else out_normal = in_normal.getXYZ();
+
+		// Planar projection of the model, the texture repeats 4 times across it
+		if (this->texCoords) {
+			auto position = this->getVertexAttribute<3>(0);
+			this->setVarying<2>(3, { 4.0f * (position.getX() + 0.5f), 4.0f * (0.5f - position.getY()) });
+		}
+	}
+
+	std::unique_ptr<sr::VertexShader> clone() const override {
+		return std::make_unique<BenchVertexShader>(*this);
+	}
+
+	void setProjectionMatrix(const lm::Matrix4x4f& mat) {
+		this->projectionMatrix = mat;
+	}
+
+	void setTransformationMatrix(const lm::Matrix4x4f& mat) {
+		this->transformationMatrix = mat;
+	}
+
+	void setInstanced(bool instanced) {
+		this->instanced = instanced;
+	}
+
+	// Only the normal is passed to the fragment shader, followed by texture coordinates if texCoords is set
+	void setDeclaredVaryings(bool texCoords) {
+		this->declareVaryings(texCoords ? 5 : 3);
+		this->declaredVaryings = true;
+		this->texCoords = texCoords;
+	}
+
+	// The transformation of main() as one matrix, for cluster culling
+	lm::Matrix4x4f getObjectToClipMatrix() const {
+		auto view = this->transformationMatrix;
+		view[2][3] -= 1.25f;
+
+		lm::Matrix4x4f mat{};
+		for (size_t row = 0; row < 4; ++row) {
+			for (size_t column = 0; column < 4; ++column) {
+				for (size_t k = 0; k < 4; ++k) mat[row][column] += this->projectionMatrix[row][k] * view[k][column];
+			}
+		}
+		return mat;
+	}
+};
+
+// Phong shading like the example, counts its invocations per clone. Textured shaders multiply it with the texture of unit 0.
+// Normal lighting outputs the normal as color, a shader cheap enough that the cost of calling main shows.
+// The inlined variant is compiled into its own shading loop, see sr::InlineFragmentShader.
+template<bool inlined>
+class BenchFragmentShader;
+
+template<bool inlined>
+using BenchFragmentShaderBase = std::conditional_t<inlined, sr::InlineFragmentShader<BenchFragmentShader<inlined>>, sr::FragmentShader>;
+
+template<bool inlined>
+class BenchFragmentShader final : public BenchFragmentShaderBase<inlined> {
+	friend class sr::InlineFragmentShader<BenchFragmentShader<inlined>>;
+private:
+	sr::vec3 lightPosition = { 300, 300, 300 };
+	bool declaredVaryings = false;
+	bool textured = false;
+	bool normalLighting = false;
+	uint64_t invocations = 0;
+
+protected:
+	void main() override {
+		this->invocations++;
+
+		auto normal = this->declaredVaryings ? this->template getVarying<3>(0) : this->in_normal;
+		sr::vec3 color;
+		if (this->normalLighting) color = 0.5f * (normal + sr::vec3({ 1, 1, 1 }));
+		else {
+			auto viewDir = sr::vec3({ 0, 0, 1 });
+			auto lDir = (lightPosition - sr::vec3(-this->in_position.getXY(), this->in_position.getZ())).getNormalized();
+			auto reflected = 2 * (-lDir * normal) * normal + lDir;
+
+			float iDiffuse = lDir * normal;
+			float iAmbient = 0.05f;
+			float iSpecular = std::pow(std::max(0.0f, reflected * viewDir), 80.0f);
+
+			float iOut = std::min(std::max(iAmbient, iDiffuse + iAmbient + iSpecular), 1.0f);
+			color = { iOut, iOut, iOut };
+		}
+
+		if (this->textured) {
+			auto albedo = this->sampleTexture(0, 3);
+			color = { color[0] * albedo[0], color[1] * albedo[1], color[2] * albedo[2] };
+		}
+		this->out_color = { color[0], color[1], color[2], 1.0f };
+	}
+
+	std::unique_ptr<sr::FragmentShader> clone() const override {
+		return std::make_unique<BenchFragmentShader>(*this);
+	}
+
+public:
+	BenchFragmentShader() = default;
+	BenchFragmentShader(const BenchFragmentShader& other) : BenchFragmentShaderBase<inlined>(other), lightPosition(other.lightPosition), declaredVaryings(other.declaredVaryings), textured(other.textured), normalLighting(other.normalLighting) {}
+
+	void setDeclaredVaryings() {
+		this->declaredVaryings = true;
+	}
+
+	// Texture coordinates follow the declared normal
+	void setTextured() {
+		this->textured = true;
+		this->useDerivatives();
+	}
+
+	void setNormalLighting() {
+		this->normalLighting = true;
+	}
+
+	~BenchFragmentShader() {
+		shadedFragments.fetch_add(this->invocations, std::memory_order_relaxed);
+	}
+};
+
+// The shading of BenchFragmentShader on simd::LANES fragments at once
+class WideBenchFragmentShader final : public sr::WideFragmentShader<WideBenchFragmentShader> {
+	friend class sr::WideFragmentShader<WideBenchFragmentShader>;
+private:
+	sr::vec3 lightPosition = { 300, 300, 300 };
+	bool declaredVaryings = false;
+	bool textured = false;
+	bool normalLighting = false;
+	uint64_t invocations = 0;
+
+protected:
+	void mainLanes() {
+		using namespace sr::simd;
+		this->invocations += std::popcount(unsigned(this->in_lanes.mask));
+
+		const auto& position = this->in_lanes.position;
+		const vfloat* normal = this->in_lanes.varyings + (this->declaredVaryings ? 0 : 4);
+		this->out_colorLanes[3] = set1(1.0f);
+
+		if (this->normalLighting) {
+			for (int i = 0; i < 3; ++i) this->out_colorLanes[i] = mul(set1(0.5f), add(normal[i], set1(1.0f)));
+		}
+		else {
+			const vfloat iOut = this->getPhong(position, normal);
+			for (int i = 0; i < 3; ++i) this->out_colorLanes[i] = iOut;
+		}
+
+		if (this->textured) {
+			vfloat albedo[4];
+			this->sampleTextureLanes(0, 3, albedo);
+			for (int i = 0; i < 3; ++i) this->out_colorLanes[i] = mul(this->out_colorLanes[i], albedo[i]);
+		}
+	}
+
+	sr::simd::vfloat getPhong(const sr::simd::vfloat position[4], const sr::simd::vfloat* normal) const {
+		using namespace sr::simd;
+		vfloat lDir[3] = { add(set1(lightPosition[0]), position[0]), add(set1(lightPosition[1]), position[1]), sub(set1(lightPosition[2]), position[2]) };
+		const vfloat length = sqrt(add(add(mul(lDir[0], lDir[0]), mul(lDir[1], lDir[1])), mul(lDir[2], lDir[2])));
+		for (auto& component : lDir) component = div(component, length);
+
+		const vfloat iDiffuse = add(add(mul(lDir[0], normal[0]), mul(lDir[1], normal[1])), mul(lDir[2], normal[2]));
+		const vfloat iAmbient = set1(0.05f);
+		const vfloat reflectedZ = sub(lDir[2], mul(mul(set1(2.0f), iDiffuse), normal[2])); // reflected * viewDir
+		const vfloat iSpecular = pow(max(reflectedZ, set1(0.0f)), set1(80.0f));
+
+		return min(max(iAmbient, add(add(iDiffuse, iAmbient), iSpecular)), set1(1.0f));
+	}
+
+public:
+	WideBenchFragmentShader() = default;
+	WideBenchFragmentShader(const WideBenchFragmentShader& other) : sr::WideFragmentShader<WideBenchFragmentShader>(other), lightPosition(other.lightPosition), declaredVaryings(other.declaredVaryings), textured(other.textured), normalLighting(other.normalLighting) {}
+
+	void setDeclaredVaryings() {
+		this->declaredVaryings = true;
+	}
+
+	void setTextured() {
+		this->textured = true;
+		this->useDerivatives();
+	}
+
+	void setNormalLighting() {
+		this->normalLighting = true;
+	}
+
+	~WideBenchFragmentShader() {
+		shadedFragments.fetch_add(this->invocations, std::memory_order_relaxed);
+	}
+};
+
+enum class ShaderVariant {
+	VIRTUAL, // main is called through the virtual interface
+	INLINE, // main is inlined into the shading loop
+	WIDE // simd::LANES fragments are shaded at once
+};
+
+template<typename Shader>
+std::shared_ptr<sr::FragmentShader> createFragmentShader(bool declaredVaryings, bool textured, bool normalLighting) {
+	auto fs = std::make_shared<Shader>();
+	if (declaredVaryings) fs->setDeclaredVaryings();
+	if (textured) fs->setTextured();
+	if (normalLighting) fs->setNormalLighting();
+	return fs;
+}
+
+std::shared_ptr<sr::FragmentShader> createFragmentShader(ShaderVariant variant, bool declaredVaryings, bool textured, bool normalLighting) {
+	if (variant == ShaderVariant::INLINE) return createFragmentShader<BenchFragmentShader<true>>(declaredVaryings, textured, normalLighting);
+	if (variant == ShaderVariant::WIDE) return createFragmentShader<WideBenchFragmentShader>(declaredVaryings, textured, normalLighting);
+	return createFragmentShader<BenchFragmentShader<false>>(declaredVaryings, textured, normalLighting);
+}
+
+// Checkerboard with a fine grid, so every mip level differs
+sr::Texture createBenchTexture(int size, sr::TextureFormat format) {
+	std::vector<uint32_t> texels(size_t(size) * size);
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			const bool checker = ((x / 64) + (y / 64)) % 2 == 0;
+			const bool grid = x % 8 == 0 || y % 8 == 0;
+			const uint32_t r = grid ? 40 : checker ? 230 : 90;
+			const uint32_t g = grid ? 40 : checker ? 160 : 200;
+			const uint32_t b = grid ? 40 : checker ? 60 : 230;
+			texels[size_t(y) * size + x] = 0xFF000000 | b << 16 | g << 8 | r;
+		}
+	}
+	return sr::Texture(size, size, texels, true, format);
+}
+
+const char* getTextureName(const std::optional<sr::TextureFormat>& format) {
+	if (!format.has_value()) return "off";
+	if (format == sr::TextureFormat::BC1) return "bc1";
+	if (format == sr::TextureFormat::BC3) return "bc3";
+	return "on";
+}
+
+const char* getDepthFormatName(sr::DepthFormat format) {
+	if (format == sr::DepthFormat::UNORM16) return "unorm16";
+	if (format == sr::DepthFormat::UNORM24) return "unorm24";
+	return "float32";
+}
+
+const char* getRasterizationModeName(sr::RasterizationMode mode) {
+	if (mode == sr::RasterizationMode::TRIANGLE_BATCHES) return "batches";
+	if (mode == sr::RasterizationMode::TRIANGLE_BATCHES_ATOMIC) return "atomic";
+	return "tiles";
+}
+
+const char* getRasterizerName(sr::RasterizerType type) {
+	if (type == sr::RasterizerType::HALF_SPACE) return "halfspace";
+	return "scanline";
+}
+
+const char* getShaderVariantName(ShaderVariant variant) {
+	if (variant == ShaderVariant::INLINE) return "inline";
+	if (variant == ShaderVariant::WIDE) return "wide";
+	return "virtual";
+}
+
+class BenchGeometryShader : public sr::GeometryShader {
+private:
+	sr::vec3 lightPosition = { 100, 100, 100 };
+
+protected:
+	void main() override {
+		auto lightDir = lightPosition - this->in_positions[0].getXYZ();
+		auto brightness = std::max(0.04f, this->in_surfaceNormal.getNormalized() * lightDir.getNormalized());
+
+		sr::vec4 outColor = { brightness, 117.0f / 255 * brightness, 24.0f / 255 * brightness, 1.0 };
+
+		this->out_colors = { outColor, outColor, outColor };
+		this->out_positions = this->in_positions;
+		this->out_normals = this->in_normals;
+	}
+
+	std::unique_ptr<sr::GeometryShader> clone() const override {
+		return std::make_unique<BenchGeometryShader>(*this);
+	}
+};
+
+class Model {
+public:
+	std::string name;
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<int> indices;
+};
+
+class Config {
+public:
+	std::vector<std::string> models = { "dragon", "Bunny", "teapot", "teddy", "pumpkin_tall_10k" };
+	std::vector<std::pair<int, int>> resolutions = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+	std::vector<sr::DepthFormat> depthFormats = { sr::DepthFormat::FLOAT32 };
+	std::vector<size_t> threadCounts;
+	std::vector<sr::RasterizationMode> rasterizationModes = { sr::RasterizationMode::TRIANGLE_BATCHES };
+	std::vector<sr::RasterizerType> rasterizers = { sr::RasterizerType::SCANLINE };
+	std::vector<bool> hierarchicalZ = { false }; // reject blocks behind the per-tile maximum depth
+	std::vector<sr::RenderMode> modes = { sr::RenderMode::TRIANGLE, sr::RenderMode::TRIANGLE_WIREFRAME };
+	std::vector<bool> optimize = { false }; // reorder the model with optimizeMesh
+	std::vector<bool> culling = { false }; // cull clusters before vertex shading
+	std::vector<bool> lod = { false }; // select simplified levels by screen size
+	std::vector<size_t> instanceCounts = { 1 }; // copies in a grid drawn with one drawInstanced call
+	std::vector<sr::ShadingMode> shadingModes = { sr::ShadingMode::FORWARD };
+	std::vector<bool> prepass = { false }; // depth only pass before shading
+	std::vector<bool> declaredVaryings = { false }; // the shaders pass only the normal instead of the default varyings
+	std::vector<ShaderVariant> shaderVariants = { ShaderVariant::VIRTUAL };
+	std::vector<bool> normalLighting = { false }; // normal as color instead of Phong lighting
+	std::vector<std::optional<sr::TextureFormat>> textures = { std::nullopt }; // trilinear sampled texture, implies declared varyings
+	int frames = 60;
+	int warmupFrames = 5;
+	std::string modelDir = SR_BENCH_MODEL_DIR;
+	std::string output;
+	bool help = false;
+};
+
+// One measured combination of the options
+class Run {
+public:
+	int width = 0;
+	int height = 0;
+	sr::DepthFormat depthFormat = sr::DepthFormat::FLOAT32;
+	size_t threads = 1;
+	sr::RasterizationMode rasterization = sr::RasterizationMode::TRIANGLE_BATCHES;
+	sr::RasterizerType rasterizer = sr::RasterizerType::SCANLINE;
+	bool hierarchicalZ = false;
+	sr::RenderMode mode = sr::RenderMode::TRIANGLE;
+	bool culling = false;
+	bool lod = false;
+	size_t instances = 1;
+	sr::ShadingMode shading = sr::ShadingMode::FORWARD;
+	bool depthPrepass = false;
+	bool declaredVaryings = false;
+	ShaderVariant shaderVariant = ShaderVariant::VIRTUAL;
+	bool normalLighting = false;
+	std::optional<sr::TextureFormat> textureFormat;
+};
+
+lm::Matrix4x4f createRotationMatrixYAxis(float rad) {
+	lm::Matrix4x4f mat{};
+
+	float cos = std::cos(rad);
+	float sin = std::sin(rad);
+
+	mat[0][0] = cos;
+	mat[0][2] = sin;
+	mat[1][1] = 1;
+	mat[2][0] = -sin;
+	mat[2][2] = cos;
+	mat[3][3] = 1;
+
+	return mat;
+}
+
+lm::Matrix4x4f createProjectionMatrix(float near, int width, int height) {
+	lm::Matrix4x4f mat{};
+
+	mat[0][0] = float(height) / float(width);
+	mat[1][1] = 1;
+	mat[2][2] = -1;
+	mat[2][3] = -2 * near;
+	mat[3][2] = -1;
+
+	return mat;
+}
+
+// Centers the model and scales it into the unit cube, so every model covers a similar screen area
+void normalizeModel(std::vector<float>& positions) {
+	if (positions.empty()) return;
+
+	float lo[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float hi[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+	for (size_t i = 0; i < positions.size(); ++i) {
+		lo[i % 3] = std::min(lo[i % 3], positions[i]);
+		hi[i % 3] = std::max(hi[i % 3], positions[i]);
+	}
+
+	const float extent = std::max({ hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] });
+	const float scale = extent > 0 ? 1.0f / extent : 1.0f;
+	for (size_t i = 0; i < positions.size(); ++i) positions[i] = (positions[i] - 0.5f * (lo[i % 3] + hi[i % 3])) * scale;
+}
+
+// Offset and scale of every instance, the copies fill the unit square of the model in the xy plane
+std::vector<float> createInstanceGrid(size_t instanceCount) {
+	const size_t columns = size_t(std::ceil(std::sqrt(double(instanceCount))));
+	const float scale = 1.0f / float(columns);
+
+	std::vector<float> instances;
+	for (size_t i = 0; i < instanceCount; ++i) {
+		const float x = (float(i % columns) + 0.5f) * scale - 0.5f;
+		const float y = (float(i / columns) + 0.5f) * scale - 0.5f;
+		instances.insert(instances.end(), { x, y, 0.0f, scale });
+	}
+	return instances;
+}
+
+std::vector<std::string> split(const std::string& list) {
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) if (!item.empty()) items.push_back(item);
+	return items;
+}
+
+// Parses a list of option names into their values
+template<typename T>
+bool parseOptions(const std::string& arg, const std::string& value, const std::vector<std::pair<std::string, T>>& options, std::vector<T>& values) {
+	values.clear();
+	for (auto& item : split(value)) {
+		auto option = std::find_if(options.begin(), options.end(), [&item](const auto& option) { return option.first == item; });
+		if (option == options.end()) {
+			std::cerr << "Invalid option " << item << " for " << arg << std::endl;
+			return false;
+		}
+		values.push_back(option->second);
+	}
+	return true;
+}
+
+bool parseSwitches(const std::string& arg, const std::string& value, std::vector<bool>& values) {
+	return parseOptions<bool>(arg, value, { { "off", false }, { "on", true } }, values);
+}
+
+bool parseNumber(const std::string& arg, const std::string& text, size_t& number) {
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+	if (error != std::errc() || end != text.data() + text.size()) {
+		std::cerr << "Invalid number " << text << " for " << arg << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool parseNumbers(const std::string& arg, const std::string& value, std::vector<size_t>& numbers) {
+	numbers.clear();
+	for (auto& item : split(value)) {
+		size_t number = 0;
+		if (!parseNumber(arg, item, number)) return false;
+		numbers.push_back(number);
+	}
+	return true;
+}
+
+bool parseArguments(int argc, char** argv, Config& config) {
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h") {
+			config.help = true;
+			return true;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		const std::string value = argv[++i];
+
+		bool valid = true;
+		if (arg == "--models") {
+			config.models = split(value);
+		}
+		else if (arg == "--resolutions") {
+			config.resolutions.clear();
+			for (auto& res : split(value)) {
+				int width = 0, height = 0;
+				if (std::sscanf(res.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+					std::cerr << "Invalid resolution " << res << std::endl;
+					return false;
+				}
+				config.resolutions.push_back({ width, height });
+			}
+		}
+		else if (arg == "--threads") valid = parseNumbers(arg, value, config.threadCounts);
+		else if (arg == "--instances") {
+			valid = parseNumbers(arg, value, config.instanceCounts);
+			for (auto& count : config.instanceCounts) count = std::max<size_t>(1, count);
+		}
+		else if (arg == "--modes") valid = parseOptions<sr::RenderMode>(arg, value, { { "triangle", sr::RenderMode::TRIANGLE }, { "wireframe", sr::RenderMode::TRIANGLE_WIREFRAME } }, config.modes);
+		else if (arg == "--optimize") valid = parseSwitches(arg, value, config.optimize);
+		else if (arg == "--culling") valid = parseSwitches(arg, value, config.culling);
+		else if (arg == "--lod") valid = parseSwitches(arg, value, config.lod);
+		else if (arg == "--prepass") valid = parseSwitches(arg, value, config.prepass);
+		else if (arg == "--hiz") valid = parseSwitches(arg, value, config.hierarchicalZ);
+		else if (arg == "--rasterization") {
+			valid = parseOptions<sr::RasterizationMode>(arg, value, {
+				{ "tiles", sr::RasterizationMode::SCREEN_TILES },
+				{ "batches", sr::RasterizationMode::TRIANGLE_BATCHES },
+				{ "atomic", sr::RasterizationMode::TRIANGLE_BATCHES_ATOMIC }
+			}, config.rasterizationModes);
+		}
+		else if (arg == "--rasterizer") valid = parseOptions<sr::RasterizerType>(arg, value, { { "scanline", sr::RasterizerType::SCANLINE }, { "halfspace", sr::RasterizerType::HALF_SPACE } }, config.rasterizers);
+		else if (arg == "--depth") {
+			valid = parseOptions<sr::DepthFormat>(arg, value, {
+				{ "float32", sr::DepthFormat::FLOAT32 },
+				{ "unorm16", sr::DepthFormat::UNORM16 },
+				{ "unorm24", sr::DepthFormat::UNORM24 }
+			}, config.depthFormats);
+		}
+		else if (arg == "--shading") valid = parseOptions<sr::ShadingMode>(arg, value, { { "forward", sr::ShadingMode::FORWARD }, { "deferred", sr::ShadingMode::DEFERRED } }, config.shadingModes);
+		else if (arg == "--varyings") valid = parseOptions<bool>(arg, value, { { "default", false }, { "declared", true } }, config.declaredVaryings);
+		else if (arg == "--shaders") {
+			valid = parseOptions<ShaderVariant>(arg, value, {
+				{ "virtual", ShaderVariant::VIRTUAL },
+				{ "inline", ShaderVariant::INLINE },
+				{ "wide", ShaderVariant::WIDE }
+			}, config.shaderVariants);
+		}
+		else if (arg == "--lighting") valid = parseOptions<bool>(arg, value, { { "phong", false }, { "normal", true } }, config.normalLighting);
+		else if (arg == "--textures") {
+			valid = parseOptions<std::optional<sr::TextureFormat>>(arg, value, {
+				{ "off", std::nullopt },
+				{ "on", sr::TextureFormat::RGBA8 },
+				{ "bc1", sr::TextureFormat::BC1 },
+				{ "bc3", sr::TextureFormat::BC3 }
+			}, config.textures);
+		}
+		else if (arg == "--frames") {
+			size_t frames = 0;
+			valid = parseNumber(arg, value, frames);
+			config.frames = int(std::clamp<size_t>(frames, 1, std::numeric_limits<int>::max()));
+		}
+		else if (arg == "--warmup") {
+			size_t frames = 0;
+			valid = parseNumber(arg, value, frames);
+			config.warmupFrames = int(std::min<size_t>(frames, std::numeric_limits<int>::max()));
+		}
+		else if (arg == "--model-dir") config.modelDir = value + "/";
+		else if (arg == "--output") config.output = value;
+		else {
+			std::cerr << "Unknown argument " << arg << std::endl;
+			return false;
+		}
+
+		if (!valid) return false;
+	}
+
+	if (config.threadCounts.empty()) {
+		const size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (size_t count = 1; count < hardwareThreads; count *= 2) config.threadCounts.push_back(count);
+		config.threadCounts.push_back(hardwareThreads);
+	}
+
+	return true;
+}
+
+// Replaces every run by one copy per value, the last expanded option varies fastest
+template<typename T, typename Setter>
+void expandRuns(std::vector<Run>& runs, const std::vector<T>& values, Setter&& set) {
+	std::vector<Run> expanded;
+	expanded.reserve(runs.size() * values.size());
+	for (auto& run : runs) {
+		for (const auto& value : values) {
+			expanded.push_back(run);
+			set(expanded.back(), value);
+		}
+	}
+	runs = std::move(expanded);
+}
+
+// Every combination of the options that apply to a prepared model
+std::vector<Run> createRuns(const Config& config) {
+	std::vector<Run> runs(1);
+	expandRuns(runs, config.resolutions, [](Run& run, const std::pair<int, int>& resolution) { std::tie(run.width, run.height) = resolution; });
+	expandRuns(runs, config.depthFormats, [](Run& run, sr::DepthFormat format) { run.depthFormat = format; });
+	expandRuns(runs, config.threadCounts, [](Run& run, size_t threads) { run.threads = threads; });
+	expandRuns(runs, config.rasterizationModes, [](Run& run, sr::RasterizationMode mode) { run.rasterization = mode; });
+	expandRuns(runs, config.rasterizers, [](Run& run, sr::RasterizerType type) { run.rasterizer = type; });
+	expandRuns(runs, config.hierarchicalZ, [](Run& run, bool hierarchicalZ) { run.hierarchicalZ = hierarchicalZ; });
+	expandRuns(runs, config.modes, [](Run& run, sr::RenderMode mode) { run.mode = mode; });
+	expandRuns(runs, config.culling, [](Run& run, bool culling) { run.culling = culling; });
+	expandRuns(runs, config.lod, [](Run& run, bool lod) { run.lod = lod; });
+	expandRuns(runs, config.instanceCounts, [](Run& run, size_t instances) { run.instances = instances; });
+	expandRuns(runs, config.shadingModes, [](Run& run, sr::ShadingMode shading) { run.shading = shading; });
+	expandRuns(runs, config.prepass, [](Run& run, bool prepass) { run.depthPrepass = prepass; });
+	expandRuns(runs, config.declaredVaryings, [](Run& run, bool declared) { run.declaredVaryings = declared; });
+	expandRuns(runs, config.shaderVariants, [](Run& run, ShaderVariant variant) { run.shaderVariant = variant; });
+	expandRuns(runs, config.normalLighting, [](Run& run, bool normalLighting) { run.normalLighting = normalLighting; });
+	expandRuns(runs, config.textures, [](Run& run, const std::optional<sr::TextureFormat>& format) { run.textureFormat = format; });
+	return runs;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+	// Nearest rank
+	size_t rank = size_t(std::ceil(p * sorted.size()));
+	return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// FNV-1a over the pixels, chained over the frames of a run
+uint64_t hashImage(const sr::ColorBuffer& surface, uint64_t hash) {
+	for (int y = 0; y < surface.getHeight(); ++y) {
+		const uint32_t* row = surface.getRow(y);
+		for (int x = 0; x < surface.getWidth(); ++x) hash = (hash ^ row[x]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+int main(int argc, char** argv) {
+	Config config;
+	if (!parseArguments(argc, argv, config)) return 1;
+	if (config.help) {
+		std::cout << USAGE;
+		return 0;
+	}
+
+	std::ofstream file;
+	if (!config.output.empty()) file.open(config.output);
+	std::ostream& out = config.output.empty() ? std::cout : file;
+
+	out << "model,optimized,culling,lod,instances,shading,prepass,varyings,shader,lighting,textures,triangles,width,height,depth,threads,rasterization,rasterizer,hiz,mode,frames,mean_ms,p50_ms,p99_ms,triangles_per_s,fragments_per_s,image" << std::endl;
+
+	const sr::Texture textures[] = {
+		createBenchTexture(512, sr::TextureFormat::RGBA8),
+		createBenchTexture(512, sr::TextureFormat::BC1),
+		createBenchTexture(512, sr::TextureFormat::BC3)
+	};
+
+	const std::vector<Run> runs = createRuns(config);
+
+	// First image of every configuration apart from the options which must not change it
+	std::unordered_map<std::string, uint64_t> images;
+	bool imagesMatch = true;
+
+	for (auto& modelName : config.models) {
+		auto data = sr::loadObj(config.modelDir + modelName + ".obj.txt");
+		if (!data.has_value()) {
+			std::cerr << "Could not load " << config.modelDir + modelName + ".obj.txt" << std::endl;
+			continue;
+		}
+
+		Model baseModel;
+		baseModel.name = modelName;
+		std::tie(baseModel.positions, baseModel.indices) = std::move(data.value());
+		normalizeModel(baseModel.positions);
+		baseModel.normals = sr::generateNormals(baseModel.positions, baseModel.indices);
+
+		for (bool optimized : config.optimize) {
+			Model model = baseModel;
+			if (optimized) sr::optimizeMesh(model.indices, model.positions, { { model.normals, 3 } });
+
+			const size_t triangleCount = model.indices.size() / 3;
+
+			// Clusters reorder the triangles, only culled draws use the clustered order
+			auto clusteredIndices = model.indices;
+			const auto clusters = sr::buildMeshClusters(clusteredIndices, model.positions);
+
+			sr::MeshLodChain lodChain;
+			if (std::find(config.lod.begin(), config.lod.end(), true) != config.lod.end()) lodChain = sr::generateLods(model.indices, model.positions);
+
+			std::shared_ptr<sr::ColorBuffer> surface;
+			for (auto& run : runs) {
+				// Consecutive runs share the surface while the resolution and depth format stay the same
+				if (surface == nullptr || surface->getWidth() != run.width || surface->getHeight() != run.height || surface->getDepthFormat() != run.depthFormat) {
+					surface = std::make_shared<sr::ColorBuffer>(run.width, run.height);
+					surface->setDepthFormat(run.depthFormat);
+				}
+
+				const bool textured = run.textureFormat.has_value();
+				sr::RenderPipeline pipeline;
+				pipeline.setRenderSurface(std::weak_ptr<sr::RenderSurface>(surface));
+				pipeline.setThreadCount(run.threads);
+				pipeline.setRasterizationMode(run.rasterization);
+				pipeline.setRasterizer(run.rasterizer);
+				if (run.hierarchicalZ) pipeline.enableHierarchicalZ();
+				else pipeline.disableHierarchicalZ();
+				pipeline.setShadingMode(run.shading);
+				if (run.depthPrepass) pipeline.enableDepthPrepass();
+
+				auto vao = pipeline.createBufferArray();
+				pipeline.bindBufferArray(vao);
+				pipeline.storeBufferInBufferArray(0, pipeline.bufferFloatData<3>(model.positions));
+				pipeline.storeBufferInBufferArray(1, pipeline.bufferFloatData<3>(model.normals));
+				pipeline.bindIndexBuffer(pipeline.createIndexBuffer(run.culling ? clusteredIndices : model.indices));
+				if (run.culling) pipeline.bindClusterBuffer(pipeline.createClusterBuffer(clusters));
+				if (run.lod) pipeline.bindLodBuffer(pipeline.createLodBuffer(lodChain));
+				if (run.instances > 1) pipeline.storeInstanceBufferInBufferArray(0, pipeline.bufferFloatData<4>(createInstanceGrid(run.instances)));
+
+				auto vs = std::make_shared<BenchVertexShader>();
+				// Texture coordinates are declared varyings
+				const bool declared = run.declaredVaryings || textured;
+				auto fs = createFragmentShader(run.shaderVariant, declared, textured, run.normalLighting);
+				auto gs = std::make_shared<BenchGeometryShader>();
+				pipeline.bindVertexShader(vs);
+				pipeline.bindFragmentShader(fs);
+				pipeline.bindGeometryShader(gs);
+
+				vs->setProjectionMatrix(createProjectionMatrix(0.5f, run.width, run.height));
+				vs->setInstanced(run.instances > 1);
+				if (declared) vs->setDeclaredVaryings(textured);
+				if (textured) pipeline.bindTexture(0, pipeline.createTexture(textures[size_t(run.textureFormat.value())]));
+
+				// Fixed camera path: one full turn around the model over the measured frames
+				auto renderFrame = [&](int frame) {
+					vs->setTransformationMatrix(createRotationMatrixYAxis(6.283185f * float(frame) / float(config.frames)));
+					pipeline.setCullingTransform(vs->getObjectToClipMatrix());
+					pipeline.beginFrame();
+					if (run.instances > 1) pipeline.drawInstanced(run.mode, model.positions.size() / 3, run.instances);
+					else pipeline.draw(run.mode, model.positions.size() / 3);
+					pipeline.endFrame();
+				};
+
+				for (int frame = 0; frame < config.warmupFrames; ++frame) renderFrame(frame);
+
+				shadedFragments = 0;
+				std::vector<double> frameTimes;
+				frameTimes.reserve(config.frames);
+
+				uint64_t image = 14695981039346656037ull;
+				for (int frame = 0; frame < config.frames; ++frame) {
+					auto begin = std::chrono::steady_clock::now();
+					renderFrame(frame);
+					auto end = std::chrono::steady_clock::now();
+					frameTimes.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+					image = hashImage(*surface, image);
+				}
+
+				double total = 0;
+				for (double time : frameTimes) total += time;
+				std::sort(frameTimes.begin(), frameTimes.end());
+
+				std::ostringstream imageKey;
+				imageKey << model.name << ',' << optimized << ',' << run.culling << ',' << run.lod << ',' << run.instances << ',' << int(run.shading) << ',' << declared << ',' << int(run.shaderVariant) << ',' << run.normalLighting << ',' << getTextureName(run.textureFormat) << ','
+					<< run.width << ',' << run.height << ',' << int(run.depthFormat) << ',' << run.threads << ',' << int(run.rasterization) << ',' << int(run.rasterizer) << ',' << int(run.mode);
+				if (run.depthFormat != sr::DepthFormat::FLOAT32) {
+					imageKey << ',' << run.depthPrepass;
+					if (run.rasterization != sr::RasterizationMode::SCREEN_TILES && pipeline.getThreadCount() > 1) imageKey << ',' << run.hierarchicalZ;
+				}
+				const auto reference = images.try_emplace(imageKey.str(), image).first;
+				if (reference->second != image) {
+					std::cerr << "Image of " << model.name << " changes with prepass " << (run.depthPrepass ? "on" : "off") << " and hiz " << (run.hierarchicalZ ? "on" : "off") << ", see the image column" << std::endl;
+					imagesMatch = false;
+				}
+
+				const double seconds = total / 1000.0;
+				out << model.name << ',' << (optimized ? "on" : "off") << ',' << (run.culling ? "on" : "off") << ',' << (run.lod ? "on" : "off") << ',' << run.instances << ',' << (run.shading == sr::ShadingMode::DEFERRED ? "deferred" : "forward") << ',' << (run.depthPrepass ? "on" : "off") << ',' << (declared ? "declared" : "default") << ',' << getShaderVariantName(run.shaderVariant) << ',' << (run.normalLighting ? "normal" : "phong") << ',' << getTextureName(run.textureFormat) << ',' << triangleCount * run.instances << ',' << run.width << ',' << run.height << ',' << getDepthFormatName(run.depthFormat) << ',' << pipeline.getThreadCount() << ',' << getRasterizationModeName(run.rasterization) << ',' << getRasterizerName(run.rasterizer) << ',' << (run.hierarchicalZ ? "on" : "off") << ','
+					<< (run.mode == sr::RenderMode::TRIANGLE ? "triangle" : "wireframe") << ',' << config.frames << ','
+					<< total / config.frames << ',' << percentile(frameTimes, 0.5) << ',' << percentile(frameTimes, 0.99) << ','
+					<< double(triangleCount * run.instances) * config.frames / seconds << ',' << double(shadedFragments.load()) / seconds << ','
+					<< std::hex << image << std::dec << std::endl;
+			}
+		}
+	}
+
+	return imagesMatch ? 0 : 1;
+}
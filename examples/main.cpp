@@ -48,6 +48,10 @@ public:
 		out_normal = in_normal.getXYZ();
 	}
 
+	std::unique_ptr<sr::VertexShader> clone() const override {
+		return std::make_unique<TestVertexShader>(*this);
+	}
+
 	void setProjectionMatrix(const lm::Matrix4x4f& mat) {
 		this->projectionMatrix = mat;
 	}
@@ -55,6 +59,21 @@ public:
 	void setTransformationMatrix(const lm::Matrix4x4f& mat) {
 		this->transformationMatrix = mat;
 	}
+
+	// The transformation of main() as one matrix, for cluster culling
+	lm::Matrix4x4f getObjectToClipMatrix() const {
+		auto view = this->transformationMatrix;
+		view[1][3] -= 0.5f;
+		view[2][3] -= 1.5f;
+
+		lm::Matrix4x4f mat{};
+		for (size_t row = 0; row < 4; ++row) {
+			for (size_t column = 0; column < 4; ++column) {
+				for (size_t k = 0; k < 4; ++k) mat[row][column] += this->projectionMatrix[row][k] * view[k][column];
+			}
+		}
+		return mat;
+	}
 };
 
 class TestFragmentShader : public sr::FragmentShader {
@@ -151,46 +170,6 @@ lm::Matrix4x4f createProjectionMatrix(float near, int width, int height) {
 	return mat;
 }
 
-std::vector<float> generateNormals(const std::vector<float>& positions,const std::vector<int>& indices) {
-	std::vector<sr::vec3> normals;
-	normals.reserve(positions.size() / 3);
-	for (int i = 0; i < positions.size() / 3; ++i) normals.push_back({ 0,0,0 });
-
-	// for every triangle...
-	for (size_t tri = 0; tri < indices.size(); tri += 3) {
-		size_t ind1 = indices[tri];
-		size_t ind2 = indices[tri + 1];
-		size_t ind3 = indices[tri + 2];
-
-		sr::vec3 v1 = { positions[ind1 * 3], positions[ind1 * 3 + 1], positions[ind1 * 3 + 2] };
-		sr::vec3 v2 = { positions[ind2 * 3], positions[ind2 * 3 + 1], positions[ind2 * 3 + 2] };
-		sr::vec3 v3 = { positions[ind3 * 3], positions[ind3 * 3 + 1], positions[ind3 * 3 + 2] };
-
-		auto d1 = v2 - v1;
-		auto d2 = v3 - v1;
-
-		auto n = lm::cross(d1, d2);
-
-		normals[ind1] = normals[ind1] + n;
-		normals[ind2] = normals[ind2] + n;
-		normals[ind3] = normals[ind3] + n;
-
-	}
-
-	std::vector<float> retData;
-	retData.reserve(positions.size());
-
-
-	for (auto& normal : normals) {
-		auto n = normal.getNormalized();
-		retData.push_back(n.getX());
-		retData.push_back(n.getY());
-		retData.push_back(n.getZ());
-	}
-
-	return retData;
-}
-
 int main(){
 
 
@@ -202,48 +181,8 @@ int main(){
 	std::string path = "../../../../examples/";
 	std::string fileName = "dragon.obj.txt";
 
-	auto model = sr::loadObj(path + fileName);
-	if (!model.has_value()) return 0;
-	auto& [pos, ind] = model.value();
-
-	std::vector<float> positions = {
-			// Front
-			-0.5f, 0.5f, 0.5f, // Front Top Left
-			0.5f, 0.5f, 0.5f, // Front Top Right
-			0.5f,-0.5f, 0.5f, // Front Bottom Right
-			-0.5f,-0.5f, 0.5f, // Front Bottom Left
-
-			// Back
-			-0.5f, 0.5f,-0.5f, // Back Top Left
-			0.5f, 0.5f,-0.5f, // Back Top  Right
-			0.5f,-0.5f,-0.5f, // Back Bottom Right
-			-0.5f,-0.5f,-0.5f // Back Bottom Left
-	};
-
-	std::vector<int> indices = {
-			//0,1,2, 0,2,3, // Front
-			2,1,0, 3,2,0,
-
-			//1,5,6, 1,6,2, // Right
-			6,5,1, 2,6,1,
-
-			//5,4,7, 5,7,6, // Back
-			7,4,5, 6,7,5,
-
-			//4,0,3, 4,3,7, // Left
-			3,0,4, 7,3,4,
-
-			//4,5,1, 4,1,0, // Top
-			1,5,4, 0,1,4,
-
-			//3,2,6, 3,6,7 // Bottom
-			6,2,3, 7,6,3
-	};
-
-	positions = pos;
-	indices = ind;
-
-	auto normals = generateNormals(positions, indices);
+	auto mesh = sr::loadObjCached(path + fileName); // normals are generated once and cached next to the model
+	if (!mesh.has_value()) return 0;
 
 	sr::RenderPipeline pipeline;
 	pipeline.setRenderSurface(w1);
@@ -251,15 +190,18 @@ int main(){
 	auto vao = pipeline.createBufferArray();
 	pipeline.bindBufferArray(vao);
 
-	auto positionBuffer = pipeline.bufferFloatData<3>(positions);
+	auto positionBuffer = pipeline.bufferFloatData<3>(mesh->getAttribute<3>(sr::MeshAttribute::POSITION));
 	pipeline.storeBufferInBufferArray(0, positionBuffer);
 
-	auto normalBuffer = pipeline.bufferFloatData<3>(normals);
+	auto normalBuffer = pipeline.bufferFloatData<3>(mesh->getAttribute<3>(sr::MeshAttribute::NORMAL));
 	pipeline.storeBufferInBufferArray(1, normalBuffer);
 
-	auto indexBuffer = pipeline.createIndexBuffer(indices);
+	auto indexBuffer = pipeline.createIndexBuffer(mesh->getIndices());
 	pipeline.bindIndexBuffer(indexBuffer);
 
+	auto clusterBuffer = pipeline.createClusterBuffer(mesh->getClusters()); // clusters hidden from the camera are skipped before vertex shading
+	pipeline.bindClusterBuffer(clusterBuffer);
+
 	auto vs = std::make_shared<TestVertexShader>();
 	pipeline.bindVertexShader(vs);
 
@@ -278,7 +220,7 @@ int main(){
 		vs->setProjectionMatrix(projMat);
 	});
 
-	std::cout << ind.size()/3 << std::endl;
+	std::cout << mesh->getTriangleCount() << std::endl;
 
 
 	float rad = 3.141592f/6;
@@ -293,12 +235,13 @@ int main(){
 
 		auto transMat = createRotationMatrixYAxis(rad);
 		vs->setTransformationMatrix(transMat);
+		pipeline.setCullingTransform(vs->getObjectToClipMatrix());
 
 		w1->makeCurrent();
 
 		pipeline.beginFrame();
 		
-		pipeline.draw(sr::RenderMode::TRIANGLE, positions.size() / 3);
+		pipeline.draw(sr::RenderMode::TRIANGLE, mesh->getVertexCount());
 
 		pipeline.endFrame();
 
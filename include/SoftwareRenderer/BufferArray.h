@@ -7,15 +7,26 @@ namespace sr {
 	class BufferArray {
 	private:
 		std::array<int, 16> buffers;
+		std::array<int, 16> instanceBuffers; // advance once per instance instead of once per vertex
 		int indexBuffer = -1;
+		int clusterBuffer = -1;
+		int lodBuffer = -1;
 	public:
 		BufferArray() = default;
 
 		void storeInAttributeList(int index, int bufferID);
 		int getBufferID(int index) const;
+		void storeInInstanceAttributeList(int index, int bufferID);
+		int getInstanceBufferID(int index) const;
 		void setIndexBuffer(int bufferID);
 		int getIndexBuffer() const;
 		bool hasIndexBuffer() const;
+		void setClusterBuffer(int bufferID);
+		int getClusterBuffer() const;
+		bool hasClusterBuffer() const;
+		void setLodBuffer(int bufferID);
+		int getLodBuffer() const;
+		bool hasLodBuffer() const;
 	};
 
 }
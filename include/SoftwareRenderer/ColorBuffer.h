@@ -0,0 +1,22 @@
+#pragma once
+
+#include <memory>
+
+#include "RenderSurface.h"
+
+namespace sr {
+
+	// In-memory render surface, renders without any window or display
+	class ColorBuffer : public RenderSurface {
+	private:
+		std::unique_ptr<uint32_t[]> buffer;
+
+	public:
+		ColorBuffer() = default;
+		ColorBuffer(int width, int height, PixelFormat format = PixelFormat::RGBA8);
+
+		void resize(int width, int height);
+		void setPixelFormat(PixelFormat format);
+	};
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include <LeptonMath/Matrix.h>
+
+#include "Renderer.h"
+#include "VertexShader.h"
+#include "FragmentShader.h"
+#include "GeometryShader.h"
+#include "Texture.h"
+
+namespace sr {
+
+	class RenderPipeline;
+
+	// Records bindings and draws for a later RenderPipeline::submit.
+	// A command buffer is not synchronized, threads record into their own buffers and submit them together.
+	// The vertex shader is copied when a draw is recorded, so its uniforms can change between draws.
+	// Fragment and geometry shaders are referenced and used with their state at submission, textures are bound by id.
+	class CommandBuffer {
+		friend class RenderPipeline;
+	private:
+
+		class DrawCommand {
+		public:
+			int bufferArray;
+			std::shared_ptr<VertexShader> vertexShader;
+			std::shared_ptr<FragmentShader> fragmentShader;
+			std::shared_ptr<GeometryShader> geometryShader;
+			std::array<int, TEXTURE_MAX_UNITS> textures;
+
+			bool cullingTransformValid;
+			lm::Matrix4x4f cullingTransform;
+
+			RenderMode mode;
+			int vertexCount;
+			int instanceCount;
+		};
+
+		std::vector<DrawCommand> commands;
+
+		// Recording state
+		int currentBufferArray = -1;
+		std::weak_ptr<VertexShader> vertexShader;
+		std::weak_ptr<FragmentShader> fragmentShader;
+		std::weak_ptr<GeometryShader> geometryShader;
+		std::array<int, TEXTURE_MAX_UNITS> textures;
+		bool cullingTransformValid = false;
+		lm::Matrix4x4f cullingTransform;
+
+	public:
+		CommandBuffer();
+
+		// Buffer array of the pipeline the command buffer is submitted to
+		void bindBufferArray(int bufferArrayID);
+
+		void bindVertexShader(std::weak_ptr<VertexShader> vs);
+		void bindFragmentShader(std::weak_ptr<FragmentShader> fs);
+		void bindGeometryShader(std::weak_ptr<GeometryShader> gs);
+		void bindTexture(int unit, int textureID); // texture of the pipeline the command buffer is submitted to
+		void setCullingTransform(const lm::Matrix4x4f& objectToClip);
+
+		void draw(RenderMode mode, int vertexCount);
+		void drawInstanced(RenderMode mode, int vertexCount, int instanceCount);
+
+		// Removes the recorded draws, the bindings are kept
+		void reset();
+		size_t getDrawCount() const;
+	};
+
+}
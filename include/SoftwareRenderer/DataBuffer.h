@@ -1,22 +1,30 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <cassert>
 
 #include <LeptonMath/Vector.h>
 
 namespace sr {
 
+	// Immutable attribute data, copies share the storage.
+	// The storage is either owned by the buffer or external memory (e.g. a mapped file) kept alive by an owner.
 	template<typename T, size_t layout>
 	class DataBuffer {
 	private:
-		std::vector<T> data;
+		std::shared_ptr<const void> owner;
+		const T* data = nullptr;
+		size_t size = 0;
 	public:
 		DataBuffer() = default;
 		DataBuffer(const std::vector<T>& data);
+		DataBuffer(std::vector<T>&& data);
+		DataBuffer(std::shared_ptr<const void> owner, const T* data, size_t size);
 
 		lm::Vector<T, layout> getVertexAttribute(size_t index) const;
 
+		const T* getData() const;
 		size_t getAttributeCount() const;
 	};
 
@@ -29,9 +37,21 @@ namespace sr {
 	// Implementation
 
 	template<typename T, size_t layout>
-	DataBuffer<T, layout>::DataBuffer(const std::vector<T>& data) : data(data) {
+	DataBuffer<T, layout>::DataBuffer(const std::vector<T>& data) : DataBuffer(std::vector<T>(data)) {
+	}
+
+	template<typename T, size_t layout>
+	DataBuffer<T, layout>::DataBuffer(std::vector<T>&& data) {
 		assert(data.size() % layout == 0);
-		this->data.shrink_to_fit();
+		auto storage = std::make_shared<const std::vector<T>>(std::move(data));
+		this->data = storage->data();
+		this->size = storage->size();
+		this->owner = std::move(storage);
+	}
+
+	template<typename T, size_t layout>
+	DataBuffer<T, layout>::DataBuffer(std::shared_ptr<const void> owner, const T* data, size_t size) : owner(std::move(owner)), data(data), size(size) {
+		assert(size % layout == 0);
 	}
 
 	template<typename T, size_t layout>
@@ -42,9 +62,14 @@ namespace sr {
 		return out;
 	}
 
+	template<typename T, size_t layout>
+	const T* DataBuffer<T, layout>::getData() const {
+		return this->data;
+	}
+
 	template<typename T, size_t layout>
 	size_t DataBuffer<T, layout>::getAttributeCount() const {
-		return this->data.size() / layout;
+		return this->size / layout;
 	}
 
 }
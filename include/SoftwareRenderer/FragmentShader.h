@@ -1,7 +1,13 @@
 #pragma once
 
+#include <memory>
+#include <cassert>
+
 #include <LeptonMath/Vector.h>
 
+#include "Vertex.h"
+#include "Texture.h"
+
 namespace sr{
 
 	using vec2 = lm::Vector2f;
@@ -10,12 +16,18 @@ namespace sr{
 
 	class FragmentShader {
 		friend class Renderer;
+	private:
+		TextureUnits textures = {}; // set by the Renderer on the copies that shade a draw
+		bool derivativesUsed = false;
+
 	protected:
 
 		// in
 		vec4 in_position;
-		vec4 in_color;
+		vec4 in_color; // default varyings, only set if the vertex shader declares none
 		vec3 in_normal;
+		const float* in_varyings = nullptr; // smooth varyings followed by flat ones
+		const VaryingDerivatives* in_derivatives = nullptr; // only set if derivatives are used
 
 		// out
 		vec4 out_color;
@@ -25,9 +37,98 @@ namespace sr{
 
 		void reset();
 
+		// Reads the varying starting at float offset as declared by the vertex shader
+		template<size_t layout>
+		lm::Vectorf<layout> getVarying(size_t offset) const;
+
+		// Requests the screen space derivatives of the varyings, usually called in the constructor. The request is copied
+		// with the shader. Derivatives are read with getVaryingDx and getVaryingDy and select the mip level in sampleTexture.
+		void useDerivatives();
+
+		template<size_t layout>
+		lm::Vectorf<layout> getVaryingDx(size_t offset) const;
+		template<size_t layout>
+		lm::Vectorf<layout> getVaryingDy(size_t offset) const;
+
+		// Texture bound to unit for the draw, nullptr if there is none
+		const Texture* getTexture(int unit) const;
+
+		// Samples the texture of unit at the uv varying starting at offset, black if no texture is bound.
+		// Without derivatives the first mip level is sampled.
+		vec4 sampleTexture(int unit, size_t offset) const;
+
+		// Sets the inputs of main to an interpolated fragment, derivatives is nullptr unless they are used
+		void setInputs(const Vertex& fragment, const VaryingDerivatives* derivatives);
+
+		// Runs main for count fragments and stores out_color of each of them in colors.
+		// The renderer calls it once per batch of fragments instead of calling main per pixel.
+		// derivatives holds the derivatives of every fragment if they are used, otherwise it is nullptr.
+		virtual void shadeFragments(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count, vec4* colors);
+
 	public:
 		virtual ~FragmentShader() = default;
 
 	};
 
+	// Base of fragment shaders that are compiled into their own shading loop: main of Shader is called
+	// without virtual dispatch and can be inlined, e.g. class MyShader final : public InlineFragmentShader<MyShader>.
+	// Shader has to be copy constructible for clone and declare InlineFragmentShader<Shader> a friend if main is not public.
+	template<typename Shader>
+	class InlineFragmentShader : public FragmentShader {
+	protected:
+		void shadeFragments(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count, vec4* colors) override;
+
+	public:
+		std::unique_ptr<FragmentShader> clone() const override;
+	};
+
+	inline void FragmentShader::setInputs(const Vertex& fragment, const VaryingDerivatives* derivatives) {
+		this->in_position = fragment.getPosition();
+		this->in_varyings = fragment.varyings.data();
+		this->in_derivatives = derivatives;
+		if (!fragment.layout.declared) {
+			this->in_color = fragment.getColor();
+			this->in_normal = fragment.getNormal();
+		}
+	}
+
+	template<size_t layout>
+	lm::Vectorf<layout> FragmentShader::getVarying(size_t offset) const {
+		assert(this->in_varyings != nullptr);
+		lm::Vectorf<layout> value;
+		for (size_t i = 0; i < layout; ++i) value[i] = this->in_varyings[offset + i];
+		return value;
+	}
+
+	template<size_t layout>
+	lm::Vectorf<layout> FragmentShader::getVaryingDx(size_t offset) const {
+		assert(this->in_derivatives != nullptr);
+		lm::Vectorf<layout> value;
+		for (size_t i = 0; i < layout; ++i) value[i] = this->in_derivatives->dx[offset + i];
+		return value;
+	}
+
+	template<size_t layout>
+	lm::Vectorf<layout> FragmentShader::getVaryingDy(size_t offset) const {
+		assert(this->in_derivatives != nullptr);
+		lm::Vectorf<layout> value;
+		for (size_t i = 0; i < layout; ++i) value[i] = this->in_derivatives->dy[offset + i];
+		return value;
+	}
+
+	template<typename Shader>
+	void InlineFragmentShader<Shader>::shadeFragments(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count, vec4* colors) {
+		auto& shader = static_cast<Shader&>(*this);
+		for (size_t i = 0; i < count; ++i) {
+			shader.setInputs(fragments[i], derivatives != nullptr ? &derivatives[i] : nullptr);
+			shader.Shader::main();
+			colors[i] = shader.out_color;
+		}
+	}
+
+	template<typename Shader>
+	std::unique_ptr<FragmentShader> InlineFragmentShader<Shader>::clone() const {
+		return std::make_unique<Shader>(static_cast<const Shader&>(*this));
+	}
+
 }
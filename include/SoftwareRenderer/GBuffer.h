@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+
+#include "Vertex.h"
+
+namespace sr {
+
+	// Interpolated fragment inputs of the visible surface of every pixel for deferred shading.
+	// The shader slot selects the fragment shader of the draw that wrote the pixel, -1 if there is nothing to shade.
+	class GBuffer {
+	private:
+
+		int width = 0;
+		int height = 0;
+
+		std::unique_ptr<Vertex[]> fragments;
+		std::unique_ptr<int[]> shaders;
+
+	public:
+
+		GBuffer() = default;
+
+		void resize(int width, int height);
+
+		void set(int x, int y, int shader, const Vertex& fragment);
+		void clear(int x, int y);
+		int getShader(int x, int y) const;
+		const Vertex& getFragment(int x, int y) const;
+
+		// Differences of the smooth varyings to the neighbors in the 2x2 quad of the pixel, like the derivatives of a GPU.
+		// If the neighbor in the quad belongs to another shader, the one on the other side is used, in both directions.
+		// Without a neighbor of the same shader the derivative is zero. The fallback reads outside of the quad,
+		// so no pixel may be cleared before every pixel of the buffer is shaded.
+		VaryingDerivatives getDerivatives(int x, int y) const;
+
+		int getWidth() const;
+		int getHeight() const;
+	};
+
+}
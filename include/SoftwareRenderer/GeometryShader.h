@@ -5,6 +5,8 @@
 
 #include <LeptonMath/Vector.h>
 
+#include "Vertex.h"
+
 namespace sr {
 
 	using vec2 = lm::Vector2f;
@@ -24,6 +26,11 @@ namespace sr {
 		std::array<vec4, 3> out_colors;
 		std::array<vec3, 3> out_normals;
 
+		// Declared varyings of the vertex shader, colors and normals are only used without them.
+		// out_varyings start as a copy of in_varyings.
+		std::array<std::array<float, VERTEX_MAX_VARYINGS>, 3> in_varyings;
+		std::array<std::array<float, VERTEX_MAX_VARYINGS>, 3> out_varyings;
+
 		virtual void main() = 0;
 		virtual std::unique_ptr<GeometryShader> clone() const = 0;
 		void reset();
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "Vertex.h"
+#include "ZBuffer.h"
+#include "Rect.h"
+#include "Simd.h"
+
+namespace sr {
+
+	#define HALF_SPACE_BLOCK_SIZE 8
+	#define HALF_SPACE_SUBPIXEL_BITS 4
+
+	// Rasterizes a screen space triangle with fixed point edge functions in 8x8 pixel blocks.
+	// Blocks outside of an edge are rejected, blocks inside of all edges skip the coverage test,
+	// only edges crossing a block are evaluated per pixel. Follows the top-left fill rule.
+	class HalfSpaceRasterizer {
+	private:
+
+		class Edge {
+		public:
+			// E(x, y) = stepX * x + stepY * y + offset at the center of pixel (x, y), inside if E >= 0
+			int64_t stepX;
+			int64_t stepY;
+			int64_t offset;
+		};
+
+		std::array<Edge, 3> edges = {};
+
+		// Attributes at the center of pixel (bounds.xMin, bounds.yMin) and their screen space derivatives
+		Vertex origin;
+		Vertex ddx;
+		Vertex ddy;
+
+		Rect bounds = {};
+
+		// Depth values of the lanes in the format of the depth buffer, encoded and loaded like ZBuffer does
+		template<DepthFormat Format>
+		static simd::vfloat encodeDepths(simd::vfloat z);
+		template<DepthFormat Format>
+		static simd::vfloat loadDepths(const typename DepthFormatTraits<Format>::Type* row);
+
+		template<DepthFormat Format, typename FragmentFunc>
+		void rasterizeFormat(const ZBuffer& zBuffer, bool hierarchicalZ, FragmentFunc&& fragment) const;
+
+	public:
+
+		// Returns false if the triangle exceeds the guard band and has to be rasterized otherwise
+		bool setup(const Vertex& v1, const Vertex& v2, const Vertex& v3, const Rect& clip);
+
+		const Rect& getBounds() const;
+
+		// Calls fragment(x, y, const Vertex&) for every covered pixel which passes the depth test.
+		// With hierarchicalZ, blocks behind the maximum depth of their ZBuffer tile are skipped.
+		// The depth test compares values of the format of the ZBuffer.
+		template<typename FragmentFunc>
+		void rasterize(const ZBuffer& zBuffer, bool hierarchicalZ, FragmentFunc&& fragment) const;
+	};
+
+
+	template<DepthFormat Format>
+	inline simd::vfloat HalfSpaceRasterizer::encodeDepths(simd::vfloat z) {
+		if constexpr (Format == DepthFormat::FLOAT32) {
+			return z;
+		}
+		else {
+			constexpr uint32_t max = DepthFormatTraits<Format>::MAX;
+			const simd::vfloat scaled = simd::mul(simd::add(z, simd::set1(1.0f)), simd::set1(float((max + 1) / 2)));
+			return simd::toFloat(simd::truncate(simd::min(simd::max(scaled, simd::set1(0.0f)), simd::set1(float(max)))));
+		}
+	}
+
+	template<DepthFormat Format>
+	inline simd::vfloat HalfSpaceRasterizer::loadDepths(const typename DepthFormatTraits<Format>::Type* row) {
+		if constexpr (Format == DepthFormat::FLOAT32) return simd::load(row);
+		else if constexpr (Format == DepthFormat::UNORM16) return simd::toFloat(simd::load(row));
+		else return simd::toFloat(simd::bitAnd(simd::load(reinterpret_cast<const int32_t*>(row)), simd::set1(int32_t(DepthFormatTraits<Format>::MAX))));
+	}
+
+	template<typename FragmentFunc>
+	void HalfSpaceRasterizer::rasterize(const ZBuffer& zBuffer, bool hierarchicalZ, FragmentFunc&& fragment) const {
+		switch (zBuffer.getFormat()) {
+		case DepthFormat::UNORM16: this->rasterizeFormat<DepthFormat::UNORM16>(zBuffer, hierarchicalZ, fragment); break;
+		case DepthFormat::UNORM24: this->rasterizeFormat<DepthFormat::UNORM24>(zBuffer, hierarchicalZ, fragment); break;
+		default: this->rasterizeFormat<DepthFormat::FLOAT32>(zBuffer, hierarchicalZ, fragment); break;
+		}
+	}
+
+	template<DepthFormat Format, typename FragmentFunc>
+	void HalfSpaceRasterizer::rasterizeFormat(const ZBuffer& zBuffer, bool hierarchicalZ, FragmentFunc&& fragment) const {
+		constexpr int blockSize = HALF_SPACE_BLOCK_SIZE;
+		constexpr int groups = blockSize / simd::LANES;
+		static_assert(blockSize % simd::LANES == 0);
+		static_assert(blockSize == ZBUFFER_TILE_SIZE, "Blocks have to match the depth hierarchy");
+
+		if (this->bounds.isEmpty()) return;
+
+		const float dzdx = this->ddx.getPosition().getZ();
+		const float dzdy = this->ddy.getPosition().getZ();
+		const float z0 = this->origin.getPosition().getZ();
+
+		const simd::vfloat zLaneStep = simd::mul(simd::toFloat(simd::laneIndex()), simd::set1(dzdx));
+		simd::vint edgeLaneStep[3];
+		for (int e = 0; e < 3; ++e) edgeLaneStep[e] = simd::mul(simd::laneIndex(), simd::set1(int32_t(this->edges[e].stepX)));
+
+		const int xOrigin = this->bounds.xMin;
+		const int yOrigin = this->bounds.yMin;
+		const int zWidth = zBuffer.getWidth();
+
+		for (int by = yOrigin & ~(blockSize - 1); by < this->bounds.yMax; by += blockSize) {
+			for (int bx = xOrigin & ~(blockSize - 1); bx < this->bounds.xMax; bx += blockSize) {
+
+				// Classify the block against every edge
+				std::array<int64_t, 3> corner;
+				std::array<bool, 3> crossing;
+				bool rejected = false;
+
+				for (int e = 0; e < 3; ++e) {
+					const auto& edge = this->edges[e];
+					corner[e] = edge.stepX * bx + edge.stepY * by + edge.offset;
+
+					const int64_t dx = edge.stepX * (blockSize - 1);
+					const int64_t dy = edge.stepY * (blockSize - 1);
+					const int64_t eMin = corner[e] + std::min<int64_t>(dx, 0) + std::min<int64_t>(dy, 0);
+					const int64_t eMax = corner[e] + std::max<int64_t>(dx, 0) + std::max<int64_t>(dy, 0);
+
+					rejected |= eMax < 0;
+					crossing[e] = eMin < 0;
+				}
+				if (rejected) continue;
+
+				// Nearest depth of the block is behind everything in its tile. The bound comes from the depth plane, not from
+				// the vertices, as pixels at the edges of the snapped triangle may lie in front of every vertex. It is lowered
+				// by the rounding error of its sum and the one of the lanes, so a pixel which set the tile maximum is never skipped.
+				if (hierarchicalZ) {
+					const float zCorner = z0 + float(by - yOrigin) * dzdy + float(bx - xOrigin) * dzdx;
+					const float zMin = zCorner + std::min(dzdx * (blockSize - 1), 0.0f) + std::min(dzdy * (blockSize - 1), 0.0f);
+					const float magnitude = std::abs(z0) + float(std::abs(by - yOrigin) + blockSize) * std::abs(dzdy) + float(std::abs(bx - xOrigin) + blockSize) * std::abs(dzdx);
+					const float zBound = zMin - 8.0f * std::numeric_limits<float>::epsilon() * magnitude;
+					if (ZBuffer::encode<Format>(zBound) > zBuffer.getTileMax(bx / blockSize, by / blockSize)) continue;
+				}
+
+				const int yBegin = std::max(by, this->bounds.yMin);
+				const int yEnd = std::min(by + blockSize, this->bounds.yMax);
+
+				for (int y = yBegin; y < yEnd; ++y) {
+					const auto* zRow = zBuffer.getRow<Format>(y);
+					const Vertex rowStart = this->origin + float(y - yOrigin) * this->ddy;
+
+					for (int g = 0; g < groups; ++g) {
+						const int x0 = bx + g * simd::LANES;
+
+						// Lanes inside the bounds
+						int mask = simd::FULL_MASK;
+						if (x0 < this->bounds.xMin) mask &= simd::FULL_MASK << std::min(this->bounds.xMin - x0, simd::LANES);
+						if (x0 + simd::LANES > this->bounds.xMax) mask &= simd::FULL_MASK >> std::min(x0 + simd::LANES - this->bounds.xMax, simd::LANES);
+						if (mask == 0) continue;
+
+						// Coverage, only for edges crossing the block. Values stay small inside a crossed block.
+						simd::vint outside = simd::set1(0);
+						for (int e = 0; e < 3; ++e) {
+							if (!crossing[e]) continue;
+							const int64_t e0 = corner[e] + this->edges[e].stepY * (y - by) + this->edges[e].stepX * (x0 - bx);
+							outside = simd::bitOr(outside, simd::add(simd::set1(int32_t(e0)), edgeLaneStep[e]));
+						}
+						mask &= ~simd::signMask(outside);
+						if (mask == 0) continue;
+
+						// Depth test
+						const simd::vfloat z = simd::add(simd::set1(z0 + float(y - yOrigin) * dzdy + float(x0 - xOrigin) * dzdx), zLaneStep);
+						alignas(32) float zLanes[simd::LANES];
+						simd::store(zLanes, z);
+						if (x0 >= 0 && x0 + simd::LANES <= zWidth) {
+							mask &= simd::lessEqualMask(encodeDepths<Format>(z), loadDepths<Format>(zRow + x0));
+						}
+						else {
+							for (int lane = 0; lane < simd::LANES; ++lane) {
+								if ((mask >> lane & 1) && !(ZBuffer::encode<Format>(zLanes[lane]) <= ZBuffer::load<Format>(zRow, x0 + lane))) mask &= ~(1 << lane);
+							}
+						}
+
+						while (mask != 0) {
+							const int lane = std::countr_zero(unsigned(mask));
+							mask &= mask - 1;
+
+							// The tested depth is passed on, so an equal depth test of a later pass sees the same value
+							const int x = x0 + lane;
+							Vertex interpolated = rowStart + float(x - xOrigin) * this->ddx;
+							interpolated.position[2] = zLanes[lane];
+							fragment(x, y, interpolated);
+						}
+					}
+				}
+			}
+		}
+	}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+namespace sr {
+
+	// Shared by the binary file formats
+	#define FILE_ENDIAN_TAG 0x01020304u // written as uint32_t, files of the other byte order do not match
+	#define FILE_SECTION_ALIGNMENT 64 // sections start at multiples of it, so they can be used in place from a mapping
+
+	// Read only memory mapping of a whole file
+	class MappedFile {
+	private:
+		const char* data = nullptr;
+		size_t size = 0;
+		bool open = false;
+
+	#ifdef _WIN32
+		void* file = nullptr;
+		void* mapping = nullptr;
+	#endif
+
+	public:
+		MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile& file) = delete;
+		MappedFile& operator=(const MappedFile& file) = delete;
+
+		bool isOpen() const;
+		std::string_view getView() const;
+	};
+
+	// Writes to a temporary file which is renamed to path, readers never see a partial file
+	bool writeFileAtomically(const std::string& path, std::string_view bytes);
+
+	inline size_t alignFileOffset(size_t offset) {
+		return (offset + FILE_SECTION_ALIGNMENT - 1) / FILE_SECTION_ALIGNMENT * FILE_SECTION_ALIGNMENT;
+	}
+
+}
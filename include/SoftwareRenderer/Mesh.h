@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <cstdint>
+
+#include <LeptonMath/Vector.h>
+
+#include "DataBuffer.h"
+#include "MeshCluster.h"
+
+namespace sr {
+
+	#define MESH_FILE_VERSION 3 // 2: OBJ caches are stored optimized, 3: clusters
+
+	enum class MeshAttribute : uint32_t {
+		POSITION = 0,
+		NORMAL = 1,
+		TEXCOORD = 2,
+		COLOR = 3
+	};
+
+	// Triangle mesh in the binary mesh format.
+	// A loaded mesh references the mapped file, its buffers point into the mapping without copying.
+	//
+	// Format, little endian, every section starts at a multiple of 64 bytes:
+	//   header: magic "SRMF", version, endian tag, attribute count, vertex count, triangle count, index offset, flags, bounds, cluster count, cluster offset
+	//   attribute table: semantic, components, offset for every attribute
+	//   attribute data: vertexCount * components floats per attribute
+	//   index data: triangleCount * 3 ints
+	//   cluster data: triangle offset, triangle count, bounding sphere and normal cone of every cluster
+	class Mesh {
+		friend std::optional<Mesh> parseMesh(std::shared_ptr<const void> owner, std::string_view bytes);
+	private:
+		class Attribute {
+		public:
+			MeshAttribute semantic;
+			uint32_t components;
+			const float* data;
+		};
+
+		std::shared_ptr<const void> owner; // mapped file or memory of the mesh
+		std::vector<Attribute> attributes;
+		const int* indices = nullptr;
+		std::vector<MeshCluster> clusters;
+
+		size_t vertexCount = 0;
+		size_t triangleCount = 0;
+
+		bool boundsValid = false;
+		lm::Vector3f boundsMin = {};
+		lm::Vector3f boundsMax = {};
+
+		const Attribute* findAttribute(MeshAttribute semantic) const;
+
+	public:
+		Mesh() = default;
+
+		bool hasAttribute(MeshAttribute semantic) const;
+
+		// Buffers share the memory of the mesh, layout has to match the number of components
+		template<size_t layout>
+		FloatDataBuffer<layout> getAttribute(MeshAttribute semantic) const;
+		IntegerDataBuffer<3> getIndices() const;
+		const std::vector<MeshCluster>& getClusters() const; // empty if the file has none
+
+		size_t getVertexCount() const;
+		size_t getTriangleCount() const;
+
+		bool hasBounds() const;
+		const lm::Vector3f& getBoundsMin() const;
+		const lm::Vector3f& getBoundsMax() const;
+	};
+
+	class MeshAttributeData {
+	public:
+		MeshAttribute semantic;
+		uint32_t components;
+		const std::vector<float>& data;
+	};
+
+	// Serializes vertex attributes and triangle indices, the bounds are computed from the POSITION attribute
+	std::vector<char> serializeMesh(const std::vector<MeshAttributeData>& attributes, const std::vector<int>& indices, const std::vector<MeshCluster>& clusters = {});
+	std::optional<Mesh> parseMesh(std::shared_ptr<const void> owner, std::string_view bytes);
+
+	bool saveMesh(const std::string& path, const std::vector<MeshAttributeData>& attributes, const std::vector<int>& indices, const std::vector<MeshCluster>& clusters = {});
+	std::optional<Mesh> loadMesh(const std::string& path);
+
+
+	template<size_t layout>
+	FloatDataBuffer<layout> Mesh::getAttribute(MeshAttribute semantic) const {
+		auto attribute = this->findAttribute(semantic);
+		if (attribute == nullptr || attribute->components != layout) return {};
+		return FloatDataBuffer<layout>(this->owner, attribute->data, this->vertexCount * layout);
+	}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <LeptonMath/Vector.h>
+#include <LeptonMath/Matrix.h>
+
+namespace sr {
+
+	#define MESH_CLUSTER_SIZE 64 // maximum triangles per cluster
+	#define MESH_CLUSTER_CONE_WEIGHT 4.0f // preference of similar normals over shared vertices when growing clusters
+
+	// Consecutive triangles of an index buffer with bounds for culling them together
+	class MeshCluster {
+	public:
+		uint32_t triangleOffset;
+		uint32_t triangleCount;
+
+		lm::Vector3f center; // bounding sphere
+		float radius;
+
+		lm::Vector3f coneAxis; // all face normals lie within the cone around the axis
+		float coneCutoff; // sine of the cone angle, 1 if the normals spread over more than a hemisphere
+	};
+
+	// Groups connected triangles with similar normals and reorders the indices cluster by cluster.
+	// Clusters are started in index order, so the coarse order of optimizeMesh is kept.
+	std::vector<MeshCluster> buildMeshClusters(std::vector<int>& indices, const std::vector<float>& positions, size_t clusterSize = MESH_CLUSTER_SIZE);
+
+	// Conservative visibility test of clusters for a transformation from object to clip space.
+	// Clusters are rejected if they lie outside of the view frustum or if all their triangles are back faces.
+	class ClusterCuller {
+	private:
+		std::vector<lm::Vector4f> planes; // object space, inside where dot(plane, (p, 1)) >= 0
+		lm::Vector3f eye; // object space camera position
+		float orientation = 0; // sign of dot(face normal, p - eye) of back faces, 0 disables the cone test
+
+	public:
+		// The side planes are widened by a pixel of a viewport of width x height
+		ClusterCuller(const lm::Matrix4x4f& objectToClip, int width, int height, bool backfaceCulling);
+
+		bool isVisible(const MeshCluster& cluster) const;
+	};
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace sr {
+
+	#define MESH_OPTIMIZER_CACHE_SIZE 16 // entries of the simulated post transform vertex cache
+	#define MESH_OPTIMIZER_OVERDRAW_THRESHOLD 1.05f // cache miss ratio a cluster may lose to the overdraw order
+
+	// Vertex attribute that is reordered together with the positions
+	class MeshStream {
+	public:
+		std::vector<float>& data;
+		uint32_t components;
+	};
+
+	// Average cache miss ratio: transformed vertices per triangle with a FIFO cache of cacheSize entries
+	float getCacheMissRatio(const std::vector<int>& indices, size_t vertexCount, size_t cacheSize = MESH_OPTIMIZER_CACHE_SIZE);
+
+	// Reorders the triangles for vertex reuse (Tipsify).
+	// clusters receives the first triangle of every run that starts with an empty cache.
+	std::vector<int> optimizeVertexCache(const std::vector<int>& indices, size_t vertexCount, std::vector<size_t>* clusters = nullptr);
+
+	// Sorts the clusters of a vertex cache optimized index buffer so outward facing clusters come first.
+	// Clusters are split further as long as their cache miss ratio stays within threshold times the original one.
+	std::vector<int> optimizeOverdraw(const std::vector<int>& indices, const std::vector<float>& positions, const std::vector<size_t>& clusters, float threshold = MESH_OPTIMIZER_OVERDRAW_THRESHOLD);
+
+	// Numbers the vertices in the order of their first use and rewrites the indices.
+	// Returns the new index of every old vertex, -1 for unreferenced vertices.
+	std::vector<int> optimizeVertexFetch(std::vector<int>& indices, size_t vertexCount);
+	void remapVertexAttribute(std::vector<float>& data, size_t components, const std::vector<int>& remap);
+
+	// All three passes, positions have 3 components
+	void optimizeMesh(std::vector<int>& indices, std::vector<float>& positions, const std::vector<MeshStream>& attributes = {});
+
+}
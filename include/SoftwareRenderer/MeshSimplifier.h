@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include <LeptonMath/Vector.h>
+#include <LeptonMath/Matrix.h>
+
+#include "ModelLoader.h"
+
+namespace sr {
+
+	#define MESH_LOD_COUNT 6 // levels including the full mesh
+	#define MESH_LOD_REDUCTION 0.5f // triangles of a level relative to the previous one
+	#define MESH_LOD_PIXEL_ERROR 1.0f // default projected error budget in pixels
+
+	// Simplified index buffer, references the vertices of the full mesh
+	class MeshLod {
+	public:
+		std::vector<int> indices;
+		float error; // object space deviation from the full mesh
+	};
+
+	// Levels from the full mesh to the coarsest one with the bounding sphere of the mesh
+	class MeshLodChain {
+	public:
+		std::vector<MeshLod> levels;
+		lm::Vector3f center;
+		float radius;
+	};
+
+	// Collapses edges by their quadric error until targetTriangleCount is reached or no collapse keeps the surface orientation.
+	// Vertices are only moved onto other vertices, so the result uses the existing vertex buffer. Borders are kept.
+	std::vector<int> simplifyMesh(const std::vector<int>& indices, const std::vector<float>& positions, size_t targetTriangleCount, float* error = nullptr);
+
+	// Every level is simplified from the previous one, the chain ends early when a level can not be reduced any further
+	MeshLodChain generateLods(const std::vector<int>& indices, const std::vector<float>& positions, size_t levelCount = MESH_LOD_COUNT);
+	MeshLodChain generateLods(const Model3D& model, size_t levelCount = MESH_LOD_COUNT);
+
+	// Coarsest level whose error projected by objectToClip onto a width x height viewport stays within pixelError pixels
+	size_t selectLod(const MeshLodChain& chain, const lm::Matrix4x4f& objectToClip, int width, int height, float pixelError = MESH_LOD_PIXEL_ERROR);
+
+}
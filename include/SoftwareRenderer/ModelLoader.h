@@ -6,10 +6,33 @@
 #include <string>
 #include <optional>
 
+#include "Mesh.h"
+
 namespace sr {
 
 	using Model3D = std::tuple<std::vector<float>, std::vector<int>>;
 
+	// Indexed triangle mesh of an OBJ file, every vertex is a unique (position, texture coordinate, normal) tuple
+	class ObjModel {
+	public:
+		std::vector<float> positions; // 3 per vertex
+		std::vector<float> texCoords; // 2 per vertex, empty if the faces have none
+		std::vector<float> normals; // 3 per vertex, empty if the faces have none
+		std::vector<int> indices; // 3 per triangle
+	};
+
+	// Positions as in the file and the triangulated position indices of the faces
 	std::optional<Model3D> loadObj(const std::string& path);
 
+	// Reads positions, texture coordinates and normals, triangulates polygons and deduplicates the vertices
+	std::optional<ObjModel> loadObjModel(const std::string& path);
+
+	// Per vertex normals, the sum of the adjacent face normals weighted by area
+	std::vector<float> generateNormals(const std::vector<float>& positions, const std::vector<int>& indices);
+
+	// Loads an OBJ file through the binary mesh cache "<path>.srmesh", normals are generated if the file has none.
+	// The cache is mapped when it is newer than the OBJ file, otherwise it is rebuilt.
+	// Triangles and vertices are stored in the order of optimizeMesh, grouped into the clusters of buildMeshClusters.
+	std::optional<Mesh> loadObjCached(const std::string& path);
+
 }
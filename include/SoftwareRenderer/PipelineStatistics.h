@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+namespace sr {
+
+	// Statistics are compiled in with the CMake option SR_ENABLE_STATISTICS only, otherwise SR_STATISTICS drops its statement
+	#ifdef SR_ENABLE_STATISTICS
+		#define SR_STATISTICS(...) __VA_ARGS__
+	#else
+		#define SR_STATISTICS(...)
+	#endif
+
+	// Counters and timers of one frame, similar to GPU pipeline statistics queries.
+	// Every job counts into its own instance, the instances are summed up at the end of the job.
+	class PipelineStatistics {
+	public:
+		// Vertex stage
+		uint64_t shadedVertices = 0;
+
+		// Cluster culling before the vertex stage
+		uint64_t culledClusters = 0;
+		uint64_t clusterCulledTriangles = 0;
+
+		// Primitive assembly
+		uint64_t inputTriangles = 0;
+		uint64_t culledTriangles = 0; // back faces
+		uint64_t clippedTriangles = 0; // completely outside of the view volume
+		uint64_t splitTriangles = 0; // clipped into two triangles
+		uint64_t occludedTriangles = 0; // rejected by the hierarchical depth buffer
+		uint64_t rasterizedTriangles = 0;
+
+		// Fragments
+		uint64_t shadedFragments = 0;
+		uint64_t earlyRejectedFragments = 0; // off the completed depth buffer of DepthMode::EQUAL, rejected before shading
+		uint64_t depthRejectedFragments = 0; // hidden when written, forward shaded fragments were shaded before
+		uint64_t writtenFragments = 0;
+		uint64_t resolveRetries = 0; // compare-and-swaps of TRIANGLE_BATCHES_ATOMIC repeated after another thread wrote the pixel
+
+		// Wall clock time of the stages in nanoseconds
+		uint64_t vertexTime = 0;
+		uint64_t geometryTime = 0; // assembly and binning, included in rasterizationTime for TRIANGLE_BATCHES
+		uint64_t rasterizationTime = 0;
+		uint64_t resolveTime = 0; // deferred shading pass
+		uint64_t frameTime = 0; // beginFrame to endFrame
+
+		// Summed over all threads in nanoseconds
+		uint64_t frameBufferLockWaitTime = 0;
+
+		void add(const PipelineStatistics& statistics);
+
+		static uint64_t now(); // nanoseconds of a monotonic clock
+	};
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+namespace sr {
+
+	class Rect {
+	public:
+		int xMin;
+		int yMin;
+		int xMax; // exclusive
+		int yMax; // exclusive
+
+		bool isEmpty() const;
+	};
+
+}
@@ -2,6 +2,9 @@
 
 #include <vector>
 #include <memory>
+#include <cstdint>
+
+#include <LeptonMath/Matrix.h>
 
 #include "Renderer.h"
 #include "DataBuffer.h"
@@ -9,24 +12,72 @@
 #include "VertexShader.h"
 #include "FragmentShader.h"
 #include "GeometryShader.h"
+#include "MeshCluster.h"
+#include "MeshSimplifier.h"
+#include "CommandBuffer.h"
+#include "Texture.h"
 
 #include "BufferManager.h"
 
 namespace sr {
 
+	#define VERTEX_BATCH_SIZE 1024
 
 	class RenderPipeline {
 	private:
 		Renderer renderer;
 
 		std::weak_ptr<VertexShader> vertexShader;
+		std::weak_ptr<FragmentShader> fragmentShader;
+		std::weak_ptr<GeometryShader> geometryShader;
+		std::vector<float> transformedVertices; // packed, see VertexStream
 
 		std::shared_ptr<BufferManager> bufferManager;
 		std::vector<IntegerDataBuffer<3>> indexBufferList;
+		std::vector<std::vector<MeshCluster>> clusterBufferList;
+		std::vector<MeshLodChain> lodBufferList;
+		std::vector<std::unique_ptr<Texture>> textureList;
+		std::array<int, TEXTURE_MAX_UNITS> boundTextures; // -1 if a unit is unbound
+
+		bool clusterCullingEnabled = true;
+		bool cullingTransformValid = false;
+		lm::Matrix4x4f cullingTransform;
+		std::vector<int> visibleIndices;
+		std::vector<uint8_t> visibleVertices;
+		float lodPixelError = MESH_LOD_PIXEL_ERROR;
 
 		std::vector<BufferArray> bufferArrays;
 		int currentBufferArray = -1;
 
+		DepthMode depthMode = DepthMode::LESS;
+		bool depthPrepassEnabled = false;
+
+		bool commandSortingEnabled = true;
+		std::vector<int> commandIndices; // merged indices of the draws of a submission
+		std::vector<std::vector<uint8_t>> commandVisibleVertices;
+
+		// Vertices of a draw in transformedVertices
+		class VertexRange {
+		public:
+			VertexShader* shader;
+			size_t offset; // first float
+			size_t vertexCount;
+			size_t instanceCount;
+			const uint8_t* visibleVertices; // only marked vertices are shaded, nullptr shades all of them
+		};
+
+		// Index buffer after level of detail selection and cluster culling, partial is set if only the marked visibleVertices are referenced
+		IntegerDataBuffer<3> selectIndices(const BufferArray& bufferArray, bool cullingTransformValid, const lm::Matrix4x4f& cullingTransform, size_t vertexCount, std::vector<uint8_t>& visibleVertices, bool& partial);
+
+		// Runs the vertex shaders of all ranges in one dispatch
+		void shadeVertices(const std::vector<VertexRange>& ranges);
+
+		// Textures of the ids, nullptr for invalid ids
+		TextureUnits getTextureUnits(const std::array<int, TEXTURE_MAX_UNITS>& textureIDs) const;
+
+		// Renders the transformed vertices, triangles go through the depth pre-pass if it is enabled
+		void renderIndexed(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceCount = 1);
+
 	public:
 		
 		RenderPipeline();
@@ -35,46 +86,107 @@ namespace sr {
 		void bindBufferArray(int bufferArrayID);
 
 		int createIndexBuffer(const std::vector<int>& data);
+		int createIndexBuffer(const IntegerDataBuffer<3>& buffer);
 		void bindIndexBuffer(int bufferID);
 
+		// Clusters of the index buffer, see buildMeshClusters
+		int createClusterBuffer(std::vector<MeshCluster> clusters);
+		void bindClusterBuffer(int bufferID);
+
+		// Simplified index buffers of the bound vertex buffers, see generateLods
+		int createLodBuffer(MeshLodChain chain);
+		void bindLodBuffer(int bufferID);
+
+		// Textures are sampled by the fragment shader through the units they are bound to, see FragmentShader::sampleTexture.
+		// -1 unbinds a unit.
+		int createTexture(Texture texture);
+		void bindTexture(int unit, int textureID);
+
 
 		void bindVertexShader(std::weak_ptr<VertexShader> vs);
 		void bindFragmentShader(std::weak_ptr<FragmentShader> fs);
 		void bindGeometryShader(std::weak_ptr<GeometryShader> gs);
 
 		void storeBufferInBufferArray(int index, int bufferID);
+		void storeInstanceBufferInBufferArray(int index, int bufferID);
 
+		void setRenderSurface(std::weak_ptr<RenderSurface> surface);
 		void setRenderSurface(std::weak_ptr<pw::PixelWindow> window);
 		void enableBackfaceCulling();
 		void disableBackfaceCulling();
+		void setRasterizationMode(RasterizationMode mode);
+		void setRasterizer(RasterizerType type);
+		void setShadingMode(ShadingMode mode);
+		void setDepthMode(DepthMode mode);
+		void enableHierarchicalZ();
+		void disableHierarchicalZ();
+		void setThreadCount(size_t threadCount); // 0 picks the hardware concurrency
+		size_t getThreadCount() const; // render threads and the calling thread
+		void enableStatistics();
+		void disableStatistics();
+		const PipelineStatistics& getStatistics() const;
+
+		// Clusters of the bound cluster buffer are culled before vertex shading if a culling transform is set.
+		// The transform has to match the vertex shader, frustum culling assumes the geometry shader keeps positions on screen.
+		void enableClusterCulling();
+		void disableClusterCulling();
+		void setCullingTransform(const lm::Matrix4x4f& objectToClip);
+
+		// With a bound lod buffer the level is selected by the culling transform, a level above 0 replaces the index buffer
+		// and is drawn without cluster culling
+		void setLodPixelError(float pixelError);
+
+		// With LESS depth, triangles are first rendered depth only and then shaded with the EQUAL depth test,
+		// so every pixel runs the fragment shader once per draw. A submission shares one pre-pass for all of its draws.
+		void enableDepthPrepass();
+		void disableDepthPrepass();
 
 		void beginFrame();
 		void endFrame();
 
 		void draw(RenderMode mode, int vertexCount);
 
+		// Draws the bound index buffer instanceCount times, the vertex shader reads per instance data with getInstanceAttribute.
+		// Triangles of all instances are rasterized as one workload. Cluster and lod buffers are ignored.
+		void drawInstanced(RenderMode mode, int vertexCount, int instanceCount);
+
+		// Executes recorded draws. Neighboring draws with the same fragment shader, textures, geometry shader, render mode and
+		// varyings are shaded and rasterized as one workload. With command sorting enabled, draws are first ordered by these
+		// states, so the result can differ from the recorded order where triangles have equal depth.
+		void submit(const CommandBuffer& commandBuffer);
+		void submit(const std::vector<const CommandBuffer*>& commandBuffers);
+		void enableCommandSorting();
+		void disableCommandSorting();
+
 		template<size_t layout>
 		int bufferFloatData(const std::vector<float>& data);
 
+		// Shares the storage of the buffer, e.g. a mapped mesh file
+		template<size_t layout>
+		int bufferFloatData(const FloatDataBuffer<layout>& buffer);
+
 	};
 
 
 	template<size_t layout>
 	int RenderPipeline::bufferFloatData(const std::vector<float>& data) {
-		switch (layout){
-		case 2: 
-			this->bufferManager->buffer2f.emplace_back(FloatDataBuffer<2>(data));
+		return this->bufferFloatData<layout>(FloatDataBuffer<layout>(data));
+	}
+
+	template<size_t layout>
+	int RenderPipeline::bufferFloatData(const FloatDataBuffer<layout>& buffer) {
+		if constexpr (layout == 2) {
+			this->bufferManager->buffer2f.push_back(buffer);
 			return this->bufferManager->buffer2f.size() - 1;
-		case 3:
-			this->bufferManager->buffer3f.emplace_back(FloatDataBuffer<3>(data));
+		}
+		else if constexpr (layout == 3) {
+			this->bufferManager->buffer3f.push_back(buffer);
 			return this->bufferManager->buffer3f.size() - 1;
-		case 4:
-			this->bufferManager->buffer4f.emplace_back(FloatDataBuffer<4>(data));
+		}
+		else {
+			static_assert(layout == 4, "Illegal data layout");
+			this->bufferManager->buffer4f.push_back(buffer);
 			return this->bufferManager->buffer4f.size() - 1;
-		default:
-			assert(false, "Illegal data layout");
-			return -1;
-			break;
 		}
 	}
 
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace sr {
+
+	enum class PixelFormat {
+		RGBA8, // bytes in memory R, G, B, A
+		BGRA8 // bytes in memory B, G, R, A
+	};
+
+	enum class DepthFormat {
+		FLOAT32,
+		UNORM16,
+		UNORM24 // lower 24 bits of 32, the upper 8 bits are spare
+	};
+
+	// Color target of the renderer.
+	// The pixels are plain memory, rows of width pixels, written by the rasterizer without any virtual call.
+	// Implementations provide the memory and may present it at the end of a frame.
+	class RenderSurface {
+	protected:
+		int width = 0;
+		int height = 0;
+		PixelFormat pixelFormat = PixelFormat::RGBA8;
+		DepthFormat depthFormat = DepthFormat::FLOAT32; // of the depth buffer the renderer keeps for this surface
+
+		uint32_t* pixels = nullptr;
+
+	public:
+		virtual ~RenderSurface() = default;
+
+		virtual void beginFrame();
+		virtual void endFrame();
+
+		void setPixel(int x, int y, uint32_t color);
+		uint32_t getPixel(int x, int y) const;
+		void clear(uint32_t color);
+
+		uint32_t* getPixels();
+		const uint32_t* getPixels() const;
+		uint32_t* getRow(int y);
+		const uint32_t* getRow(int y) const;
+
+		int getWidth() const;
+		int getHeight() const;
+		PixelFormat getPixelFormat() const;
+
+		void setDepthFormat(DepthFormat format);
+		DepthFormat getDepthFormat() const;
+	};
+
+
+	inline void RenderSurface::setPixel(int x, int y, uint32_t color) {
+		this->pixels[size_t(y) * this->width + x] = color;
+	}
+
+	inline uint32_t RenderSurface::getPixel(int x, int y) const {
+		return this->pixels[size_t(y) * this->width + x];
+	}
+
+}
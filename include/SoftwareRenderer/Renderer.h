@@ -4,21 +4,36 @@
 #include <utility>
 #include <array>
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
 
 #include <PixelWindow/PixelWindow.h>
 #include <LeptonMath/Vector.h>
 
 #include "Vertex.h"
+#include "RenderSurface.h"
+#include "WindowSurface.h"
 #include "DataBuffer.h"
 #include "FragmentShader.h"
 #include "GeometryShader.h"
 #include "ZBuffer.h"
+#include "GBuffer.h"
 #include "ThreadPool.h"
+#include "TileBinner.h"
+#include "HalfSpaceRasterizer.h"
+#include "PipelineStatistics.h"
+#include "MeshCluster.h"
+#include "MeshSimplifier.h"
 
 
 namespace sr {
 
 	#define BUFFER_SIZE 1024
+	#define TILE_SIZE 64
+	#define HIERARCHICAL_Z_REFRESH_INTERVAL 16 // triangles rendered in a tile between depth hierarchy updates
+	#define DEFERRED_RESOLVE_ROWS 8 // rows claimed at once by a thread of the deferred shading pass
+	#define FRAGMENT_BATCH_SIZE 64 // fragments passed to the fragment shader at once, see FragmentShader::shadeFragments
 
 	typedef lm::Vector<int, 2> Point2D;
 
@@ -27,6 +42,28 @@ namespace sr {
 		TRIANGLE_WIREFRAME
 	};
 
+	enum class RasterizationMode {
+		TRIANGLE_BATCHES, // every thread rasterizes a batch of triangles, fragments are resolved under a lock
+		TRIANGLE_BATCHES_ATOMIC, // like TRIANGLE_BATCHES, fragments are resolved with a compare-and-swap on a packed depth and color per pixel
+		SCREEN_TILES // triangles are binned to screen tiles, every tile is rasterized by exactly one thread
+	};
+
+	enum class ShadingMode {
+		FORWARD, // fragments are shaded when they pass the depth test during rasterization
+		DEFERRED // fragments are stored in a G-buffer, the visible ones are shaded once at the end of the frame
+	};
+
+	enum class DepthMode {
+		LESS, // fragments in front of the depth buffer are shaded, written and update the depth
+		DEPTH_ONLY, // like LESS without fragment shader and color writes, e.g. for shadow maps or a depth pre-pass
+		EQUAL // fragments at exactly the depth of a completed depth buffer are shaded, the depth is not written
+	};
+
+	enum class RasterizerType {
+		SCANLINE, // splits triangles into flat top and flat bottom halves and walks their spans
+		HALF_SPACE // evaluates edge functions on pixel blocks with SIMD
+	};
+
 	class Renderer {
 	private:
 
@@ -47,72 +84,181 @@ namespace sr {
 
 			std::array<Fragment, size> buffer = { 0 };
 			int index = 0;
+
+			Rect clipRect = {};
+			bool directWrite = false; // the context owns clipRect exclusively and writes without batching
+
+			int deferredShader = -1; // G-buffer shader slot of the draw in deferred shading, -1 shades immediately
+			std::vector<Vertex> deferredFragments; // inputs of the buffered fragments in deferred shading
+
+			// Fragments that passed the early depth test and wait for the fragment shader. Their depth is tested again
+			// when they are written, so shading them after later triangles were rasterized does not change the result.
+			std::array<Vertex, FRAGMENT_BATCH_SIZE> shadingInputs;
+			std::array<Point2D, FRAGMENT_BATCH_SIZE> shadingPositions;
+			std::array<lm::Vector4f, FRAGMENT_BATCH_SIZE> shadingColors;
+			size_t shadingCount = 0;
+
+			// Derivatives of the current triangle and of the waiting fragments, only if the fragment shader uses them
+			VaryingDerivatives triangleDerivatives;
+			std::array<VaryingDerivatives, FRAGMENT_BATCH_SIZE> shadingDerivatives;
+
+			SR_STATISTICS(PipelineStatistics statistics;)
 		public:
 			bool isFull() const;
 			void addPixel(int x, int y, int color, float depth);
+			void addDeferredPixel(int x, int y, float depth, const Vertex& fragment);
 			void reset();
 			const std::array<Renderer::Fragment, size>& getBuffer() const;
 			int getIndex() const;
 		};
 
-		ThreadPool<16> renderPool;
-		//  FPS Full HD 
-		//				Dragon		Bunny
-		//  1 Thread :	21 FPS		95  FPS
-		//  2 Threads:	35 FPS		129 FPS
-		//  4 Threads:	50 FPS		142 FPS
-		//  8 Threads:	55 FPS		140 FPS
-		// 16 Threads:	56 FPS		138 FPS
+		std::unique_ptr<ThreadPool> renderPool = std::make_unique<ThreadPool>();
+		// Performance is measured with the SoftwareRenderer_bench target
 
-		std::weak_ptr<pw::PixelWindow> frameBuffer;
+		std::weak_ptr<RenderSurface> frameBuffer;
+		std::shared_ptr<WindowSurface> windowSurface; // presents on a PixelWindow set as render surface
 		ZBuffer zBuffer;
 
 		std::mutex frameBufferLock;
 
+		// Depth and color of every pixel for TRIANGLE_BATCHES_ATOMIC, the depth in the upper half ordered like an unsigned integer.
+		// A tile of TILE_SIZE is loaded from the depth buffer and render surface by the first fragment of a draw that reaches it,
+		// the loaded tiles are stored back after the draw.
+		std::unique_ptr<std::atomic<uint64_t>[]> resolveBuffer;
+		std::unique_ptr<std::atomic<uint8_t>[]> resolveTiles;
+		size_t resolveBufferSize = 0;
+		int resolveTilesX = 0;
+		int resolveTileCount = 0;
+		bool atomicResolve = false; // the current draw writes to the resolve buffer
+
+		RasterizationMode rasterizationMode = RasterizationMode::TRIANGLE_BATCHES;
+		RasterizerType rasterizerType = RasterizerType::SCANLINE;
+
+		DepthMode depthMode = DepthMode::LESS;
+		ShadingMode shadingMode = ShadingMode::FORWARD;
+		GBuffer gBuffer;
+		std::vector<std::unique_ptr<FragmentShader>> deferredShaders; // fragment shaders of the deferred draws of this frame
+		int currentDeferredShader = -1;
+
+		TileBinner tileBinner{ TILE_SIZE };
+		std::vector<std::vector<std::array<Vertex, 3>>> binnedTriangles; // screen space triangles of every bin producer
+
 		std::weak_ptr<FragmentShader> fragmentShader;
 		std::weak_ptr<GeometryShader> geometryShader;
+		TextureUnits textures = {};
 
 		bool backfaceCullingEnabled = true;
+		bool hierarchicalZEnabled = false; // the refresh and tests cost more than they save on the bench scenes
+		bool statisticsEnabled = false;
+
+		PipelineStatistics statistics; // of the last finished frame
+		SR_STATISTICS(
+			PipelineStatistics frameStatistics;
+			std::mutex statisticsLock;
+			uint64_t frameBegin = 0;
+		)
+
+		// depth is a value of the depth buffer, see ZBuffer::encode
+		bool testDepth(int x, int y, float depth) const;
+		void renderPixel(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, int color, float depth);
+		void flushPixels(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext);
+		void resolvePixels(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext); // flushPixels without the lock
+		void loadResolveTile(const std::shared_ptr<RenderSurface>& fb, int tile);
+		void storeResolveTiles(const std::shared_ptr<RenderSurface>& fb);
+		Rect getResolveTileRect(const std::shared_ptr<RenderSurface>& fb, int tile) const;
+		void renderDeferredPixel(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, const Vertex& fragment);
+		void resolveDeferred(const std::shared_ptr<RenderSurface>& fb);
+
+		bool initBatchContext(RenderMode mode, RenderBatchContext<BUFFER_SIZE>& batchContext, bool needsFragmentShader);
+		size_t assembleTriangle(RenderMode mode, RenderBatchContext<BUFFER_SIZE>& batchContext, int width, int height, const Vertex& v1, const Vertex& v2, const Vertex& v3, std::array<std::array<Vertex, 3>, 2>& out);
+		void rasterizeTriangle(RenderMode mode, const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const std::array<Vertex, 3>& triangle);
+
+		// Triangle parallel rendering
+		void renderIndexedBatch(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceVertexCount, size_t batchBegin, size_t batchSize);
 
-		void renderPixel(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, int color, float depth);
+		// Tile parallel rendering
+		void binIndexedBatch(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceVertexCount, size_t bin, size_t batchBegin, size_t batchSize);
+		void renderTile(RenderMode mode, int tile);
+		Rect getTriangleBounds(const Vertex& v1, const Vertex& v2, const Vertex& v3, int width, int height) const;
+		float getMinDepth(const Vertex& v1, const Vertex& v2, const Vertex& v3) const;
 
 		// For wireframe rendering
-		void renderLine(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int xBegin, int yBegin, int xEnd, int yEnd, int color);
-		void renderTriangleWireframe(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3);
-		void renderIndexedTriangleWireframeBatch(const std::vector<Vertex>& vertices, const IntegerDataBuffer<3>& indices, size_t batchBegin, size_t batchSize);
+		void renderLine(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int xBegin, int yBegin, int xEnd, int yEnd, int color);
+		void renderTriangleWireframe(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3);
 
 		// For triangle rendering
-		void renderIndexedTriangleBatch(const std::vector<Vertex>& vertices, const IntegerDataBuffer<3>& indices, size_t batchBegin, size_t batchSize);
-		void renderTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3);
-		void renderFlatTopTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target);
-		void renderFlatBottomTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target);
-		void renderFlatTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int yBegin, int yEnd, Vertex edge1, Vertex edge2, const Vertex& dir1, const Vertex& dir2);
+		void renderTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3);
+		void renderFlatTopTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target);
+		void renderFlatBottomTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target);
+		void renderFlatTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int yBegin, int yEnd, const Vertex& edge1, const Vertex& edge2, const Vertex& dir1, const Vertex& dir2);
+		template<DepthFormat Format>
+		void renderFlatTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int yBegin, int yEnd, Vertex edge1, Vertex edge2, const Vertex& dir1, const Vertex& dir2);
+		void shadeFragment(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, const Vertex& fragment);
+		void shadeFragments(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext); // shades and writes the waiting fragments
 
 		Vertex transformViewport(const Vertex& vert, int viewportWidth, int viewportHeight) const;
 		std::array<std::reference_wrapper<const Vertex>, 3> sortVerticesY(const Vertex& v1, const Vertex& v2, const Vertex& v3) const;
 
 		Vertex lerp(const Vertex& v1, const Vertex& v2, float alpha) const;
-		int convertColor(const lm::Vector4f& color) const;
+		int convertColor(const lm::Vector4f& color, PixelFormat format) const;
 
 		std::pair<size_t, std::array<Vertex, 4>> clipTriangle(const Vertex& v1, const Vertex& v2, const Vertex& v3) const;
 
 		lm::Vector3f getSurfaceNormal(const Vertex& v1, const Vertex& v2, const Vertex& v3) const;
 
+		// Derivatives of the smooth varyings of a screen space triangle, they are constant as varyings are interpolated linearly
+		VaryingDerivatives getDerivatives(const Vertex& v1, const Vertex& v2, const Vertex& v3) const;
+
 		void checkZBufferSize();
+		void checkResolveBufferSize();
 
 	public:
+		// Runs job(0) to job(jobCount - 1) on the render threads and the calling thread, returns when all are done
+		template<typename Func>
+		void dispatch(size_t jobCount, Func&& job);
+
+		void setRenderSurface(std::weak_ptr<RenderSurface> surface);
 		void setRenderSurface(std::weak_ptr<pw::PixelWindow> window);
 		void enableBackfaceCulling();
 		void disableBackfaceCulling();
+		void setRasterizationMode(RasterizationMode mode);
+		void setRasterizer(RasterizerType type);
+		void setShadingMode(ShadingMode mode);
+		void setDepthMode(DepthMode mode);
+		void enableHierarchicalZ();
+		void disableHierarchicalZ();
+		void setThreadCount(size_t threadCount); // 0 picks the hardware concurrency
+		size_t getThreadCount() const; // render threads and the calling thread
+
+		// Statistics are only collected when compiled with SR_ENABLE_STATISTICS
+		void enableStatistics();
+		void disableStatistics();
+		const PipelineStatistics& getStatistics() const;
+		void addStatistics(const PipelineStatistics& statistics); // adds to the current frame
 
 		void bindFragmentShader(std::weak_ptr<FragmentShader> fs);
 		void bindGeometryShader(std::weak_ptr<GeometryShader> gs);
+		void bindTextures(const TextureUnits& textures); // sampled by the fragment shaders of the following draws
 
 		void beginFrame();
 		void endFrame();
 
+		// Appends the indices of the clusters that may be visible when the vertex shader transforms positions by objectToClip
+		// and marks their vertices in visibleVertices
+		void cullClusters(const std::vector<MeshCluster>& clusters, const IntegerDataBuffer<3>& indices, const lm::Matrix4x4f& objectToClip, std::vector<int>& visibleIndices, std::vector<uint8_t>& visibleVertices);
+
+		// Level of the chain for the current render surface, see selectLod in MeshSimplifier.h
+		size_t selectLod(const MeshLodChain& chain, const lm::Matrix4x4f& objectToClip, float pixelError);
+
 		void render(RenderMode mode, const std::vector<Vertex>& vertices);
-		void renderIndexed(RenderMode mode, const std::vector<Vertex>& vertices, const IntegerDataBuffer<3>& indices);
+		// The vertices of instanceCount instances follow each other, every instance is drawn with the same indices
+		void renderIndexed(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceCount = 1);
 	};
 
+
+	template<typename Func>
+	void Renderer::dispatch(size_t jobCount, Func&& job) {
+		this->renderPool->parallelFor(jobCount, std::forward<Func>(job));
+	}
+
 }
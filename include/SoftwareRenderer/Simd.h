@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#if defined(__AVX2__)
+	#define SR_SIMD_AVX2
+	#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define SR_SIMD_SSE2
+	#include <emmintrin.h>
+#endif
+
+// Minimal lane abstraction used by the rasterizer and wide fragment shaders.
+// Uses AVX2 (8 lanes) or SSE2 (4 lanes) if the compiler targets it, a scalar emulation otherwise.
+// AVX2 is only targeted with the CMake option SR_ENABLE_AVX2 or equivalent compiler flags.
+// Masks returned as vfloat have all bits of a lane set where the comparison holds.
+namespace sr::simd {
+
+#if defined(SR_SIMD_AVX2)
+
+	constexpr int LANES = 8;
+
+	using vint = __m256i;
+	using vfloat = __m256;
+
+	inline vint set1(int32_t x) { return _mm256_set1_epi32(x); }
+	inline vint laneIndex() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+	inline vint add(vint a, vint b) { return _mm256_add_epi32(a, b); }
+	inline vint mul(vint a, vint b) { return _mm256_mullo_epi32(a, b); }
+	inline vint bitOr(vint a, vint b) { return _mm256_or_si256(a, b); }
+	inline int signMask(vint a) { return _mm256_movemask_ps(_mm256_castsi256_ps(a)); }
+
+	inline vfloat set1(float x) { return _mm256_set1_ps(x); }
+	inline vfloat toFloat(vint a) { return _mm256_cvtepi32_ps(a); }
+	inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+	inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+	inline vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+	inline void store(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+	inline int lessEqualMask(vfloat a, vfloat b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+
+	inline vint sub(vint a, vint b) { return _mm256_sub_epi32(a, b); }
+	inline vint shiftLeft(vint a, int bits) { return _mm256_slli_epi32(a, bits); }
+	inline vint shiftRight(vint a, int bits) { return _mm256_srli_epi32(a, bits); }
+	inline vint bitAnd(vint a, vint b) { return _mm256_and_si256(a, b); }
+	inline vint load(const int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	inline vint load(const uint16_t* p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+	inline void store(int32_t* p, vint a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a); }
+	inline vint truncate(vfloat a) { return _mm256_cvttps_epi32(a); }
+	inline vint castToInt(vfloat a) { return _mm256_castps_si256(a); }
+	inline vfloat castToFloat(vint a) { return _mm256_castsi256_ps(a); }
+
+	inline vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+	inline vfloat div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+	inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+	inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+	inline vfloat sqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+	inline vfloat bitAnd(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+	inline vfloat bitOr(vfloat a, vfloat b) { return _mm256_or_ps(a, b); }
+	inline vfloat less(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+
+	// Lane i is lanes[i][offset]
+	inline vfloat gather(const float* const* lanes, size_t offset) {
+		return _mm256_setr_ps(lanes[0][offset], lanes[1][offset], lanes[2][offset], lanes[3][offset], lanes[4][offset], lanes[5][offset], lanes[6][offset], lanes[7][offset]);
+	}
+
+#elif defined(SR_SIMD_SSE2)
+
+	constexpr int LANES = 4;
+
+	using vint = __m128i;
+	using vfloat = __m128;
+
+	inline vint set1(int32_t x) { return _mm_set1_epi32(x); }
+	inline vint laneIndex() { return _mm_setr_epi32(0, 1, 2, 3); }
+	inline vint add(vint a, vint b) { return _mm_add_epi32(a, b); }
+	inline vint mul(vint a, vint b) {
+		// SSE2 has no 32 bit mullo
+		const __m128i even = _mm_mul_epu32(a, b);
+		const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+	inline vint bitOr(vint a, vint b) { return _mm_or_si128(a, b); }
+	inline int signMask(vint a) { return _mm_movemask_ps(_mm_castsi128_ps(a)); }
+
+	inline vfloat set1(float x) { return _mm_set1_ps(x); }
+	inline vfloat toFloat(vint a) { return _mm_cvtepi32_ps(a); }
+	inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+	inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+	inline vfloat load(const float* p) { return _mm_loadu_ps(p); }
+	inline void store(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+	inline int lessEqualMask(vfloat a, vfloat b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+
+	inline vint sub(vint a, vint b) { return _mm_sub_epi32(a, b); }
+	inline vint shiftLeft(vint a, int bits) { return _mm_slli_epi32(a, bits); }
+	inline vint shiftRight(vint a, int bits) { return _mm_srli_epi32(a, bits); }
+	inline vint bitAnd(vint a, vint b) { return _mm_and_si128(a, b); }
+	inline vint load(const int32_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	inline vint load(const uint16_t* p) { return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128()); }
+	inline void store(int32_t* p, vint a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a); }
+	inline vint truncate(vfloat a) { return _mm_cvttps_epi32(a); }
+	inline vint castToInt(vfloat a) { return _mm_castps_si128(a); }
+	inline vfloat castToFloat(vint a) { return _mm_castsi128_ps(a); }
+
+	inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+	inline vfloat div(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+	inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+	inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+	inline vfloat sqrt(vfloat a) { return _mm_sqrt_ps(a); }
+	inline vfloat bitAnd(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+	inline vfloat bitOr(vfloat a, vfloat b) { return _mm_or_ps(a, b); }
+	inline vfloat less(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+
+	// Lane i is lanes[i][offset]
+	inline vfloat gather(const float* const* lanes, size_t offset) {
+		return _mm_setr_ps(lanes[0][offset], lanes[1][offset], lanes[2][offset], lanes[3][offset]);
+	}
+
+#else
+
+	constexpr int LANES = 4;
+
+	struct vint { int32_t v[LANES]; };
+	struct vfloat { float v[LANES]; };
+
+	inline vint set1(int32_t x) { return { x, x, x, x }; }
+	inline vint laneIndex() { return { 0, 1, 2, 3 }; }
+	inline vint add(vint a, vint b) { for (int i = 0; i < LANES; ++i) a.v[i] += b.v[i]; return a; }
+	inline vint mul(vint a, vint b) { for (int i = 0; i < LANES; ++i) a.v[i] *= b.v[i]; return a; }
+	inline vint bitOr(vint a, vint b) { for (int i = 0; i < LANES; ++i) a.v[i] |= b.v[i]; return a; }
+	inline int signMask(vint a) { int m = 0; for (int i = 0; i < LANES; ++i) m |= (a.v[i] < 0) << i; return m; }
+
+	inline vfloat set1(float x) { return { x, x, x, x }; }
+	inline vfloat toFloat(vint a) { vfloat r; for (int i = 0; i < LANES; ++i) r.v[i] = float(a.v[i]); return r; }
+	inline vfloat add(vfloat a, vfloat b) { for (int i = 0; i < LANES; ++i) a.v[i] += b.v[i]; return a; }
+	inline vfloat mul(vfloat a, vfloat b) { for (int i = 0; i < LANES; ++i) a.v[i] *= b.v[i]; return a; }
+	inline vfloat load(const float* p) { vfloat r; for (int i = 0; i < LANES; ++i) r.v[i] = p[i]; return r; }
+	inline void store(float* p, vfloat a) { for (int i = 0; i < LANES; ++i) p[i] = a.v[i]; }
+	inline int lessEqualMask(vfloat a, vfloat b) { int m = 0; for (int i = 0; i < LANES; ++i) m |= (a.v[i] <= b.v[i]) << i; return m; }
+
+	inline vint sub(vint a, vint b) { for (int i = 0; i < LANES; ++i) a.v[i] -= b.v[i]; return a; }
+	inline vint shiftLeft(vint a, int bits) { for (int i = 0; i < LANES; ++i) a.v[i] = int32_t(uint32_t(a.v[i]) << bits); return a; }
+	inline vint shiftRight(vint a, int bits) { for (int i = 0; i < LANES; ++i) a.v[i] = int32_t(uint32_t(a.v[i]) >> bits); return a; }
+	inline vint bitAnd(vint a, vint b) { for (int i = 0; i < LANES; ++i) a.v[i] &= b.v[i]; return a; }
+	inline vint load(const int32_t* p) { vint r; for (int i = 0; i < LANES; ++i) r.v[i] = p[i]; return r; }
+	inline vint load(const uint16_t* p) { vint r; for (int i = 0; i < LANES; ++i) r.v[i] = p[i]; return r; }
+	inline void store(int32_t* p, vint a) { for (int i = 0; i < LANES; ++i) p[i] = a.v[i]; }
+	inline vint truncate(vfloat a) { vint r; for (int i = 0; i < LANES; ++i) r.v[i] = int32_t(a.v[i]); return r; }
+	inline vint castToInt(vfloat a) { vint r; std::memcpy(r.v, a.v, sizeof(r.v)); return r; }
+	inline vfloat castToFloat(vint a) { vfloat r; std::memcpy(r.v, a.v, sizeof(r.v)); return r; }
+
+	inline vfloat sub(vfloat a, vfloat b) { for (int i = 0; i < LANES; ++i) a.v[i] -= b.v[i]; return a; }
+	inline vfloat div(vfloat a, vfloat b) { for (int i = 0; i < LANES; ++i) a.v[i] /= b.v[i]; return a; }
+	// Like the SSE instructions, b is returned if one of the operands is NaN
+	inline vfloat min(vfloat a, vfloat b) { for (int i = 0; i < LANES; ++i) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return a; }
+	inline vfloat max(vfloat a, vfloat b) { for (int i = 0; i < LANES; ++i) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+	inline vfloat sqrt(vfloat a) { for (int i = 0; i < LANES; ++i) a.v[i] = std::sqrt(a.v[i]); return a; }
+	inline vfloat bitAnd(vfloat a, vfloat b) { vint r = castToInt(a); const vint m = castToInt(b); for (int i = 0; i < LANES; ++i) r.v[i] &= m.v[i]; return castToFloat(r); }
+	inline vfloat bitOr(vfloat a, vfloat b) { return castToFloat(bitOr(castToInt(a), castToInt(b))); }
+	inline vfloat less(vfloat a, vfloat b) { vint r; for (int i = 0; i < LANES; ++i) r.v[i] = a.v[i] < b.v[i] ? -1 : 0; return castToFloat(r); }
+
+	// Lane i is lanes[i][offset]
+	inline vfloat gather(const float* const* lanes, size_t offset) { vfloat r; for (int i = 0; i < LANES; ++i) r.v[i] = lanes[i][offset]; return r; }
+
+#endif
+
+	constexpr int FULL_MASK = (1 << LANES) - 1;
+
+	// Rounds towards negative infinity, for values within the int32_t range
+	inline vfloat floor(vfloat a) {
+		const vfloat truncated = toFloat(truncate(a));
+		return sub(truncated, bitAnd(less(a, truncated), set1(1.0f)));
+	}
+
+	// Natural logarithm for positive a, smaller values are clamped to the smallest normal float. Cephes polynomial, about 1e-7 relative error.
+	inline vfloat log(vfloat a) {
+		const vfloat one = set1(1.0f);
+		vfloat x = max(a, castToFloat(set1(0x00800000)));
+
+		// a = m * 2^e with m in [0.5, 1)
+		vfloat e = add(toFloat(sub(shiftRight(castToInt(x), 23), set1(0x7f))), one);
+		x = bitOr(bitAnd(x, castToFloat(set1(~0x7f800000))), set1(0.5f));
+
+		// m below sqrt(0.5) is doubled, so x - 1 stays in [sqrt(0.5) - 1, sqrt(2) - 1)
+		const vfloat small = less(x, set1(0.707106781186547524f));
+		e = sub(e, bitAnd(one, small));
+		x = add(sub(x, one), bitAnd(x, small));
+
+		const vfloat z = mul(x, x);
+		vfloat y = set1(7.0376836292e-2f);
+		y = add(mul(y, x), set1(-1.1514610310e-1f));
+		y = add(mul(y, x), set1(1.1676998740e-1f));
+		y = add(mul(y, x), set1(-1.2420140846e-1f));
+		y = add(mul(y, x), set1(1.4249322787e-1f));
+		y = add(mul(y, x), set1(-1.6668057665e-1f));
+		y = add(mul(y, x), set1(2.0000714765e-1f));
+		y = add(mul(y, x), set1(-2.4999993993e-1f));
+		y = add(mul(y, x), set1(3.3333331174e-1f));
+		y = mul(mul(y, x), z);
+
+		y = add(y, mul(e, set1(-2.12194440e-4f)));
+		y = sub(y, mul(z, set1(0.5f)));
+		return add(add(x, y), mul(e, set1(0.693359375f)));
+	}
+
+	// Exponential function, arguments are clamped to the range of normal floats, as denormal results are slow to compute with.
+	// Cephes polynomial, about 1e-7 relative error.
+	inline vfloat exp(vfloat a) {
+		const vfloat one = set1(1.0f);
+		vfloat x = min(max(a, set1(-87.0f)), set1(88.3762626647949f));
+
+		// a = n * ln(2) + r, n rounded to the nearest integer
+		const vfloat n = floor(add(mul(x, set1(1.44269504088896341f)), set1(0.5f)));
+
+		x = sub(sub(x, mul(n, set1(0.693359375f))), mul(n, set1(-2.12194440e-4f)));
+
+		const vfloat z = mul(x, x);
+		vfloat y = set1(1.9875691500e-4f);
+		y = add(mul(y, x), set1(1.3981999507e-3f));
+		y = add(mul(y, x), set1(8.3334519073e-3f));
+		y = add(mul(y, x), set1(4.1665795894e-2f));
+		y = add(mul(y, x), set1(1.6666665459e-1f));
+		y = add(mul(y, x), set1(5.0000001201e-1f));
+		y = add(add(mul(y, z), x), one);
+
+		// 2^n from the exponent bits
+		return mul(y, castToFloat(shiftLeft(add(truncate(n), set1(0x7f)), 23)));
+	}
+
+	// a^b for a >= 0, a = 0 returns about 1e-38 for positive b
+	inline vfloat pow(vfloat a, vfloat b) {
+		return exp(mul(b, log(a)));
+	}
+
+}
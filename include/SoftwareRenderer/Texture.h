@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <cstdint>
+
+#include <LeptonMath/Vector.h>
+
+#include "Simd.h"
+
+namespace sr {
+
+	#define TEXTURE_TILE_SIZE 8 // texels per side of a tile, the RGBA8 texels of a tile fill 4 cache lines
+	#define TEXTURE_MAX_UNITS 8 // textures bound to a draw at once
+	#define TEXTURE_BLOCK_SIZE 4 // texels per side of a compressed block
+	#define TEXTURE_BLOCK_CACHE_SIZE 64 // decoded blocks cached per thread
+	#define TEXTURE_FILE_VERSION 1
+
+	class Texture;
+	using TextureUnits = std::array<const Texture*, TEXTURE_MAX_UNITS>;
+
+	enum class TextureFilter {
+		NEAREST, // nearest texel of the nearest mip level
+		BILINEAR, // bilinear in the nearest mip level
+		TRILINEAR // bilinear in the two nearest mip levels, blended by the level of detail
+	};
+
+	enum class TextureWrap {
+		REPEAT,
+		CLAMP
+	};
+
+	enum class TextureFormat : uint32_t {
+		RGBA8 = 0,
+		BC1 = 1, // 8 bytes per block: two RGB565 endpoints and 2 bit indices, endpoints in ascending order select 1 bit alpha
+		BC3 = 2 // 16 bytes per block: two alpha endpoints and 3 bit indices, followed by a BC1 block without alpha
+	};
+
+	// RGBA8 or block compressed image with a mip chain, sampled by fragment shaders.
+	// RGBA8 levels are stored in tiles of TEXTURE_TILE_SIZE x TEXTURE_TILE_SIZE texels with the texels of a tile in Morton order,
+	// so a bilinear footprint and the footprints of neighboring pixels share cache lines in every direction.
+	// Compressed levels are stored as rows of blocks of TEXTURE_BLOCK_SIZE x TEXTURE_BLOCK_SIZE texels. The sampler decodes
+	// whole blocks into a small cache per thread, the texels of a footprint are then read from the decoded block.
+	//
+	// File format, little endian, every section starts at a multiple of 64 bytes:
+	//   header: magic "SRTF", version, endian tag, format, filter, wrap, level count
+	//   level table: width, height, offset, size in bytes for every level
+	//   level data: rows of RGBA8 texels or rows of blocks
+	class Texture {
+		friend std::vector<char> serializeTexture(const Texture& texture);
+		friend std::optional<Texture> parseTexture(std::string_view bytes);
+	private:
+		class Level {
+		public:
+			int width = 0;
+			int height = 0;
+			int tilesX = 0; // tiles per row, blocks per row of compressed levels
+			TextureFormat format = TextureFormat::RGBA8;
+			uint64_t id = 0; // identifies the decoded blocks of a compressed level, shared by copies of the level
+			std::vector<uint32_t> texels;
+			std::vector<uint64_t> blocks; // one word per BC1 block, two per BC3 block
+
+			uint32_t get(int x, int y) const;
+			uint32_t getCompressed(int x, int y) const;
+			size_t getByteSize() const;
+		};
+
+		std::vector<Level> levels;
+		TextureFormat format = TextureFormat::RGBA8;
+		TextureFilter filter = TextureFilter::TRILINEAR;
+		TextureWrap wrap = TextureWrap::REPEAT;
+
+		// Adds a level in the format of the texture, compressed levels are encoded from the texels
+		void addLevel(int width, int height, const uint32_t* rows);
+		void addLevel(int width, int height, std::vector<uint64_t> blocks);
+
+		// Texel coordinate of the level, wrapped or clamped into [0, size)
+		int wrapCoordinate(int coordinate, int size) const;
+
+		// Mip levels and blend weights of the second level for a level of detail, see sample
+		void selectLevels(float lod, size_t& level, size_t& nextLevel, float& weight) const;
+
+		lm::Vector4f sampleNearest(const Level& level, float u, float v) const;
+		lm::Vector4f sampleBilinear(const Level& level, float u, float v) const;
+
+		// Samples level levels[lane] of every lane
+		void sampleLanes(const size_t* levels, const simd::vfloat uv[2], simd::vfloat color[4]) const;
+
+	public:
+		Texture() = default;
+
+		// Texels in rows starting at v = 0, bytes in memory R, G, B, A.
+		// With mipmaps, the levels down to 1x1 are generated with a box filter. Compressed formats encode every level,
+		// BC1 keeps alpha only as a cutout at 0.5.
+		Texture(int width, int height, const std::vector<uint32_t>& texels, bool mipmaps = true, TextureFormat format = TextureFormat::RGBA8);
+
+		void setFilter(TextureFilter filter);
+		void setWrap(TextureWrap wrap);
+		TextureFilter getFilter() const;
+		TextureWrap getWrap() const;
+
+		int getWidth(size_t level = 0) const;
+		int getHeight(size_t level = 0) const;
+		size_t getLevelCount() const;
+		TextureFormat getFormat() const;
+		size_t getByteSize() const; // all levels
+
+		// Texel of a level, coordinates outside of the level are wrapped
+		uint32_t getTexel(int x, int y, size_t level = 0) const;
+
+		// Filtered color at uv, [0, 1] covers the texture. The level of detail is log2 of the larger texel footprint
+		// of a pixel, given by the screen space derivatives of uv. Without derivatives the first level is sampled.
+		lm::Vector4f sample(const lm::Vector2f& uv) const;
+		lm::Vector4f sample(const lm::Vector2f& uv, const lm::Vector2f& dx, const lm::Vector2f& dy) const;
+		lm::Vector4f sampleLevel(const lm::Vector2f& uv, float lod) const;
+
+		// sample for simd::LANES pixels at once, color receives the red, green, blue and alpha lanes
+		void sample(const simd::vfloat uv[2], const simd::vfloat dx[2], const simd::vfloat dy[2], simd::vfloat color[4]) const;
+	};
+
+	std::vector<char> serializeTexture(const Texture& texture);
+	std::optional<Texture> parseTexture(std::string_view bytes);
+
+	bool saveTexture(const std::string& path, const Texture& texture);
+	std::optional<Texture> loadTexture(const std::string& path);
+
+}
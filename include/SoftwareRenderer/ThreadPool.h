@@ -1,9 +1,11 @@
 #pragma once
 
 #include <array>
-#include <queue>
-
-#include <functional>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
 
 #include <thread>
 #include <mutex>
@@ -11,100 +13,98 @@
 
 namespace sr {
 
-	template<size_t count>
+	#define THREAD_POOL_QUEUE_SIZE 4096 // jobs per worker queue, has to be a power of two
+
+	// Work stealing thread pool.
+	// Every worker owns a lock-free deque, it pops its own jobs from the bottom and steals from the top of other deques.
+	// A submission pushes at most one runner per thread, runners claim job indices from a shared cursor until none are left,
+	// so any job count fits into the deques and nothing is allocated per job.
+	// The submitting thread helps executing jobs and then parks until all of its runners are done.
 	class ThreadPool {
 	private:
-		std::array<std::thread, count> threads;
-		std::array<volatile bool, count> threadStatus = {0}; // indicates if a thread is working
-		
-		std::queue<std::function<void()>> jobs;
 
-		std::mutex queueLock;
+		// Lives on the stack of the submitting thread until remaining reaches 0
+		class JobGroup {
+		public:
+			void (*function)(void* context, size_t index);
+			void* context;
+			size_t jobCount;
+			std::atomic<size_t> nextJob; // next index to claim
+			std::atomic<size_t> remaining; // runners not finished yet
+		};
+
+		class Job {
+		public:
+			JobGroup* group = nullptr;
+		};
+
+		// Chase-Lev deque with a fixed capacity
+		class JobQueue {
+		private:
+			class Slot {
+			public:
+				std::atomic<JobGroup*> group;
+			};
+
+			alignas(64) std::atomic<int64_t> top = 0;
+			alignas(64) std::atomic<int64_t> bottom = 0;
+			alignas(64) std::array<Slot, THREAD_POOL_QUEUE_SIZE> slots;
+
+		public:
+			bool push(const Job& job); // owner only
+			bool pop(Job& job); // owner only
+			bool steal(Job& job); // any thread
+		};
+
+		std::vector<std::thread> threads;
+		std::vector<std::unique_ptr<JobQueue>> queues; // one per worker, the last one belongs to external threads
+
+		std::mutex externalLock; // serializes submissions from threads outside of the pool
+
+		std::atomic<int64_t> pendingJobs = 0;
+		std::atomic<int> sleepingThreads = 0;
+		std::atomic<bool> terminated = false;
+
+		std::mutex sleepLock;
 		std::condition_variable resumeCondition;
 
-		bool terminated = false;
-		bool active = true;
+		// Signals finished groups, owned by the pool so the last runner never touches a group that may be gone
+		std::mutex completionLock;
+		std::condition_variable completionCondition;
+
+		void ThreadProc(size_t id);
 
-		void ThreadProc(int id);
+		bool findJob(size_t queueID, Job& job);
+		void execute(const Job& job);
+		void wakeThreads();
+
+		void run(size_t jobCount, void (*function)(void* context, size_t index), void* context);
 
 	public:
 
-		ThreadPool();
+		// threadCount includes the submitting thread, 0 picks the hardware concurrency
+		ThreadPool(size_t threadCount = 0);
 		~ThreadPool();
 
 		ThreadPool(const ThreadPool& pool) = delete;
 
 		ThreadPool& operator=(const ThreadPool& pool) = delete;
 
-		void addJob(const std::function<void()>& job);
-
-		void activate();
-		void deactivate();
+		// Runs job(0) to job(jobCount - 1) and returns when all of them are done
+		template<typename Func>
+		void parallelFor(size_t jobCount, Func&& job);
 
-		bool isBusy() const;
+		size_t getThreadCount() const;
 
 	};
 
 
-	template<size_t count>
-	void ThreadPool<count>::ThreadProc(int id) {
-		while (true) {
-			std::function<void()> job;
-			{
-				std::unique_lock<std::mutex> lock(this->queueLock);
-				this->resumeCondition.wait(lock, [this] {
-					return (!this->jobs.empty() && active) || this->terminated;
-					});
-
-				if (this->terminated) {
-					return;
-				}
-
-				threadStatus[id] = true;
-				job = jobs.front();
-				jobs.pop();
-			}
-			job();
-			threadStatus[id] = false;
-		}
-	}
-
-	template<size_t count>
-	ThreadPool<count>::ThreadPool() {
-		for (int i = 0; i < count; ++i) this->threads[i] = std::thread(&ThreadPool<count>::ThreadProc, this, i);
-	}
-
-	template<size_t count>
-	ThreadPool<count>::~ThreadPool() {
-		this->terminated = true;
-		this->resumeCondition.notify_all();
-		for (auto& t : this->threads) t.join();
-	}
-
-	template<size_t count>
-	void ThreadPool<count>::addJob(const std::function<void()>& job) {
-		{
-			std::unique_lock lock(this->queueLock);
-			this->jobs.push(job);
-		}
-		resumeCondition.notify_one();
-	}
-
-	template<size_t count>
-	void ThreadPool<count>::activate() {
-		this->active = true;
-	}
-
-	template<size_t count>
-	void ThreadPool<count>::deactivate() {
-		this->active = false;
-	}
-
-	template<size_t count>
-	bool ThreadPool<count>::isBusy() const {
-		bool busy = !this->jobs.empty();
-		for (auto status : this->threadStatus) busy |= status;
-		return busy;
+	template<typename Func>
+	void ThreadPool::parallelFor(size_t jobCount, Func&& job) {
+		using JobType = std::remove_reference_t<Func>;
+		this->run(jobCount, [](void* context, size_t index) {
+			(*static_cast<JobType*>(context))(index);
+		}, const_cast<void*>(static_cast<const void*>(&job)));
 	}
 
 }
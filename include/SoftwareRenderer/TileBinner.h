@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "Rect.h"
+
+namespace sr {
+
+	// Sorts items (triangles) into a grid of screen tiles.
+	// Every producer owns its own set of bins, so producers can insert concurrently without locking
+	// and the consumer of a tile sees the items in producer order.
+	class TileBinner {
+	private:
+		int tileSize = 64;
+		int width = 0;
+		int height = 0;
+		int tilesX = 0;
+		int tilesY = 0;
+
+		size_t producerCount = 0;
+
+		std::vector<std::vector<uint32_t>> bins; // bins[producer * tileCount + tile]
+
+	public:
+		TileBinner() = default;
+		TileBinner(int tileSize);
+
+		void resize(int width, int height, size_t producerCount);
+		void clear();
+
+		void insert(size_t producer, const Rect& bounds, uint32_t item);
+		const std::vector<uint32_t>& getBin(size_t producer, int tile) const;
+		bool isTileEmpty(int tile) const;
+
+		Rect getTileRect(int tile) const;
+
+		int getTileSize() const;
+		int getTileCount() const;
+		size_t getProducerCount() const;
+	};
+
+}
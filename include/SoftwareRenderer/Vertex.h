@@ -1,24 +1,167 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
 #include <LeptonMath/Vector.h>
 
 namespace sr {
 
+	// Floats passed from the vertex to the fragment stage, a multiple of 4 as smooth varyings are interpolated in groups of 4.
+	// Enough for a normal, texture coordinates and a tangent with handedness.
+	#define VERTEX_MAX_VARYINGS 16
+	#define VERTEX_DEFAULT_VARYINGS 7 // color and normal of shaders without declared varyings
+
+	// Smooth varyings are interpolated, flat varyings follow them and keep the value of the first vertex of a triangle.
+	// Without declared varyings, color and normal are the first seven smooth varyings.
+	class VaryingLayout {
+	public:
+		uint8_t smooth = VERTEX_DEFAULT_VARYINGS;
+		uint8_t flat = 0;
+		bool declared = false;
+
+		// Floats of a packed vertex, see VertexStream
+		size_t getStride() const;
+		// Varying floats rounded up to groups of 4, the part of Vertex::varyings that is fetched
+		size_t getGroupedCount() const;
+		bool operator==(const VaryingLayout& other) const;
+	};
+
 	class Vertex {
 	public:
 		lm::Vector4f position;
-		lm::Vector4f color;
-		lm::Vector3f normal;
+		std::array<float, VERTEX_MAX_VARYINGS> varyings;
+		VaryingLayout layout;
+
+		static_assert(VERTEX_MAX_VARYINGS % 4 == 0);
 
 		const lm::Vector4f& getPosition() const;
-		const lm::Vector4f& getColor() const;
-		const lm::Vector3f& getNormal() const;
 
+		// Default varyings
+		lm::Vector4f getColor() const;
+		lm::Vector3f getNormal() const;
+		void setColor(const lm::Vector4f& color);
+		void setNormal(const lm::Vector3f& normal);
+
+		// Copies the groups of 4 floats used by the layout from source, the layout has to be set first
+		void copyVaryings(const float* source);
+
+		// Copies the flat varyings of source, all vertices of a triangle get the values of its first vertex
+		void copyFlatVaryings(const Vertex& source);
+
+		// Only the groups of 4 floats holding smooth varyings are computed, flat varyings are taken from the first operand
 		friend Vertex operator+(const Vertex& v1, const Vertex& v2);
 		friend Vertex operator-(const Vertex& v1, const Vertex& v2);
 		friend Vertex operator-(const Vertex& v);
 		friend Vertex operator*(float scalar, const Vertex& v);
 	};
 
+	// Screen space derivatives of the varyings of a fragment, zero for flat varyings
+	class VaryingDerivatives {
+	public:
+		std::array<float, VERTEX_MAX_VARYINGS> dx;
+		std::array<float, VERTEX_MAX_VARYINGS> dy;
+	};
+
+	// Transformed vertices of one layout, packed as position and declared varyings.
+	// A vertex is fetched in groups of 4 floats, so the data has to be followed by VERTEX_MAX_VARYINGS floats of padding.
+	class VertexStream {
+	public:
+		const float* data = nullptr;
+		VaryingLayout layout;
+		size_t size = 0; // vertices
+
+		Vertex get(size_t index) const;
+	};
+
+	// Per pixel arithmetic and vertex fetch are defined inline
+
+	inline void Vertex::copyFlatVaryings(const Vertex& source) {
+		const size_t begin = source.layout.smooth;
+		for (size_t i = begin; i < begin + source.layout.flat; ++i) this->varyings[i] = source.varyings[i];
+	}
+
+	inline Vertex operator+(const Vertex& v1, const Vertex& v2) {
+		Vertex res;
+
+		res.position = v1.position + v2.position;
+		res.layout = v1.layout;
+		for (size_t c = 0; c < v1.layout.smooth; c += 4) {
+			for (size_t i = c; i < c + 4; ++i) res.varyings[i] = v1.varyings[i] + v2.varyings[i];
+		}
+		res.copyFlatVaryings(v1);
+
+		return res;
+	}
+
+	inline Vertex operator-(const Vertex& v1, const Vertex& v2) {
+		Vertex res;
+
+		res.position = v1.position - v2.position;
+		res.layout = v1.layout;
+		for (size_t c = 0; c < v1.layout.smooth; c += 4) {
+			for (size_t i = c; i < c + 4; ++i) res.varyings[i] = v1.varyings[i] - v2.varyings[i];
+		}
+		res.copyFlatVaryings(v1);
+
+		return res;
+	}
+
+	inline Vertex operator-(const Vertex& v) {
+		Vertex res;
+
+		res.position = -v.position;
+		res.layout = v.layout;
+		for (size_t c = 0; c < v.layout.smooth; c += 4) {
+			for (size_t i = c; i < c + 4; ++i) res.varyings[i] = -v.varyings[i];
+		}
+		res.copyFlatVaryings(v);
+
+		return res;
+	}
+
+	inline Vertex operator*(float scalar, const Vertex& v) {
+		Vertex res;
+
+		res.position = scalar * v.position;
+		res.layout = v.layout;
+		for (size_t c = 0; c < v.layout.smooth; c += 4) {
+			for (size_t i = c; i < c + 4; ++i) res.varyings[i] = scalar * v.varyings[i];
+		}
+		res.copyFlatVaryings(v);
+
+		return res;
+	}
+
+	inline size_t VaryingLayout::getStride() const {
+		return 4 + this->smooth + this->flat;
+	}
+
+	inline size_t VaryingLayout::getGroupedCount() const {
+		return (size_t(this->smooth) + this->flat + 3) & ~size_t(3);
+	}
+
+	inline void Vertex::copyVaryings(const float* source) {
+		const size_t count = this->layout.getGroupedCount();
+		for (size_t c = 0; c < VERTEX_MAX_VARYINGS && c < count; c += 4) {
+			for (size_t i = c; i < c + 4; ++i) this->varyings[i] = source[i];
+		}
+	}
+
+	inline bool VaryingLayout::operator==(const VaryingLayout& other) const {
+		return this->smooth == other.smooth && this->flat == other.flat && this->declared == other.declared;
+	}
+
+	inline Vertex VertexStream::get(size_t index) const {
+		const float* packed = this->data + index * this->layout.getStride();
+
+		Vertex vertex;
+		vertex.position = { packed[0], packed[1], packed[2], packed[3] };
+		vertex.layout = this->layout;
+		vertex.copyVaryings(packed + 4);
+
+		return vertex;
+	}
 
 }
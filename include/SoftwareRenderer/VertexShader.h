@@ -1,11 +1,14 @@
 #pragma once
 
 #include <memory>
+#include <array>
+#include <cassert>
 
 #include <LeptonMath/Vector.h>
 
 #include "BufferArray.h"
 #include "BufferManager.h"
+#include "Vertex.h"
 
 namespace sr {
 
@@ -15,24 +18,47 @@ namespace sr {
 
 	class VertexShader {
 		friend class RenderPipeline;
+		friend class CommandBuffer;
 	private:
 		BufferArray bufferArray;
-		std::weak_ptr<BufferManager> bufferManager;
+		BufferManager* bufferManager = nullptr; // set by the RenderPipeline for the duration of a draw call
+		VaryingLayout varyingLayout;
+
+		// Writes position and varyings as a packed vertex of varyingLayout, see VertexStream
+		void storeOutput(float* packed) const;
 
 	protected:
 
 		size_t vertexID = 0;
+		size_t instanceID = 0; // 0 outside of instanced draws
 
 		vec4 out_position;
+
+		// Default varyings, unused once varyings are declared
 		vec4 out_color;
 		vec3 out_normal;
 
+		std::array<float, VERTEX_MAX_VARYINGS> out_varyings{};
+
 		virtual void main() = 0;
+		virtual std::unique_ptr<VertexShader> clone() const = 0;
 		
 		void reset();
 
 		template<size_t layout>
 		lm::Vectorf<layout> getVertexAttribute(int index);
+
+		// Attribute of the current instance from the instance buffers of the buffer array
+		template<size_t layout>
+		lm::Vectorf<layout> getInstanceAttribute(int index);
+
+		// Replaces color and normal by smooth and flat floats in out_varyings, usually called in the constructor.
+		// Only the declared varyings are interpolated, the fragment shader reads them with getVarying.
+		void declareVaryings(size_t smooth, size_t flat = 0);
+
+		// Writes the varying starting at float offset
+		template<size_t layout>
+		void setVarying(size_t offset, const lm::Vectorf<layout>& value);
 	public:
 		virtual ~VertexShader() = default;
 	};
@@ -40,7 +66,7 @@ namespace sr {
 	// TODO Boundchecking
 	template<size_t layout>
 	lm::Vectorf<layout> VertexShader::getVertexAttribute(int index) {
-		auto bm = this->bufferManager.lock();
+		auto bm = this->bufferManager;
 		if (bm == nullptr) return lm::Vectorf<layout>();
 		
 		auto bufferID = bufferArray.getBufferID(index);
@@ -50,4 +76,21 @@ namespace sr {
 		return floatBuffer.getVertexAttribute(this->vertexID);
 	}
 
+	template<size_t layout>
+	lm::Vectorf<layout> VertexShader::getInstanceAttribute(int index) {
+		auto bm = this->bufferManager;
+		if (bm == nullptr) return lm::Vectorf<layout>();
+
+		auto bufferID = bufferArray.getInstanceBufferID(index);
+		const FloatDataBuffer<layout>& floatBuffer = bm->getBuffer<layout>(bufferID);
+
+		return floatBuffer.getVertexAttribute(this->instanceID);
+	}
+
+	template<size_t layout>
+	void VertexShader::setVarying(size_t offset, const lm::Vectorf<layout>& value) {
+		assert(offset + layout <= VERTEX_MAX_VARYINGS);
+		for (size_t i = 0; i < layout; ++i) this->out_varyings[offset + i] = value[i];
+	}
+
 }
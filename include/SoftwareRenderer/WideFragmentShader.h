@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+
+#include "FragmentShader.h"
+#include "Simd.h"
+#include "Vertex.h"
+
+namespace sr {
+
+	// Inputs of up to simd::LANES fragments in structure of arrays layout, lane i holds fragment i of the bundle.
+	// Lanes outside of mask repeat the last active fragment, so they can be shaded like the others.
+	class FragmentLanes {
+	public:
+		simd::vfloat position[4];
+		simd::vfloat varyings[VERTEX_MAX_VARYINGS]; // without declared varyings, color is in 0 to 3 and the normal in 4 to 6
+		simd::vfloat dx[VERTEX_MAX_VARYINGS]; // derivatives of the smooth varyings, only set if derivatives is true
+		simd::vfloat dy[VERTEX_MAX_VARYINGS];
+		bool derivatives = false;
+		int mask = 0;
+	};
+
+	// Base of fragment shaders that shade simd::LANES fragments at once. Shader implements mainLanes, which reads in_lanes
+	// and writes the red, green, blue and alpha lanes of out_colorLanes. Fragments arrive in rasterization order,
+	// usually neighbors in a row. Shader has to be copy constructible and declare WideFragmentShader<Shader> a friend
+	// if mainLanes is not public, e.g. class MyShader final : public WideFragmentShader<MyShader>.
+	template<typename Shader>
+	class WideFragmentShader : public FragmentShader {
+	private:
+		void loadLanes(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count);
+
+	protected:
+		FragmentLanes in_lanes;
+		simd::vfloat out_colorLanes[4];
+
+		void shadeFragments(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count, vec4* colors) override;
+
+		// Shades the scalar inputs in the first lane
+		void main() override;
+
+		// sampleTexture for all lanes
+		void sampleTextureLanes(int unit, size_t offset, simd::vfloat color[4]) const;
+
+	public:
+		std::unique_ptr<FragmentShader> clone() const override;
+	};
+
+
+	template<typename Shader>
+	void WideFragmentShader<Shader>::loadLanes(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count) {
+		const size_t smoothCount = fragments[0].layout.smooth;
+		const size_t varyingCount = smoothCount + fragments[0].layout.flat;
+
+		// Lanes are assembled in registers, writing them to memory first stalls the vector loads
+		const float* positions[simd::LANES];
+		const float* varyings[simd::LANES];
+		for (size_t lane = 0; lane < size_t(simd::LANES); ++lane) {
+			const Vertex& fragment = fragments[std::min(lane, count - 1)];
+			positions[lane] = &fragment.position[0];
+			varyings[lane] = fragment.varyings.data();
+		}
+
+		for (size_t i = 0; i < 4; ++i) this->in_lanes.position[i] = simd::gather(positions, i);
+		for (size_t i = 0; i < varyingCount; ++i) this->in_lanes.varyings[i] = simd::gather(varyings, i);
+		this->in_lanes.mask = simd::FULL_MASK >> (simd::LANES - int(count));
+
+		this->in_lanes.derivatives = derivatives != nullptr;
+		if (derivatives == nullptr) return;
+
+		const float* dx[simd::LANES];
+		const float* dy[simd::LANES];
+		for (size_t lane = 0; lane < size_t(simd::LANES); ++lane) {
+			const VaryingDerivatives& fragment = derivatives[std::min(lane, count - 1)];
+			dx[lane] = fragment.dx.data();
+			dy[lane] = fragment.dy.data();
+		}
+
+		for (size_t i = 0; i < smoothCount; ++i) {
+			this->in_lanes.dx[i] = simd::gather(dx, i);
+			this->in_lanes.dy[i] = simd::gather(dy, i);
+		}
+	}
+
+	template<typename Shader>
+	void WideFragmentShader<Shader>::shadeFragments(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count, vec4* colors) {
+		auto& shader = static_cast<Shader&>(*this);
+		for (size_t begin = 0; begin < count; begin += simd::LANES) {
+			const size_t lanes = std::min<size_t>(simd::LANES, count - begin);
+			this->loadLanes(fragments + begin, derivatives != nullptr ? derivatives + begin : nullptr, lanes);
+			shader.Shader::mainLanes();
+
+			alignas(32) float channels[4][simd::LANES];
+			for (size_t i = 0; i < 4; ++i) simd::store(channels[i], this->out_colorLanes[i]);
+			for (size_t lane = 0; lane < lanes; ++lane) colors[begin + lane] = { channels[0][lane], channels[1][lane], channels[2][lane], channels[3][lane] };
+		}
+	}
+
+	template<typename Shader>
+	void WideFragmentShader<Shader>::main() {
+		Vertex fragment;
+		fragment.position = this->in_position;
+		std::copy_n(this->in_varyings, VERTEX_MAX_VARYINGS, fragment.varyings.begin());
+		fragment.layout.smooth = VERTEX_MAX_VARYINGS;
+		fragment.layout.flat = 0;
+
+		this->shadeFragments(&fragment, this->in_derivatives, 1, &this->out_color);
+	}
+
+	template<typename Shader>
+	void WideFragmentShader<Shader>::sampleTextureLanes(int unit, size_t offset, simd::vfloat color[4]) const {
+		const Texture* texture = this->getTexture(unit);
+		if (texture == nullptr) {
+			for (size_t i = 0; i < 4; ++i) color[i] = simd::set1(i == 3 ? 1.0f : 0.0f);
+			return;
+		}
+
+		// Without derivatives the footprint is zero, which selects the first mip level
+		const simd::vfloat* uv = this->in_lanes.varyings + offset;
+		if (!this->in_lanes.derivatives) {
+			const simd::vfloat zero[2] = { simd::set1(0.0f), simd::set1(0.0f) };
+			texture->sample(uv, zero, zero, color);
+			return;
+		}
+		texture->sample(uv, this->in_lanes.dx + offset, this->in_lanes.dy + offset, color);
+	}
+
+	template<typename Shader>
+	std::unique_ptr<FragmentShader> WideFragmentShader<Shader>::clone() const {
+		return std::make_unique<Shader>(static_cast<const Shader&>(*this));
+	}
+
+}
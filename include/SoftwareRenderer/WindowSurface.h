@@ -0,0 +1,23 @@
+#pragma once
+
+#include <memory>
+
+#include <PixelWindow/PixelWindow.h>
+
+#include "ColorBuffer.h"
+
+namespace sr {
+
+	// Renders into memory and presents the finished frame on a PixelWindow
+	class WindowSurface : public ColorBuffer {
+	private:
+		std::weak_ptr<pw::PixelWindow> window;
+
+	public:
+		WindowSurface(std::weak_ptr<pw::PixelWindow> window);
+
+		void beginFrame() override;
+		void endFrame() override;
+	};
+
+}
@@ -1,29 +1,144 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <limits>
+
+#include "Rect.h"
+#include "RenderSurface.h"
 
 namespace sr {
 
+	#define ZBUFFER_TILE_SIZE 8
+	#define ZBUFFER_COARSE_TILE_SIZE 64
+
+	template<DepthFormat Format>
+	struct DepthFormatTraits;
+
+	template<>
+	struct DepthFormatTraits<DepthFormat::FLOAT32> {
+		using Type = float;
+	};
+
+	template<>
+	struct DepthFormatTraits<DepthFormat::UNORM16> {
+		using Type = uint16_t;
+		static constexpr uint32_t MAX = 0xFFFF;
+	};
+
+	template<>
+	struct DepthFormatTraits<DepthFormat::UNORM24> {
+		using Type = uint32_t;
+		static constexpr uint32_t MAX = 0xFFFFFF;
+	};
+
+	// Depth buffer in one of the depth formats.
+	// Depths are compared as values of the format: the depth itself for FLOAT32, the unorm integer for the others,
+	// which a float holds exactly. encode turns the depth of a fragment into its value, values are what get, set and
+	// the depth hierarchy work with. Unorm formats map the depths -1 to 1 onto 0 to MAX, farther depths are clamped.
 	class ZBuffer {
 	private:
 
 		int width = 0;
 		int height = 0;
+		DepthFormat format = DepthFormat::FLOAT32;
+
+		std::unique_ptr<std::byte[]> buffer;
+
+		// Hierarchical depth: the maximum value of every 8x8 tile and every 64x64 tile.
+		// Writes only mark a tile dirty, the maxima stay conservative until refresh recomputes them.
+		// Triangle batches test the maxima while other threads refresh them under the frame buffer lock, so they are atomic.
+		// Relaxed order is enough, a stale maximum is one that has not been lowered yet.
+		int tilesX = 0;
+		int tilesY = 0;
+		int coarseTilesX = 0;
+		int coarseTilesY = 0;
+
+		std::unique_ptr<std::atomic<float>[]> tileMax;
+		std::unique_ptr<std::atomic<float>[]> coarseTileMax;
+		std::unique_ptr<bool[]> tileDirty;
+
+		template<DepthFormat Format>
+		void fill();
+
+		template<DepthFormat Format>
+		float getRowMax(int y, int xBegin, int xEnd) const;
+
+		void refreshTile(int tileX, int tileY);
+		void refreshCoarseTile(int coarseX, int coarseY);
 
-		std::unique_ptr<float[]> buffer;
 	public:
 
 		ZBuffer() = default;
-		ZBuffer(int width, int height);
+		ZBuffer(int width, int height, DepthFormat format = DepthFormat::FLOAT32);
 
-		void resize(int width, int height);
+		void resize(int width, int height, DepthFormat format = DepthFormat::FLOAT32);
 
+		template<DepthFormat Format>
+		static float encode(float depth);
+		template<DepthFormat Format>
+		static float load(const typename DepthFormatTraits<Format>::Type* row, int x);
+		template<DepthFormat Format>
+		static void store(typename DepthFormatTraits<Format>::Type* row, int x, float value);
+		template<DepthFormat Format>
+		static float getClearValue();
+
+		float encode(float depth) const;
 		float get(int x, int y) const;
 		void set(int x, int y, float value) ;
+		template<DepthFormat Format>
+		const typename DepthFormatTraits<Format>::Type* getRow(int y) const;
 		void reset();
 
+		void refresh(const Rect& rect);
+		float getTileMax(int tileX, int tileY) const;
+		bool isOccluded(const Rect& rect, float value) const;
+
 		int getWidth() const;
 		int getHeight() const;
+		DepthFormat getFormat() const;
 	};
 
+
+	// Float to integer conversions truncate the same way in scalar and SIMD code, so the rasterizers encode like this
+	template<DepthFormat Format>
+	inline float ZBuffer::encode(float depth) {
+		if constexpr (Format == DepthFormat::FLOAT32) {
+			return depth;
+		}
+		else {
+			constexpr uint32_t max = DepthFormatTraits<Format>::MAX;
+			return float(int32_t(std::min(std::max((depth + 1.0f) * float((max + 1) / 2), 0.0f), float(max))));
+		}
+	}
+
+	template<DepthFormat Format>
+	inline float ZBuffer::load(const typename DepthFormatTraits<Format>::Type* row, int x) {
+		if constexpr (Format == DepthFormat::UNORM24) return float(row[x] & DepthFormatTraits<Format>::MAX);
+		else return float(row[x]);
+	}
+
+	template<DepthFormat Format>
+	inline void ZBuffer::store(typename DepthFormatTraits<Format>::Type* row, int x, float value) {
+		using Type = typename DepthFormatTraits<Format>::Type;
+		if constexpr (Format == DepthFormat::UNORM24) row[x] = (row[x] & ~DepthFormatTraits<Format>::MAX) | uint32_t(value);
+		else row[x] = Type(value);
+	}
+
+	template<DepthFormat Format>
+	inline float ZBuffer::getClearValue() {
+		if constexpr (Format == DepthFormat::FLOAT32) return std::numeric_limits<float>::infinity();
+		else return float(DepthFormatTraits<Format>::MAX);
+	}
+
+	template<DepthFormat Format>
+	inline const typename DepthFormatTraits<Format>::Type* ZBuffer::getRow(int y) const {
+		assert(this->buffer != nullptr && this->format == Format);
+		assert(!(y < 0 || y >= this->height));
+		return reinterpret_cast<const typename DepthFormatTraits<Format>::Type*>(this->buffer.get()) + size_t(y) * this->width;
+	}
+
 }
@@ -10,6 +10,14 @@ namespace sr {
 		return this->buffers[index];
 	}
 
+	void BufferArray::storeInInstanceAttributeList(int index, int bufferID) {
+		this->instanceBuffers[index] = bufferID;
+	}
+
+	int BufferArray::getInstanceBufferID(int index) const {
+		return this->instanceBuffers[index];
+	}
+
 	void BufferArray::setIndexBuffer(int bufferID) {
 		this->indexBuffer = bufferID;
 	}
@@ -22,4 +30,28 @@ namespace sr {
 		return this->indexBuffer != -1;
 	}
 
+	void BufferArray::setClusterBuffer(int bufferID) {
+		this->clusterBuffer = bufferID;
+	}
+
+	int BufferArray::getClusterBuffer() const {
+		return this->clusterBuffer;
+	}
+
+	bool BufferArray::hasClusterBuffer() const {
+		return this->clusterBuffer != -1;
+	}
+
+	void BufferArray::setLodBuffer(int bufferID) {
+		this->lodBuffer = bufferID;
+	}
+
+	int BufferArray::getLodBuffer() const {
+		return this->lodBuffer;
+	}
+
+	bool BufferArray::hasLodBuffer() const {
+		return this->lodBuffer != -1;
+	}
+
 }
@@ -0,0 +1,21 @@
+#include "SoftwareRenderer/ColorBuffer.h"
+
+namespace sr {
+
+	ColorBuffer::ColorBuffer(int width, int height, PixelFormat format) {
+		this->pixelFormat = format;
+		this->resize(width, height);
+	}
+
+	void ColorBuffer::resize(int width, int height) {
+		this->width = width;
+		this->height = height;
+		this->buffer = std::make_unique<uint32_t[]>(size_t(width) * height);
+		this->pixels = this->buffer.get();
+	}
+
+	void ColorBuffer::setPixelFormat(PixelFormat format) {
+		this->pixelFormat = format;
+	}
+
+}
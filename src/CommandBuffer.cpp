@@ -0,0 +1,65 @@
+#include "SoftwareRenderer/CommandBuffer.h"
+
+namespace sr {
+
+	CommandBuffer::CommandBuffer() {
+		this->textures.fill(-1);
+	}
+
+	void CommandBuffer::bindBufferArray(int bufferArrayID) {
+		this->currentBufferArray = bufferArrayID;
+	}
+
+	void CommandBuffer::bindVertexShader(std::weak_ptr<VertexShader> vs) {
+		this->vertexShader = vs;
+	}
+
+	void CommandBuffer::bindFragmentShader(std::weak_ptr<FragmentShader> fs) {
+		this->fragmentShader = fs;
+	}
+
+	void CommandBuffer::bindGeometryShader(std::weak_ptr<GeometryShader> gs) {
+		this->geometryShader = gs;
+	}
+
+	void CommandBuffer::bindTexture(int unit, int textureID) {
+		if (unit < 0 || unit >= TEXTURE_MAX_UNITS) return;
+		this->textures[unit] = textureID;
+	}
+
+	void CommandBuffer::setCullingTransform(const lm::Matrix4x4f& objectToClip) {
+		this->cullingTransform = objectToClip;
+		this->cullingTransformValid = true;
+	}
+
+	void CommandBuffer::draw(RenderMode mode, int vertexCount) {
+		this->drawInstanced(mode, vertexCount, 1);
+	}
+
+	void CommandBuffer::drawInstanced(RenderMode mode, int vertexCount, int instanceCount) {
+		auto vs = this->vertexShader.lock();
+		if (vs == nullptr || this->currentBufferArray == -1 || vertexCount <= 0 || instanceCount <= 0) return;
+
+		DrawCommand command;
+		command.bufferArray = this->currentBufferArray;
+		command.vertexShader = vs->clone();
+		command.fragmentShader = this->fragmentShader.lock();
+		command.geometryShader = this->geometryShader.lock();
+		command.textures = this->textures;
+		command.cullingTransformValid = this->cullingTransformValid;
+		command.cullingTransform = this->cullingTransform;
+		command.mode = mode;
+		command.vertexCount = vertexCount;
+		command.instanceCount = instanceCount;
+		this->commands.push_back(std::move(command));
+	}
+
+	void CommandBuffer::reset() {
+		this->commands.clear();
+	}
+
+	size_t CommandBuffer::getDrawCount() const {
+		return this->commands.size();
+	}
+
+}
@@ -7,4 +7,30 @@ namespace sr {
 		out_color = {};
 	}
 
+	void FragmentShader::useDerivatives() {
+		this->derivativesUsed = true;
+	}
+
+	const Texture* FragmentShader::getTexture(int unit) const {
+		if (unit < 0 || unit >= TEXTURE_MAX_UNITS) return nullptr;
+		return this->textures[unit];
+	}
+
+	vec4 FragmentShader::sampleTexture(int unit, size_t offset) const {
+		const Texture* texture = this->getTexture(unit);
+		if (texture == nullptr) return { 0.0f, 0.0f, 0.0f, 1.0f };
+
+		const auto uv = this->getVarying<2>(offset);
+		if (this->in_derivatives == nullptr) return texture->sample(uv);
+		return texture->sample(uv, this->getVaryingDx<2>(offset), this->getVaryingDy<2>(offset));
+	}
+
+	void FragmentShader::shadeFragments(const Vertex* fragments, const VaryingDerivatives* derivatives, size_t count, vec4* colors) {
+		for (size_t i = 0; i < count; ++i) {
+			this->setInputs(fragments[i], derivatives != nullptr ? &derivatives[i] : nullptr);
+			this->main();
+			colors[i] = this->out_color;
+		}
+	}
+
 }
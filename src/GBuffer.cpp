@@ -0,0 +1,77 @@
+#include "SoftwareRenderer/GBuffer.h"
+
+#include <cassert>
+#include <algorithm>
+
+namespace sr {
+
+	void GBuffer::resize(int width, int height) {
+		this->width = width;
+		this->height = height;
+		this->fragments = std::make_unique<Vertex[]>(size_t(width) * height);
+		this->shaders = std::make_unique<int[]>(size_t(width) * height);
+		std::fill_n(this->shaders.get(), size_t(width) * height, -1);
+	}
+
+	void GBuffer::set(int x, int y, int shader, const Vertex& fragment) {
+		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
+		const size_t index = size_t(y) * this->width + x;
+		this->fragments[index] = fragment;
+		this->shaders[index] = shader;
+	}
+
+	void GBuffer::clear(int x, int y) {
+		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
+		this->shaders[size_t(y) * this->width + x] = -1;
+	}
+
+	int GBuffer::getShader(int x, int y) const {
+		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
+		return this->shaders[size_t(y) * this->width + x];
+	}
+
+	const Vertex& GBuffer::getFragment(int x, int y) const {
+		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
+		return this->fragments[size_t(y) * this->width + x];
+	}
+
+	VaryingDerivatives GBuffer::getDerivatives(int x, int y) const {
+		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
+		VaryingDerivatives derivatives = {};
+
+		const size_t index = size_t(y) * this->width + x;
+		const int shader = this->shaders[index];
+		const Vertex& fragment = this->fragments[index];
+		const size_t smooth = fragment.layout.smooth;
+
+		auto isNeighbor = [this, shader](int nx, int ny) {
+			return nx >= 0 && nx < this->width && ny >= 0 && ny < this->height && this->shaders[size_t(ny) * this->width + nx] == shader;
+		};
+
+		// Offset to the neighbor, the difference is negated for neighbors on the left or top
+		int dx = (x & 1) ? -1 : 1;
+		if (!isNeighbor(x + dx, y)) dx = -dx;
+		if (isNeighbor(x + dx, y)) {
+			const Vertex& neighbor = this->fragments[size_t(y) * this->width + (x + dx)];
+			for (size_t i = 0; i < smooth; ++i) derivatives.dx[i] = float(dx) * (neighbor.varyings[i] - fragment.varyings[i]);
+		}
+
+		int dy = (y & 1) ? -1 : 1;
+		if (!isNeighbor(x, y + dy)) dy = -dy;
+		if (isNeighbor(x, y + dy)) {
+			const Vertex& neighbor = this->fragments[size_t(y + dy) * this->width + x];
+			for (size_t i = 0; i < smooth; ++i) derivatives.dy[i] = float(dy) * (neighbor.varyings[i] - fragment.varyings[i]);
+		}
+
+		return derivatives;
+	}
+
+	int GBuffer::getWidth() const {
+		return this->width;
+	}
+
+	int GBuffer::getHeight() const {
+		return this->height;
+	}
+
+}
@@ -0,0 +1,98 @@
+#include "SoftwareRenderer/HalfSpaceRasterizer.h"
+
+#include <cmath>
+#include <functional>
+
+namespace sr {
+
+	// Keeps the per pixel edge values of a crossed block within 32 bit
+	constexpr float GUARD_BAND = 65536.0f;
+
+	bool HalfSpaceRasterizer::setup(const Vertex& v1, const Vertex& v2, const Vertex& v3, const Rect& clip) {
+		std::array<std::reference_wrapper<const Vertex>, 3> v = { v1, v2, v3 };
+
+		for (const Vertex& vert : v) {
+			const auto& pos = vert.getPosition();
+			if (!(std::abs(pos.getX()) <= GUARD_BAND && std::abs(pos.getY()) <= GUARD_BAND)) return false;
+		}
+
+		this->bounds = {};
+
+		// Snap to the subpixel grid
+		constexpr float subpixels = float(1 << HALF_SPACE_SUBPIXEL_BITS);
+		std::array<int64_t, 3> xs, ys;
+		for (int i = 0; i < 3; ++i) {
+			xs[i] = std::lround(v[i].get().getPosition().getX() * subpixels);
+			ys[i] = std::lround(v[i].get().getPosition().getY() * subpixels);
+		}
+
+		int64_t area = (xs[1] - xs[0]) * (ys[2] - ys[0]) - (xs[2] - xs[0]) * (ys[1] - ys[0]);
+		if (area == 0) return true; // Degenerate, nothing to draw
+
+		// Make the edge functions positive inside
+		if (area < 0) {
+			std::swap(v[1], v[2]);
+			std::swap(xs[1], xs[2]);
+			std::swap(ys[1], ys[2]);
+		}
+
+		constexpr int64_t one = 1 << HALF_SPACE_SUBPIXEL_BITS;
+		for (int i = 0; i < 3; ++i) {
+			const int j = (i + 1) % 3;
+
+			const int64_t a = ys[i] - ys[j];
+			const int64_t b = xs[j] - xs[i];
+			const int64_t c = xs[i] * ys[j] - ys[i] * xs[j];
+
+			// Top-left fill rule: pixel centers on right or bottom edges are not covered
+			const bool topLeft = a > 0 || (a == 0 && b > 0);
+
+			this->edges[i].stepX = a * one;
+			this->edges[i].stepY = b * one;
+			this->edges[i].offset = (a + b) * (one / 2) + c + (topLeft ? 0 : -1);
+		}
+
+		// Attribute planes
+		const auto& p0 = v[0].get().getPosition();
+		const auto& p1 = v[1].get().getPosition();
+		const auto& p2 = v[2].get().getPosition();
+
+		const float dx1 = p1.getX() - p0.getX();
+		const float dy1 = p1.getY() - p0.getY();
+		const float dx2 = p2.getX() - p0.getX();
+		const float dy2 = p2.getY() - p0.getY();
+
+		const float areaf = dx1 * dy2 - dx2 * dy1;
+		if (areaf == 0.0f) return true;
+
+		const Vertex d1 = v[1].get() - v[0].get();
+		const Vertex d2 = v[2].get() - v[0].get();
+
+		this->ddx = (1.0f / areaf) * (dy2 * d1 - dy1 * d2);
+		this->ddy = (1.0f / areaf) * (dx1 * d2 - dx2 * d1);
+
+		// Pixel bounds, conservative, exact coverage is decided by the edge functions
+		Rect triangleBounds{};
+		triangleBounds.xMin = int(std::floor(std::min({ p0.getX(), p1.getX(), p2.getX() })));
+		triangleBounds.yMin = int(std::floor(std::min({ p0.getY(), p1.getY(), p2.getY() })));
+		triangleBounds.xMax = int(std::floor(std::max({ p0.getX(), p1.getX(), p2.getX() }))) + 1;
+		triangleBounds.yMax = int(std::floor(std::max({ p0.getY(), p1.getY(), p2.getY() }))) + 1;
+
+		this->bounds.xMin = std::max(triangleBounds.xMin, clip.xMin);
+		this->bounds.yMin = std::max(triangleBounds.yMin, clip.yMin);
+		this->bounds.xMax = std::min(triangleBounds.xMax, clip.xMax);
+		this->bounds.yMax = std::min(triangleBounds.yMax, clip.yMax);
+		if (this->bounds.isEmpty()) return true;
+
+		this->origin = v[0].get()
+			+ (float(this->bounds.xMin) + 0.5f - p0.getX()) * this->ddx
+			+ (float(this->bounds.yMin) + 0.5f - p0.getY()) * this->ddy;
+
+		return true;
+	}
+
+	const Rect& HalfSpaceRasterizer::getBounds() const {
+		return this->bounds;
+	}
+
+}
@@ -0,0 +1,120 @@
+#include "SoftwareRenderer/MappedFile.h"
+
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace sr {
+
+#ifdef _WIN32
+
+	MappedFile::MappedFile(const std::string& path) {
+		this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (this->file == INVALID_HANDLE_VALUE) {
+			this->file = nullptr;
+			return;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(this->file, &fileSize)) return;
+		this->size = size_t(fileSize.QuadPart);
+
+		// Empty files can not be mapped
+		if (this->size == 0) {
+			this->open = true;
+			return;
+		}
+
+		this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (this->mapping == nullptr) return;
+
+		this->data = static_cast<const char*>(MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0));
+		this->open = this->data != nullptr;
+	}
+
+	MappedFile::~MappedFile() {
+		if (this->data != nullptr) UnmapViewOfFile(this->data);
+		if (this->mapping != nullptr) CloseHandle(this->mapping);
+		if (this->file != nullptr) CloseHandle(this->file);
+	}
+
+#else
+
+	MappedFile::MappedFile(const std::string& path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			::close(fd);
+			return;
+		}
+		this->size = size_t(info.st_size);
+
+		// Empty files can not be mapped
+		if (this->size == 0) {
+			::close(fd);
+			this->open = true;
+			return;
+		}
+
+		void* mapped = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // The mapping keeps the file alive
+		if (mapped == MAP_FAILED) return;
+
+		madvise(mapped, this->size, MADV_SEQUENTIAL);
+
+		this->data = static_cast<const char*>(mapped);
+		this->open = true;
+	}
+
+	MappedFile::~MappedFile() {
+		if (this->data != nullptr) munmap(const_cast<char*>(this->data), this->size);
+	}
+
+#endif
+
+	bool MappedFile::isOpen() const {
+		return this->open;
+	}
+
+	std::string_view MappedFile::getView() const {
+		if (this->data == nullptr) return {};
+		return std::string_view(this->data, this->size);
+	}
+
+	bool writeFileAtomically(const std::string& path, std::string_view bytes) {
+		const std::string temporaryPath = path + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+		{
+			std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+			if (!output.is_open()) return false;
+			output.write(bytes.data(), std::streamsize(bytes.size()));
+			output.close();
+			if (output.fail()) {
+				std::error_code error;
+				std::filesystem::remove(temporaryPath, error);
+				return false;
+			}
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, path, error);
+		if (error) {
+			std::filesystem::remove(temporaryPath, error);
+			return false;
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,244 @@
+#include "SoftwareRenderer/Mesh.h"
+
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include "SoftwareRenderer/MappedFile.h"
+
+namespace sr {
+
+	constexpr uint32_t MESH_FILE_HAS_BOUNDS = 1;
+
+	class MeshFileHeader {
+	public:
+		char magic[4];
+		uint32_t version;
+		uint32_t endianTag;
+		uint32_t attributeCount;
+		uint64_t vertexCount;
+		uint64_t triangleCount;
+		uint64_t indexOffset;
+		uint32_t flags;
+		float boundsMin[3];
+		float boundsMax[3];
+		uint32_t clusterCount;
+		uint64_t clusterOffset;
+	};
+
+	class MeshFileAttribute {
+	public:
+		uint32_t semantic;
+		uint32_t components;
+		uint64_t offset;
+	};
+
+	class MeshFileCluster {
+	public:
+		uint32_t triangleOffset;
+		uint32_t triangleCount;
+		float center[3];
+		float radius;
+		float coneAxis[3];
+		float coneCutoff;
+	};
+
+	static_assert(sizeof(MeshFileHeader) == 80 && sizeof(MeshFileAttribute) == 16 && sizeof(MeshFileCluster) == 40);
+
+	// Mesh
+
+	const Mesh::Attribute* Mesh::findAttribute(MeshAttribute semantic) const {
+		for (auto& attribute : this->attributes) {
+			if (attribute.semantic == semantic) return &attribute;
+		}
+		return nullptr;
+	}
+
+	bool Mesh::hasAttribute(MeshAttribute semantic) const {
+		return this->findAttribute(semantic) != nullptr;
+	}
+
+	IntegerDataBuffer<3> Mesh::getIndices() const {
+		return IntegerDataBuffer<3>(this->owner, this->indices, this->triangleCount * 3);
+	}
+
+	const std::vector<MeshCluster>& Mesh::getClusters() const {
+		return this->clusters;
+	}
+
+	size_t Mesh::getVertexCount() const {
+		return this->vertexCount;
+	}
+
+	size_t Mesh::getTriangleCount() const {
+		return this->triangleCount;
+	}
+
+	bool Mesh::hasBounds() const {
+		return this->boundsValid;
+	}
+
+	const lm::Vector3f& Mesh::getBoundsMin() const {
+		return this->boundsMin;
+	}
+
+	const lm::Vector3f& Mesh::getBoundsMax() const {
+		return this->boundsMax;
+	}
+
+	// Serialization
+
+	std::vector<char> serializeMesh(const std::vector<MeshAttributeData>& attributes, const std::vector<int>& indices, const std::vector<MeshCluster>& clusters) {
+		if (indices.size() % 3 != 0) return {};
+		for (auto& cluster : clusters) {
+			if (size_t(cluster.triangleOffset) + cluster.triangleCount > indices.size() / 3) return {};
+		}
+
+		size_t vertexCount = 0;
+		for (size_t i = 0; i < attributes.size(); ++i) {
+			const auto& attribute = attributes[i];
+			if (attribute.components == 0 || attribute.components > 4 || attribute.data.size() % attribute.components != 0) return {};
+
+			const size_t count = attribute.data.size() / attribute.components;
+			if (i > 0 && count != vertexCount) return {}; // Attributes have to describe the same vertices
+			vertexCount = count;
+		}
+
+		MeshFileHeader header{};
+		std::memcpy(header.magic, "SRMF", 4);
+		header.version = MESH_FILE_VERSION;
+		header.endianTag = FILE_ENDIAN_TAG;
+		header.attributeCount = uint32_t(attributes.size());
+		header.vertexCount = vertexCount;
+		header.triangleCount = indices.size() / 3;
+
+		// Layout
+		std::vector<MeshFileAttribute> table(attributes.size());
+		size_t offset = alignFileOffset(sizeof(MeshFileHeader) + table.size() * sizeof(MeshFileAttribute));
+		for (size_t i = 0; i < attributes.size(); ++i) {
+			table[i] = { uint32_t(attributes[i].semantic), attributes[i].components, offset };
+			offset = alignFileOffset(offset + attributes[i].data.size() * sizeof(float));
+		}
+		header.indexOffset = offset;
+		header.clusterCount = uint32_t(clusters.size());
+		header.clusterOffset = alignFileOffset(offset + indices.size() * sizeof(int));
+		const size_t fileSize = header.clusterOffset + clusters.size() * sizeof(MeshFileCluster);
+
+		// Bounds
+		for (auto& attribute : attributes) {
+			if (attribute.semantic != MeshAttribute::POSITION || attribute.components < 3 || vertexCount == 0) continue;
+
+			for (int axis = 0; axis < 3; ++axis) {
+				header.boundsMin[axis] = std::numeric_limits<float>::max();
+				header.boundsMax[axis] = std::numeric_limits<float>::lowest();
+			}
+			for (size_t v = 0; v < vertexCount; ++v) {
+				for (int axis = 0; axis < 3; ++axis) {
+					const float value = attribute.data[v * attribute.components + axis];
+					header.boundsMin[axis] = std::min(header.boundsMin[axis], value);
+					header.boundsMax[axis] = std::max(header.boundsMax[axis], value);
+				}
+			}
+			header.flags |= MESH_FILE_HAS_BOUNDS;
+			break;
+		}
+
+		std::vector<char> bytes(fileSize, 0);
+		std::memcpy(bytes.data(), &header, sizeof(header));
+		if (!table.empty()) std::memcpy(bytes.data() + sizeof(header), table.data(), table.size() * sizeof(MeshFileAttribute));
+		for (size_t i = 0; i < attributes.size(); ++i) {
+			if (!attributes[i].data.empty()) std::memcpy(bytes.data() + table[i].offset, attributes[i].data.data(), attributes[i].data.size() * sizeof(float));
+		}
+		if (!indices.empty()) std::memcpy(bytes.data() + header.indexOffset, indices.data(), indices.size() * sizeof(int));
+		for (size_t i = 0; i < clusters.size(); ++i) {
+			const auto& cluster = clusters[i];
+			const MeshFileCluster fileCluster = {
+				cluster.triangleOffset, cluster.triangleCount,
+				{ cluster.center[0], cluster.center[1], cluster.center[2] }, cluster.radius,
+				{ cluster.coneAxis[0], cluster.coneAxis[1], cluster.coneAxis[2] }, cluster.coneCutoff
+			};
+			std::memcpy(bytes.data() + header.clusterOffset + i * sizeof(MeshFileCluster), &fileCluster, sizeof(fileCluster));
+		}
+
+		return bytes;
+	}
+
+	std::optional<Mesh> parseMesh(std::shared_ptr<const void> owner, std::string_view bytes) {
+		MeshFileHeader header;
+		if (bytes.size() < sizeof(header)) return {};
+		std::memcpy(&header, bytes.data(), sizeof(header));
+
+		if (std::memcmp(header.magic, "SRMF", 4) != 0) return {};
+		if (header.version != MESH_FILE_VERSION || header.endianTag != FILE_ENDIAN_TAG) return {};
+
+		// Every section has to lie within the file
+		auto fits = [&bytes](uint64_t offset, uint64_t count, uint64_t elementSize) {
+			if (offset % alignof(float) != 0 || offset > bytes.size()) return false;
+			return count <= (bytes.size() - offset) / elementSize;
+		};
+
+		if (!fits(sizeof(header), header.attributeCount, sizeof(MeshFileAttribute))) return {};
+		if (!fits(header.indexOffset, header.triangleCount, 3 * sizeof(int))) return {};
+		if (!fits(header.clusterOffset, header.clusterCount, sizeof(MeshFileCluster))) return {};
+
+		Mesh mesh;
+		mesh.vertexCount = size_t(header.vertexCount);
+		mesh.triangleCount = size_t(header.triangleCount);
+		mesh.indices = reinterpret_cast<const int*>(bytes.data() + header.indexOffset);
+
+		// A stale or edited file must not make the renderer read past the vertices
+		for (size_t i = 0; i < mesh.triangleCount * 3; ++i) {
+			if (mesh.indices[i] < 0 || uint64_t(mesh.indices[i]) >= header.vertexCount) return {};
+		}
+
+		for (uint32_t i = 0; i < header.attributeCount; ++i) {
+			MeshFileAttribute attribute;
+			std::memcpy(&attribute, bytes.data() + sizeof(header) + i * sizeof(MeshFileAttribute), sizeof(attribute));
+
+			if (attribute.components == 0 || attribute.components > 4) return {};
+			if (!fits(attribute.offset, header.vertexCount, attribute.components * sizeof(float))) return {};
+
+			mesh.attributes.push_back({ MeshAttribute(attribute.semantic), attribute.components, reinterpret_cast<const float*>(bytes.data() + attribute.offset) });
+		}
+
+		mesh.clusters.reserve(header.clusterCount);
+		for (uint32_t i = 0; i < header.clusterCount; ++i) {
+			MeshFileCluster fileCluster;
+			std::memcpy(&fileCluster, bytes.data() + header.clusterOffset + i * sizeof(MeshFileCluster), sizeof(fileCluster));
+			if (uint64_t(fileCluster.triangleOffset) + fileCluster.triangleCount > header.triangleCount) return {};
+
+			MeshCluster cluster{};
+			cluster.triangleOffset = fileCluster.triangleOffset;
+			cluster.triangleCount = fileCluster.triangleCount;
+			cluster.center = { fileCluster.center[0], fileCluster.center[1], fileCluster.center[2] };
+			cluster.radius = fileCluster.radius;
+			cluster.coneAxis = { fileCluster.coneAxis[0], fileCluster.coneAxis[1], fileCluster.coneAxis[2] };
+			cluster.coneCutoff = fileCluster.coneCutoff;
+			mesh.clusters.push_back(cluster);
+		}
+
+		if (header.flags & MESH_FILE_HAS_BOUNDS) {
+			mesh.boundsValid = true;
+			mesh.boundsMin = { header.boundsMin[0], header.boundsMin[1], header.boundsMin[2] };
+			mesh.boundsMax = { header.boundsMax[0], header.boundsMax[1], header.boundsMax[2] };
+		}
+
+		mesh.owner = std::move(owner);
+		return mesh;
+	}
+
+	bool saveMesh(const std::string& path, const std::vector<MeshAttributeData>& attributes, const std::vector<int>& indices, const std::vector<MeshCluster>& clusters) {
+		auto bytes = serializeMesh(attributes, indices, clusters);
+		if (bytes.empty()) return false;
+		return writeFileAtomically(path, std::string_view(bytes.data(), bytes.size()));
+	}
+
+	std::optional<Mesh> loadMesh(const std::string& path) {
+		auto file = std::make_shared<MappedFile>(path);
+		if (!file->isOpen()) return {};
+
+		auto bytes = file->getView();
+		return parseMesh(std::move(file), bytes);
+	}
+
+}
@@ -0,0 +1,234 @@
+#include "SoftwareRenderer/MeshCluster.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace sr {
+
+	lm::Vector3f getClusterPosition(const float* positions, int index) {
+		const float* p = positions + size_t(index) * 3;
+		return { p[0], p[1], p[2] };
+	}
+
+	lm::Vector3f getClusterFaceNormal(const std::vector<int>& indices, const std::vector<float>& positions, size_t triangle) {
+		auto p1 = getClusterPosition(positions.data(), indices[triangle * 3]);
+		auto p2 = getClusterPosition(positions.data(), indices[triangle * 3 + 1]);
+		auto p3 = getClusterPosition(positions.data(), indices[triangle * 3 + 2]);
+
+		auto n = lm::cross(p2 - p1, p3 - p1);
+		const float length = std::sqrt(n * n);
+		return length > 0 ? (1.0f / length) * n : n;
+	}
+
+	// Bounding sphere and normal cone of consecutive triangles
+	MeshCluster computeMeshCluster(const std::vector<int>& indices, const std::vector<float>& positions, const std::vector<lm::Vector3f>& faceNormals, size_t begin, size_t end) {
+		MeshCluster cluster{};
+		cluster.triangleOffset = uint32_t(begin);
+		cluster.triangleCount = uint32_t(end - begin);
+
+		// Sphere around the center of the bounding box
+		lm::Vector3f lo = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+		lm::Vector3f hi = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+		for (size_t i = begin * 3; i < end * 3; ++i) {
+			auto p = getClusterPosition(positions.data(), indices[i]);
+			for (size_t axis = 0; axis < 3; ++axis) {
+				lo[axis] = std::min(lo[axis], p[axis]);
+				hi[axis] = std::max(hi[axis], p[axis]);
+			}
+		}
+		cluster.center = 0.5f * (lo + hi);
+
+		float radiusSquared = 0;
+		for (size_t i = begin * 3; i < end * 3; ++i) {
+			auto d = getClusterPosition(positions.data(), indices[i]) - cluster.center;
+			radiusSquared = std::max(radiusSquared, d * d);
+		}
+		cluster.radius = std::sqrt(radiusSquared);
+
+		// Cone around the average normal, degenerate triangles have no orientation
+		lm::Vector3f axis = { 0, 0, 0 };
+		for (size_t t = begin; t < end; ++t) axis = axis + faceNormals[t];
+
+		cluster.coneAxis = { 0, 0, 0 };
+		cluster.coneCutoff = 1;
+
+		const float axisLength = std::sqrt(axis * axis);
+		if (axisLength == 0) return cluster;
+		axis = (1.0f / axisLength) * axis;
+
+		float minCos = 1;
+		for (size_t t = begin; t < end; ++t) {
+			if (faceNormals[t] * faceNormals[t] > 0) minCos = std::min(minCos, faceNormals[t] * axis);
+		}
+
+		if (minCos > 0) {
+			cluster.coneAxis = axis;
+			cluster.coneCutoff = std::sqrt(1 - minCos * minCos);
+		}
+		return cluster;
+	}
+
+	std::vector<MeshCluster> buildMeshClusters(std::vector<int>& indices, const std::vector<float>& positions, size_t clusterSize) {
+		const size_t triangleCount = indices.size() / 3;
+		const size_t vertexCount = positions.size() / 3;
+		if (clusterSize == 0 || triangleCount == 0) return {};
+
+		// Triangles adjacent to every vertex
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < triangleCount * 3; ++i) adjacencyOffsets[indices[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; ++i) adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+
+		std::vector<lm::Vector3f> faceNormals(triangleCount);
+		for (size_t t = 0; t < triangleCount; ++t) faceNormals[t] = getClusterFaceNormal(indices, positions, t);
+
+		// Grow every cluster from the first remaining triangle, preferring neighbors that share vertices and orientation
+		std::vector<bool> assigned(triangleCount, false);
+		std::vector<uint32_t> vertexCluster(vertexCount, 0); // cluster number + 1 of the last cluster using the vertex
+		std::vector<uint32_t> candidateCluster(triangleCount, 0);
+		std::vector<uint32_t> candidates;
+		std::vector<uint32_t> order;
+		std::vector<size_t> clusterBegins;
+		order.reserve(triangleCount);
+
+		size_t seed = 0;
+		uint32_t clusterNumber = 0;
+		while (order.size() < triangleCount) {
+			while (assigned[seed]) seed++;
+			clusterNumber++;
+			clusterBegins.push_back(order.size());
+
+			lm::Vector3f axis = { 0, 0, 0 };
+			lm::Vector3f normalSum = { 0, 0, 0 };
+			candidates.assign(1, uint32_t(seed));
+			candidateCluster[seed] = clusterNumber;
+
+			for (size_t size = 0; size < clusterSize && !candidates.empty(); ++size) {
+				// Fewest new vertices first, then the normal closest to the cluster
+				size_t best = 0;
+				float bestScore = std::numeric_limits<float>::max();
+				for (size_t c = 0; c < candidates.size(); ++c) {
+					const uint32_t t = candidates[c];
+
+					int newVertices = 0;
+					for (size_t corner = 0; corner < 3; ++corner) newVertices += vertexCluster[indices[t * 3 + corner]] != clusterNumber;
+
+					const float score = float(newVertices) + MESH_CLUSTER_CONE_WEIGHT * (1.0f - faceNormals[t] * axis);
+					if (score < bestScore) {
+						bestScore = score;
+						best = c;
+					}
+				}
+
+				const uint32_t triangle = candidates[best];
+				candidates[best] = candidates.back();
+				candidates.pop_back();
+
+				assigned[triangle] = true;
+				order.push_back(triangle);
+				normalSum = normalSum + faceNormals[triangle];
+				const float length = std::sqrt(normalSum * normalSum);
+				if (length > 0) axis = (1.0f / length) * normalSum;
+
+				for (size_t corner = 0; corner < 3; ++corner) {
+					const int v = indices[triangle * 3 + corner];
+					if (vertexCluster[v] == clusterNumber) continue;
+					vertexCluster[v] = clusterNumber;
+
+					for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a) {
+						const uint32_t neighbor = adjacency[a];
+						if (assigned[neighbor] || candidateCluster[neighbor] == clusterNumber) continue;
+						candidateCluster[neighbor] = clusterNumber;
+						candidates.push_back(neighbor);
+					}
+				}
+			}
+		}
+
+		// Store the triangles cluster by cluster
+		std::vector<int> clustered(triangleCount * 3);
+		std::vector<lm::Vector3f> clusteredNormals(triangleCount);
+		for (size_t i = 0; i < triangleCount; ++i) {
+			std::copy_n(indices.begin() + size_t(order[i]) * 3, 3, clustered.begin() + i * 3);
+			clusteredNormals[i] = faceNormals[order[i]];
+		}
+		indices = std::move(clustered);
+
+		std::vector<MeshCluster> clusters;
+		clusters.reserve(clusterBegins.size());
+		for (size_t c = 0; c < clusterBegins.size(); ++c) {
+			const size_t end = c + 1 < clusterBegins.size() ? clusterBegins[c + 1] : triangleCount;
+			clusters.push_back(computeMeshCluster(indices, positions, clusteredNormals, clusterBegins[c], end));
+		}
+		return clusters;
+	}
+
+	// ClusterCuller
+
+	ClusterCuller::ClusterCuller(const lm::Matrix4x4f& objectToClip, int width, int height, bool backfaceCulling) {
+		const auto& x = objectToClip[0];
+		const auto& y = objectToClip[1];
+		const auto& z = objectToClip[2];
+		const auto& w = objectToClip[3];
+
+		// -w <= x, y <= w widened by a pixel, truncated wireframe coordinates may touch the border. Near plane z >= -w as clipped.
+		const float kx = 1.0f + 2.0f / float(std::max(width, 1));
+		const float ky = 1.0f + 2.0f / float(std::max(height, 1));
+		const lm::Vector4f sides[5] = { x + kx * w, kx * w - x, y + ky * w, ky * w - y, z + w };
+
+		for (auto& plane : sides) {
+			const float length = std::sqrt(plane.getXYZ() * plane.getXYZ());
+			if (length > 0) this->planes.push_back((1.0f / length) * plane);
+		}
+
+		if (!backfaceCulling) return;
+
+		// Screen space orientation of a triangle is det(A) * dot(n, p - eye) with A the upper left 3x3 of the x, y, w rows.
+		// The renderer culls triangles with a negative value.
+		const float a[3][4] = {
+			{ x[0], x[1], x[2], x[3] },
+			{ y[0], y[1], y[2], y[3] },
+			{ w[0], w[1], w[2], w[3] }
+		};
+		const float det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+			- a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+			+ a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+		if (std::abs(det) < 1e-12f) return; // Parallel projection, no eye position
+
+		// A * eye = -t by Cramer's rule
+		float eye[3];
+		for (int c = 0; c < 3; ++c) {
+			float m[3][3];
+			for (int r = 0; r < 3; ++r) {
+				for (int k = 0; k < 3; ++k) m[r][k] = k == c ? -a[r][3] : a[r][k];
+			}
+			eye[c] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+				- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+				+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+		}
+
+		this->eye = { eye[0], eye[1], eye[2] };
+		this->orientation = det > 0 ? -1.0f : 1.0f;
+	}
+
+	bool ClusterCuller::isVisible(const MeshCluster& cluster) const {
+		const lm::Vector4f center(cluster.center, 1.0f);
+		for (auto& plane : this->planes) {
+			if (plane * center < -cluster.radius) return false;
+		}
+
+		if (this->orientation != 0 && cluster.coneCutoff < 1) {
+			// Every view direction to the sphere is within the cone angle of 90 degrees to the normals
+			const auto d = cluster.center - this->eye;
+			const float distance = std::sqrt(d * d);
+			if (this->orientation * (cluster.coneAxis * d) > cluster.coneCutoff * distance + cluster.radius * (1 + cluster.coneCutoff)) return false;
+		}
+
+		return true;
+	}
+
+}
@@ -0,0 +1,252 @@
+#include "SoftwareRenderer/MeshOptimizer.h"
+
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+namespace sr {
+
+	// FIFO cache of transformed vertices, a vertex is cached while less than cacheSize misses happened after its own
+	class VertexCacheSimulation {
+	private:
+		std::vector<uint32_t> cacheTime;
+		uint32_t timestamp;
+		uint32_t cacheSize;
+
+	public:
+		VertexCacheSimulation(size_t vertexCount, size_t cacheSize)
+			: cacheTime(vertexCount, 0), timestamp(uint32_t(cacheSize) + 1), cacheSize(uint32_t(cacheSize)) {
+		}
+
+		bool isCached(int vertex) const {
+			return this->timestamp - this->cacheTime[vertex] <= this->cacheSize;
+		}
+
+		uint32_t getAge(int vertex) const {
+			return this->timestamp - this->cacheTime[vertex];
+		}
+
+		// Returns true on a cache miss
+		bool access(int vertex) {
+			if (this->isCached(vertex)) return false;
+			this->cacheTime[vertex] = this->timestamp++;
+			return true;
+		}
+
+		void flush() {
+			this->timestamp += this->cacheSize + 1;
+		}
+	};
+
+	float getCacheMissRatio(const std::vector<int>& indices, size_t vertexCount, size_t cacheSize) {
+		if (indices.size() < 3) return 0.0f;
+
+		VertexCacheSimulation cache(vertexCount, cacheSize);
+		size_t misses = 0;
+		for (int index : indices) misses += cache.access(index);
+		return float(misses) / float(indices.size() / 3);
+	}
+
+	std::vector<int> optimizeVertexCache(const std::vector<int>& indices, size_t vertexCount, std::vector<size_t>* clusters) {
+		const size_t triangleCount = indices.size() / 3;
+		if (clusters != nullptr) clusters->assign(1, 0);
+		if (triangleCount == 0) return indices;
+
+		// Triangles adjacent to every vertex
+		std::vector<uint32_t> liveTriangles(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; ++i) liveTriangles[indices[i]]++;
+
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; ++i) adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+
+		VertexCacheSimulation cache(vertexCount, MESH_OPTIMIZER_CACHE_SIZE);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<int> deadEnds;
+		std::vector<int> candidates;
+		size_t cursor = 0;
+
+		std::vector<int> result;
+		result.reserve(triangleCount * 3);
+
+		int vertex = indices[0];
+		while (vertex >= 0) {
+			// Emit all remaining triangles around the fanning vertex
+			candidates.clear();
+			for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; ++a) {
+				const uint32_t triangle = adjacency[a];
+				if (emitted[triangle]) continue;
+				emitted[triangle] = true;
+
+				for (size_t corner = 0; corner < 3; ++corner) {
+					const int v = indices[triangle * 3 + corner];
+					result.push_back(v);
+					deadEnds.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+					cache.access(v);
+				}
+			}
+
+			// Next fanning vertex: the oldest candidate that stays cached while its fan is emitted
+			int next = -1;
+			int64_t bestPriority = -1;
+			for (int v : candidates) {
+				if (liveTriangles[v] == 0) continue;
+
+				int64_t priority = 0;
+				if (cache.getAge(v) + 2 * liveTriangles[v] <= MESH_OPTIMIZER_CACHE_SIZE) priority = cache.getAge(v);
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					next = v;
+				}
+			}
+
+			if (next < 0) {
+				// Dead end, continue at a recently used vertex or the next unprocessed one
+				while (!deadEnds.empty() && next < 0) {
+					const int v = deadEnds.back();
+					deadEnds.pop_back();
+					if (liveTriangles[v] > 0) next = v;
+				}
+				while (cursor < vertexCount && next < 0) {
+					if (liveTriangles[cursor] > 0) next = int(cursor);
+					else cursor++;
+				}
+
+				if (next >= 0 && clusters != nullptr && clusters->back() != result.size() / 3) clusters->push_back(result.size() / 3);
+			}
+
+			vertex = next;
+		}
+
+		return result;
+	}
+
+	std::vector<int> optimizeOverdraw(const std::vector<int>& indices, const std::vector<float>& positions, const std::vector<size_t>& clusters, float threshold) {
+		const size_t triangleCount = indices.size() / 3;
+		const size_t vertexCount = positions.size() / 3;
+		if (triangleCount == 0) return indices;
+
+		// Split the clusters where the cache miss ratio of the part is good enough
+		std::vector<size_t> boundaries;
+		VertexCacheSimulation cache(vertexCount, MESH_OPTIMIZER_CACHE_SIZE);
+
+		for (size_t c = 0; c < std::max<size_t>(clusters.size(), 1); ++c) {
+			const size_t begin = clusters.empty() ? 0 : clusters[c];
+			const size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+			if (begin >= end) continue;
+
+			cache.flush();
+			size_t clusterMisses = 0;
+			for (size_t i = begin * 3; i < end * 3; ++i) clusterMisses += cache.access(indices[i]);
+			const float limit = threshold * float(clusterMisses) / float(end - begin);
+
+			cache.flush();
+			boundaries.push_back(begin);
+			size_t partBegin = begin;
+			size_t partMisses = 0;
+			for (size_t t = begin; t + 1 < end; ++t) {
+				for (size_t corner = 0; corner < 3; ++corner) partMisses += cache.access(indices[t * 3 + corner]);
+
+				if (float(partMisses) <= limit * float(t + 1 - partBegin)) {
+					boundaries.push_back(t + 1);
+					cache.flush();
+					partBegin = t + 1;
+					partMisses = 0;
+				}
+			}
+		}
+
+		// Area weighted centroid and normal of the mesh and the clusters
+		auto accumulate = [&indices, &positions](size_t begin, size_t end, float* centroid, float* normal) {
+			float area = 0;
+			for (size_t t = begin; t < end; ++t) {
+				const float* v1 = &positions[size_t(indices[t * 3]) * 3];
+				const float* v2 = &positions[size_t(indices[t * 3 + 1]) * 3];
+				const float* v3 = &positions[size_t(indices[t * 3 + 2]) * 3];
+
+				const float d1[3] = { v2[0] - v1[0], v2[1] - v1[1], v2[2] - v1[2] };
+				const float d2[3] = { v3[0] - v1[0], v3[1] - v1[1], v3[2] - v1[2] };
+				const float n[3] = { d1[1] * d2[2] - d1[2] * d2[1], d1[2] * d2[0] - d1[0] * d2[2], d1[0] * d2[1] - d1[1] * d2[0] };
+				const float triangleArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+				for (int axis = 0; axis < 3; ++axis) {
+					centroid[axis] += (v1[axis] + v2[axis] + v3[axis]) / 3.0f * triangleArea;
+					normal[axis] += n[axis];
+				}
+				area += triangleArea;
+			}
+			if (area > 0) for (int axis = 0; axis < 3; ++axis) centroid[axis] /= area;
+		};
+
+		float meshCentroid[3] = {};
+		float meshNormal[3] = {};
+		accumulate(0, triangleCount, meshCentroid, meshNormal);
+
+		std::vector<float> sortKeys(boundaries.size());
+		for (size_t c = 0; c < boundaries.size(); ++c) {
+			const size_t end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+
+			float centroid[3] = {};
+			float normal[3] = {};
+			accumulate(boundaries[c], end, centroid, normal);
+
+			const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			float key = 0;
+			if (length > 0) for (int axis = 0; axis < 3; ++axis) key += (centroid[axis] - meshCentroid[axis]) * normal[axis] / length;
+			sortKeys[c] = key;
+		}
+
+		// Clusters facing away from the center occlude the others from most viewpoints
+		std::vector<size_t> order(boundaries.size());
+		std::iota(order.begin(), order.end(), size_t(0));
+		std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<int> result;
+		result.reserve(triangleCount * 3);
+		for (size_t c : order) {
+			const size_t end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+			result.insert(result.end(), indices.begin() + boundaries[c] * 3, indices.begin() + end * 3);
+		}
+		return result;
+	}
+
+	std::vector<int> optimizeVertexFetch(std::vector<int>& indices, size_t vertexCount) {
+		std::vector<int> remap(vertexCount, -1);
+		int nextVertex = 0;
+		for (int& index : indices) {
+			if (remap[index] < 0) remap[index] = nextVertex++;
+			index = remap[index];
+		}
+		return remap;
+	}
+
+	void remapVertexAttribute(std::vector<float>& data, size_t components, const std::vector<int>& remap) {
+		size_t vertexCount = 0;
+		for (int index : remap) vertexCount += index >= 0;
+
+		std::vector<float> remapped(vertexCount * components);
+		for (size_t v = 0; v < remap.size(); ++v) {
+			if (remap[v] < 0) continue;
+			std::copy_n(data.begin() + v * components, components, remapped.begin() + size_t(remap[v]) * components);
+		}
+		data = std::move(remapped);
+	}
+
+	void optimizeMesh(std::vector<int>& indices, std::vector<float>& positions, const std::vector<MeshStream>& attributes) {
+		const size_t vertexCount = positions.size() / 3;
+
+		std::vector<size_t> clusters;
+		indices = optimizeVertexCache(indices, vertexCount, &clusters);
+		indices = optimizeOverdraw(indices, positions, clusters);
+
+		auto remap = optimizeVertexFetch(indices, vertexCount);
+		remapVertexAttribute(positions, 3, remap);
+		for (auto& attribute : attributes) remapVertexAttribute(attribute.data, attribute.components, remap);
+	}
+
+}
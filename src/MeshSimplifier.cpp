@@ -0,0 +1,330 @@
+#include "SoftwareRenderer/MeshSimplifier.h"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+namespace sr {
+
+	#define MESH_SIMPLIFIER_BORDER_WEIGHT 10.0 // keeps border vertices on the planes perpendicular to the border
+
+	// Sum of squared distances to planes as a symmetric 4x4 matrix
+	class Quadric {
+	public:
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+
+		void addPlane(double a, double b, double c, double d, double weight) {
+			this->a2 += weight * a * a;
+			this->ab += weight * a * b;
+			this->ac += weight * a * c;
+			this->ad += weight * a * d;
+			this->b2 += weight * b * b;
+			this->bc += weight * b * c;
+			this->bd += weight * b * d;
+			this->c2 += weight * c * c;
+			this->cd += weight * c * d;
+			this->d2 += weight * d * d;
+		}
+
+		void add(const Quadric& q) {
+			this->a2 += q.a2; this->ab += q.ab; this->ac += q.ac; this->ad += q.ad;
+			this->b2 += q.b2; this->bc += q.bc; this->bd += q.bd;
+			this->c2 += q.c2; this->cd += q.cd;
+			this->d2 += q.d2;
+		}
+
+		double evaluate(const float* p) const {
+			const double x = p[0], y = p[1], z = p[2];
+			const double error = this->a2 * x * x + 2 * this->ab * x * y + 2 * this->ac * x * z + 2 * this->ad * x
+				+ this->b2 * y * y + 2 * this->bc * y * z + 2 * this->bd * y
+				+ this->c2 * z * z + 2 * this->cd * z
+				+ this->d2;
+			return std::max(error, 0.0);
+		}
+	};
+
+	class SimplifierEdge {
+	public:
+		int from;
+		int to;
+		double cost;
+	};
+
+	class PositionKeyHash {
+	public:
+		size_t operator()(const std::array<uint32_t, 3>& key) const {
+			uint64_t h = key[0] * 0x9E3779B97F4A7C15ull;
+			h ^= (key[1] + (h << 6) + (h >> 2)) * 0xBF58476D1CE4E5B9ull;
+			h ^= (key[2] + (h << 6) + (h >> 2)) * 0x94D049BB133111EBull;
+			return size_t(h ^ (h >> 31));
+		}
+	};
+
+	lm::Vector3f getSimplifierNormal(const float* p1, const float* p2, const float* p3) {
+		const lm::Vector3f d1 = { p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2] };
+		const lm::Vector3f d2 = { p3[0] - p1[0], p3[1] - p1[1], p3[2] - p1[2] };
+		return lm::cross(d1, d2);
+	}
+
+	std::vector<int> simplifyMesh(const std::vector<int>& indices, const std::vector<float>& positions, size_t targetTriangleCount, float* error) {
+		const size_t vertexCount = positions.size() / 3;
+
+		// Vertices at the same position (texture or normal seams) are collapsed together
+		std::vector<int> positionIDs(vertexCount);
+		std::vector<int> representatives;
+		{
+			std::unordered_map<std::array<uint32_t, 3>, int, PositionKeyHash> ids;
+			ids.reserve(vertexCount);
+			for (size_t v = 0; v < vertexCount; ++v) {
+				std::array<uint32_t, 3> key;
+				std::memcpy(key.data(), &positions[v * 3], sizeof(key));
+
+				auto [entry, inserted] = ids.try_emplace(key, int(representatives.size()));
+				if (inserted) representatives.push_back(int(v));
+				positionIDs[v] = entry->second;
+			}
+		}
+		const size_t positionCount = representatives.size();
+		auto getPosition = [&positions, &representatives](int id) {
+			return &positions[size_t(representatives[id]) * 3];
+		};
+
+		// Triangles in position IDs and the vertex of every corner
+		std::vector<int> triangles;
+		std::vector<int> corners;
+		triangles.reserve(indices.size());
+		corners.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			const int a = positionIDs[indices[i]], b = positionIDs[indices[i + 1]], c = positionIDs[indices[i + 2]];
+			if (a == b || b == c || c == a) continue;
+			triangles.insert(triangles.end(), { a, b, c });
+			corners.insert(corners.end(), { indices[i], indices[i + 1], indices[i + 2] });
+		}
+
+		// Edges used by one triangle only
+		auto getEdgeKey = [](int a, int b) {
+			return uint64_t(uint32_t(std::min(a, b))) << 32 | uint32_t(std::max(a, b));
+		};
+		auto findBorderEdges = [&triangles, &getEdgeKey]() {
+			std::unordered_map<uint64_t, int> edgeUses;
+			edgeUses.reserve(triangles.size());
+			for (size_t t = 0; t < triangles.size(); t += 3) {
+				for (size_t e = 0; e < 3; ++e) edgeUses[getEdgeKey(triangles[t + e], triangles[t + (e + 1) % 3])]++;
+			}
+			return edgeUses;
+		};
+
+		// Plane quadrics of the faces, border edges add a plane perpendicular to their face
+		std::vector<Quadric> quadrics(positionCount);
+		std::vector<bool> border(positionCount, false);
+		{
+			auto edgeUses = findBorderEdges();
+			for (size_t t = 0; t < triangles.size(); t += 3) {
+				const float* p[3] = { getPosition(triangles[t]), getPosition(triangles[t + 1]), getPosition(triangles[t + 2]) };
+				auto n = getSimplifierNormal(p[0], p[1], p[2]);
+				const float length = std::sqrt(n * n);
+				if (length == 0) continue;
+				n = (1.0f / length) * n;
+
+				const double d = -(double(n[0]) * p[0][0] + double(n[1]) * p[0][1] + double(n[2]) * p[0][2]);
+				for (size_t corner = 0; corner < 3; ++corner) quadrics[triangles[t + corner]].addPlane(n[0], n[1], n[2], d, 1.0);
+
+				for (size_t e = 0; e < 3; ++e) {
+					const int a = triangles[t + e], b = triangles[t + (e + 1) % 3];
+					if (edgeUses[getEdgeKey(a, b)] != 1) continue;
+					border[a] = border[b] = true;
+
+					const lm::Vector3f edge = { p[(e + 1) % 3][0] - p[e][0], p[(e + 1) % 3][1] - p[e][1], p[(e + 1) % 3][2] - p[e][2] };
+					auto side = lm::cross(edge, n);
+					const float sideLength = std::sqrt(side * side);
+					if (sideLength == 0) continue;
+					side = (1.0f / sideLength) * side;
+
+					const double sideD = -(double(side[0]) * p[e][0] + double(side[1]) * p[e][1] + double(side[2]) * p[e][2]);
+					quadrics[a].addPlane(side[0], side[1], side[2], sideD, MESH_SIMPLIFIER_BORDER_WEIGHT);
+					quadrics[b].addPlane(side[0], side[1], side[2], sideD, MESH_SIMPLIFIER_BORDER_WEIGHT);
+				}
+			}
+		}
+
+		double maxCost = 0;
+		std::vector<SimplifierEdge> edges;
+		std::vector<uint32_t> adjacencyOffsets(positionCount + 1);
+		std::vector<uint32_t> adjacency;
+		std::vector<bool> locked(positionCount);
+		std::vector<int> remap(positionCount);
+
+		// Every pass collapses the cheapest edges that do not share a neighborhood
+		while (triangles.size() / 3 > targetTriangleCount) {
+			auto edgeUses = findBorderEdges();
+
+			edges.clear();
+			for (auto& [key, uses] : edgeUses) {
+				const int a = int(key >> 32), b = int(key & 0xFFFFFFFF);
+
+				// Border vertices only move along the border
+				const bool borderEdge = uses == 1;
+				const bool aToB = !border[a] || (border[b] && borderEdge);
+				const bool bToA = !border[b] || (border[a] && borderEdge);
+				if (!aToB && !bToA) continue;
+
+				Quadric q = quadrics[a];
+				q.add(quadrics[b]);
+				const double costAToB = aToB ? q.evaluate(getPosition(b)) : std::numeric_limits<double>::max();
+				const double costBToA = bToA ? q.evaluate(getPosition(a)) : std::numeric_limits<double>::max();
+
+				if (costAToB <= costBToA) edges.push_back({ a, b, costAToB });
+				else edges.push_back({ b, a, costBToA });
+			}
+			std::sort(edges.begin(), edges.end(), [](const SimplifierEdge& x, const SimplifierEdge& y) {
+				return x.cost < y.cost || (x.cost == y.cost && (x.from < y.from || (x.from == y.from && x.to < y.to)));
+			});
+
+			// Triangles around every position
+			std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+			for (int id : triangles) adjacencyOffsets[id + 1]++;
+			for (size_t v = 0; v < positionCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			adjacency.resize(triangles.size());
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < triangles.size(); ++i) adjacency[fill[triangles[i]]++] = uint32_t(i / 3);
+
+			std::fill(locked.begin(), locked.end(), false);
+			for (size_t v = 0; v < positionCount; ++v) remap[v] = int(v);
+
+			size_t remainingTriangles = triangles.size() / 3;
+			size_t collapses = 0;
+			for (auto& edge : edges) {
+				if (remainingTriangles <= targetTriangleCount) break;
+				if (locked[edge.from] || locked[edge.to]) continue;
+
+				// The collapse must not flip a remaining triangle
+				bool valid = true;
+				const float* target = getPosition(edge.to);
+				for (uint32_t a = adjacencyOffsets[edge.from]; a < adjacencyOffsets[edge.from + 1] && valid; ++a) {
+					const int* triangle = &triangles[size_t(adjacency[a]) * 3];
+					if (triangle[0] == edge.to || triangle[1] == edge.to || triangle[2] == edge.to) continue;
+
+					const float* before[3] = { getPosition(triangle[0]), getPosition(triangle[1]), getPosition(triangle[2]) };
+					const float* after[3] = { before[0], before[1], before[2] };
+					for (size_t corner = 0; corner < 3; ++corner) {
+						if (triangle[corner] == edge.from) after[corner] = target;
+					}
+
+					const auto n0 = getSimplifierNormal(before[0], before[1], before[2]);
+					const auto n1 = getSimplifierNormal(after[0], after[1], after[2]);
+					valid = n0 * n1 > 0;
+				}
+				if (!valid) continue;
+
+				remap[edge.from] = edge.to;
+				quadrics[edge.to].add(quadrics[edge.from]);
+				maxCost = std::max(maxCost, edge.cost);
+
+				// Costs and orientations around both vertices are outdated until the next pass
+				for (int v : { edge.from, edge.to }) {
+					for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a) {
+						const int* triangle = &triangles[size_t(adjacency[a]) * 3];
+						locked[triangle[0]] = locked[triangle[1]] = locked[triangle[2]] = true;
+					}
+				}
+
+				collapses++;
+				remainingTriangles -= std::min<size_t>(remainingTriangles, 2);
+			}
+
+			if (collapses == 0) break; // No valid collapse left
+
+			// Apply the collapses and remove degenerate triangles
+			size_t write = 0;
+			for (size_t t = 0; t < triangles.size(); t += 3) {
+				const int a = remap[triangles[t]], b = remap[triangles[t + 1]], c = remap[triangles[t + 2]];
+				if (a == b || b == c || c == a) continue;
+
+				triangles[write] = a;
+				triangles[write + 1] = b;
+				triangles[write + 2] = c;
+				std::copy_n(corners.begin() + t, 3, corners.begin() + write);
+				write += 3;
+			}
+			triangles.resize(write);
+			corners.resize(write);
+		}
+
+		if (error != nullptr) *error = float(std::sqrt(maxCost));
+
+		// Corners that were not moved keep their vertex and its attributes
+		std::vector<int> result(triangles.size());
+		for (size_t i = 0; i < triangles.size(); ++i) {
+			result[i] = positionIDs[corners[i]] == triangles[i] ? corners[i] : representatives[triangles[i]];
+		}
+		return result;
+	}
+
+	MeshLodChain generateLods(const std::vector<int>& indices, const std::vector<float>& positions, size_t levelCount) {
+		MeshLodChain chain;
+
+		// Bounding sphere around the center of the bounding box
+		lm::Vector3f lo = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+		lm::Vector3f hi = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+		for (size_t i = 0; i < positions.size(); ++i) {
+			lo[i % 3] = std::min(lo[i % 3], positions[i]);
+			hi[i % 3] = std::max(hi[i % 3], positions[i]);
+		}
+		chain.center = { 0, 0, 0 };
+		if (!positions.empty()) chain.center = 0.5f * (lo + hi);
+
+		float radiusSquared = 0;
+		for (size_t i = 0; i + 2 < positions.size(); i += 3) {
+			const lm::Vector3f d = { positions[i] - chain.center[0], positions[i + 1] - chain.center[1], positions[i + 2] - chain.center[2] };
+			radiusSquared = std::max(radiusSquared, d * d);
+		}
+		chain.radius = std::sqrt(radiusSquared);
+
+		chain.levels.push_back({ indices, 0.0f });
+		while (chain.levels.size() < levelCount) {
+			const auto& previous = chain.levels.back();
+			const size_t previousTriangles = previous.indices.size() / 3;
+
+			float error = 0;
+			auto simplified = simplifyMesh(previous.indices, positions, size_t(float(previousTriangles) * MESH_LOD_REDUCTION), &error);
+			if (simplified.empty() || simplified.size() / 3 > previousTriangles * 9 / 10) break; // Not worth another level
+
+			// Deviations add up over the chain
+			const float totalError = previous.error + error;
+			chain.levels.push_back({ std::move(simplified), totalError });
+		}
+
+		return chain;
+	}
+
+	MeshLodChain generateLods(const Model3D& model, size_t levelCount) {
+		return generateLods(std::get<1>(model), std::get<0>(model), levelCount);
+	}
+
+	size_t selectLod(const MeshLodChain& chain, const lm::Matrix4x4f& objectToClip, int width, int height, float pixelError) {
+		const auto& w = objectToClip[3];
+
+		// Smallest w of the bounding sphere, the distance in front of the camera for a perspective projection
+		const float wScale = std::sqrt(w.getXYZ() * w.getXYZ());
+		const float depth = w * lm::Vector4f(chain.center, 1.0f) - chain.radius * wScale;
+		if (depth <= 0) return 0;
+
+		// Pixels per object space unit
+		const float xScale = std::sqrt(objectToClip[0].getXYZ() * objectToClip[0].getXYZ()) * float(width) / 2;
+		const float yScale = std::sqrt(objectToClip[1].getXYZ() * objectToClip[1].getXYZ()) * float(height) / 2;
+		const float pixelsPerUnit = std::max(xScale, yScale) / depth;
+
+		size_t level = 0;
+		for (size_t i = 1; i < chain.levels.size(); ++i) {
+			if (chain.levels[i].error * pixelsPerUnit <= pixelError) level = i;
+		}
+		return level;
+	}
+
+}
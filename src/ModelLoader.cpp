@@ -1,9 +1,60 @@
 #include "SoftwareRenderer/ModelLoader.h"
 
-#include <fstream>
+#include <cmath>
+#include <array>
+#include <limits>
+#include <charconv>
+#include <string_view>
+#include <filesystem>
+#include <unordered_map>
+
+#include "SoftwareRenderer/MappedFile.h"
+#include "SoftwareRenderer/ThreadPool.h"
+#include "SoftwareRenderer/MeshOptimizer.h"
 
 namespace sr {
 
+	#define OBJ_CHUNK_SIZE (size_t(1) << 20) // bytes of a file parsed by one job
+
+	constexpr int OBJ_MISSING_INDEX = std::numeric_limits<int>::min();
+
+	// Data of a range of lines
+	class ObjChunk {
+	public:
+		std::vector<float> positions;
+		std::vector<float> texCoords;
+		std::vector<float> normals;
+
+		// Position, texture coordinate and normal index of every triangle corner.
+		// Relative indices are stored relative to the beginning of the chunk and listed in relativeCorners.
+		std::vector<int> corners;
+		std::vector<size_t> relativeCorners;
+
+		bool corrupt = false;
+	};
+
+	// Hash key of a deduplicated vertex
+	class ObjVertex {
+	public:
+		int position;
+		int texCoord;
+		int normal;
+
+		bool operator==(const ObjVertex& other) const {
+			return this->position == other.position && this->texCoord == other.texCoord && this->normal == other.normal;
+		}
+	};
+
+	class ObjVertexHash {
+	public:
+		size_t operator()(const ObjVertex& v) const {
+			uint64_t h = uint32_t(v.position) * 0x9E3779B97F4A7C15ull;
+			h ^= (uint32_t(v.texCoord) + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2)) * 0xBF58476D1CE4E5B9ull;
+			h ^= (uint32_t(v.normal) + 0x94D049BB133111EBull + (h << 6) + (h >> 2)) * 0x94D049BB133111EBull;
+			return size_t(h ^ (h >> 31));
+		}
+	};
+
 	void normalize(std::vector<float>& data) {
 		float biggest = 0;
 		for (auto x : data)
@@ -11,64 +62,365 @@ namespace sr {
 		for (auto& x : data) x /= biggest;
 	}
 
-	std::vector<std::string> splitLineObj(const std::string& line) {
-		int index = 0;
-		int next = 0;
+	bool isObjSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Removes the next token from the line and returns it
+	std::string_view nextTokenObj(std::string_view& line) {
+		size_t begin = 0;
+		while (begin < line.size() && isObjSpace(line[begin])) begin++;
+
+		size_t end = begin;
+		while (end < line.size() && !isObjSpace(line[end])) end++;
+
+		auto token = line.substr(begin, end - begin);
+		line.remove_prefix(end);
+		return token;
+	}
+
+	bool parseFloatObj(std::string_view token, float& value) {
+		if (!token.empty() && token[0] == '+') token.remove_prefix(1);
+
+		const char* end = token.data() + token.size();
+		auto result = std::from_chars(token.data(), end, value);
+		return result.ec == std::errc() && result.ptr == end;
+	}
+
+	// Parses up to count floats of the line, the remaining values keep their defaults
+	bool parseFloatsObj(std::string_view& line, float* values, int minCount, int count) {
+		for (int i = 0; i < count; ++i) {
+			auto token = nextTokenObj(line);
+			if (token.empty()) return i >= minCount;
+			if (!parseFloatObj(token, values[i])) return false;
+		}
+		return true; // Further values (w, vertex colors) are ignored
+	}
+
+	// Parses one index of a face vertex, stops at '/'
+	bool parseIndexObj(std::string_view& token, int& value) {
+		if (!token.empty() && token[0] == '+') token.remove_prefix(1);
+
+		const char* end = token.data() + token.size();
+		auto result = std::from_chars(token.data(), end, value);
+		if (result.ec != std::errc() || value == 0) return false;
+
+		token.remove_prefix(result.ptr - token.data());
+		return token.empty() || token[0] == '/';
+	}
+
+	// Parses a face vertex "v", "v/vt", "v//vn" or "v/vt/vn" into chunk relative or absolute zero based indices
+	bool parseFaceVertexObj(std::string_view token, const ObjChunk& chunk, std::array<int, 3>& corner, std::array<bool, 3>& relative) {
+		corner = { OBJ_MISSING_INDEX, OBJ_MISSING_INDEX, OBJ_MISSING_INDEX };
+		relative = { false, false, false };
+
+		const size_t counts[3] = { chunk.positions.size() / 3, chunk.texCoords.size() / 2, chunk.normals.size() / 3 };
+		for (int component = 0; component < 3 && !token.empty(); ++component) {
+			if (component > 0) {
+				token.remove_prefix(1); // '/'
+				if (token.empty() || token[0] == '/') continue; // "v//vn"
+			}
+
+			int index;
+			if (!parseIndexObj(token, index)) return false;
+
+			relative[component] = index < 0;
+			corner[component] = index < 0 ? int(counts[component]) + index : index - 1;
+		}
+		return corner[0] != OBJ_MISSING_INDEX;
+	}
 
-		std::vector<std::string> subStrings;
+	void parseObjChunk(std::string_view text, ObjChunk& chunk) {
+		std::vector<std::array<int, 3>> polygon;
+		std::vector<std::array<bool, 3>> polygonRelative;
 
-		while (index < line.size()) {
-			if (line[index] == ' ') {
-				if (index != next) subStrings.push_back(line.substr(next, size_t(index) - next));
-				while (index != line.size() && line[index] == ' ') index++;
-				next = index;
+		while (!text.empty()) {
+			const size_t lineEnd = text.find('\n');
+			std::string_view line = text.substr(0, lineEnd);
+			text.remove_prefix(lineEnd == std::string_view::npos ? text.size() : lineEnd + 1);
+
+			auto keyword = nextTokenObj(line);
+			if (keyword == "v") {
+				float p[3];
+				if (!parseFloatsObj(line, p, 3, 3)) {
+					chunk.corrupt = true;
+					return;
+				}
+				chunk.positions.insert(chunk.positions.end(), { p[0], p[1], p[2] });
+			}
+			else if (keyword == "vt") {
+				float t[2] = { 0, 0 };
+				if (!parseFloatsObj(line, t, 1, 2)) {
+					chunk.corrupt = true;
+					return;
+				}
+				chunk.texCoords.insert(chunk.texCoords.end(), { t[0], t[1] });
+			}
+			else if (keyword == "vn") {
+				float n[3];
+				if (!parseFloatsObj(line, n, 3, 3)) {
+					chunk.corrupt = true;
+					return;
+				}
+				chunk.normals.insert(chunk.normals.end(), { n[0], n[1], n[2] });
 			}
-			else {
-				index++;
+			else if (keyword == "f") {
+				polygon.clear();
+				polygonRelative.clear();
+				for (auto token = nextTokenObj(line); !token.empty(); token = nextTokenObj(line)) {
+					std::array<int, 3> corner;
+					std::array<bool, 3> relative;
+					if (!parseFaceVertexObj(token, chunk, corner, relative)) {
+						chunk.corrupt = true;
+						return;
+					}
+					polygon.push_back(corner);
+					polygonRelative.push_back(relative);
+				}
+
+				if (polygon.size() < 3) {
+					chunk.corrupt = true;
+					return;
+				}
+
+				// Fan triangulation, exact for convex polygons
+				for (size_t i = 1; i + 1 < polygon.size(); ++i) {
+					for (size_t c : { size_t(0), i, i + 1 }) {
+						for (int component = 0; component < 3; ++component) {
+							if (polygonRelative[c][component]) chunk.relativeCorners.push_back(chunk.corners.size());
+							chunk.corners.push_back(polygon[c][component]);
+						}
+					}
+				}
 			}
 		}
+	}
 
-		if (index != next) subStrings.push_back(line.substr(next, size_t(index) - next));
-		return subStrings;
+	// Shared by all loads, its threads are started by the first file that is split into several chunks
+	ThreadPool& getLoaderPool() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	// Parses the file into chunks and stitches them together into one chunk with absolute indices
+	bool parseObj(const std::string& path, ObjChunk& model) {
+		MappedFile file(path);
+		if (!file.isOpen()) return false;
+
+		// Split the file at line ends into chunks
+		std::vector<std::string_view> parts;
+		std::string_view text = file.getView();
+		while (!text.empty()) {
+			size_t end = text.size();
+			if (end > OBJ_CHUNK_SIZE) {
+				end = text.find('\n', OBJ_CHUNK_SIZE);
+				end = end == std::string_view::npos ? text.size() : end + 1;
+			}
+			parts.push_back(text.substr(0, end));
+			text.remove_prefix(end);
+		}
+
+		if (parts.size() <= 1) {
+			if (!parts.empty()) parseObjChunk(parts[0], model);
+		}
+		else {
+			std::vector<ObjChunk> chunks(parts.size());
+
+			getLoaderPool().parallelFor(parts.size(), [&parts, &chunks](size_t i) {
+				parseObjChunk(parts[i], chunks[i]);
+			});
+
+			size_t sizes[4] = {};
+			for (auto& chunk : chunks) {
+				if (chunk.corrupt) return false;
+				sizes[0] += chunk.positions.size();
+				sizes[1] += chunk.texCoords.size();
+				sizes[2] += chunk.normals.size();
+				sizes[3] += chunk.corners.size();
+			}
+			model.positions.reserve(sizes[0]);
+			model.texCoords.reserve(sizes[1]);
+			model.normals.reserve(sizes[2]);
+			model.corners.reserve(sizes[3]);
+
+			for (auto& chunk : chunks) {
+				// Relative indices count from the data of the previous chunks
+				const int offsets[3] = { int(model.positions.size() / 3), int(model.texCoords.size() / 2), int(model.normals.size() / 3) };
+				for (size_t corner : chunk.relativeCorners) chunk.corners[corner] += offsets[corner % 3];
+
+				model.positions.insert(model.positions.end(), chunk.positions.begin(), chunk.positions.end());
+				model.texCoords.insert(model.texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+				model.normals.insert(model.normals.end(), chunk.normals.begin(), chunk.normals.end());
+				model.corners.insert(model.corners.end(), chunk.corners.begin(), chunk.corners.end());
+			}
+		}
+
+		if (model.corrupt) return false;
+
+		// Indices have to reference existing data
+		const int64_t counts[3] = { int64_t(model.positions.size() / 3), int64_t(model.texCoords.size() / 2), int64_t(model.normals.size() / 3) };
+		for (size_t i = 0; i < model.corners.size(); ++i) {
+			const int index = model.corners[i];
+			if (index == OBJ_MISSING_INDEX && i % 3 != 0) continue;
+			if (index < 0 || index >= counts[i % 3]) return false;
+		}
+
+		return true;
 	}
 
 	std::optional<Model3D> loadObj(const std::string& path) {
 		Model3D modelData = std::make_tuple<std::vector<float>, std::vector<int>>({}, {});
 		auto& [positions, indices] = modelData;
 
-		std::ifstream input;
-		input.open(path);
-		if (!input.is_open()) return {};
-
-		std::string line;
-		while (std::getline(input, line)) {
-			auto split = splitLineObj(line);
-			//std::cout << line << std::endl;
-			if (split.size() > 1) {
-				if (split[0].compare("v") == 0) {
-					if (split.size() != 4)
-						return {}; // File corrupt
-					positions.push_back(std::stof(split[1]));
-					positions.push_back(std::stof(split[2]));
-					positions.push_back(std::stof(split[3]));
+		ObjChunk model;
+		if (!parseObj(path, model)) return {}; // File corrupt
+
+		positions = std::move(model.positions);
+		indices.reserve(model.corners.size() / 3);
+		for (size_t i = 0; i < model.corners.size(); i += 3) indices.push_back(model.corners[i]);
+
+		normalize(positions);
+
+		return modelData;
+	}
+
+	std::optional<ObjModel> loadObjModel(const std::string& path) {
+		ObjChunk model;
+		if (!parseObj(path, model)) return {}; // File corrupt
+
+		ObjModel out;
+		const size_t cornerCount = model.corners.size() / 3;
+
+		bool hasTexCoords = false;
+		bool hasNormals = false;
+		for (size_t i = 0; i < model.corners.size(); i += 3) {
+			hasTexCoords |= model.corners[i + 1] != OBJ_MISSING_INDEX;
+			hasNormals |= model.corners[i + 2] != OBJ_MISSING_INDEX;
+		}
+
+		if (!hasTexCoords && !hasNormals) {
+			// Vertices are positions only, the positions of the file are already unique
+			out.positions = std::move(model.positions);
+			out.indices.reserve(cornerCount);
+			for (size_t i = 0; i < model.corners.size(); i += 3) out.indices.push_back(model.corners[i]);
+		}
+		else {
+			std::unordered_map<ObjVertex, int, ObjVertexHash> vertexIndices;
+			vertexIndices.reserve(cornerCount);
+			out.indices.reserve(cornerCount);
+
+			for (size_t i = 0; i < model.corners.size(); i += 3) {
+				const ObjVertex vertex = { model.corners[i], model.corners[i + 1], model.corners[i + 2] };
+
+				auto [entry, inserted] = vertexIndices.try_emplace(vertex, int(out.positions.size() / 3));
+				out.indices.push_back(entry->second);
+				if (!inserted) continue;
+
+				const float* p = &model.positions[size_t(vertex.position) * 3];
+				out.positions.insert(out.positions.end(), { p[0], p[1], p[2] });
+
+				if (hasTexCoords) {
+					if (vertex.texCoord == OBJ_MISSING_INDEX) {
+						out.texCoords.insert(out.texCoords.end(), { 0.0f, 0.0f });
+					}
+					else {
+						const float* t = &model.texCoords[size_t(vertex.texCoord) * 2];
+						out.texCoords.insert(out.texCoords.end(), { t[0], t[1] });
+					}
 				}
-				else if (split[0].compare("f") == 0) {
-					if (split.size() != 4)
-						return {}; // File corrupt
-					indices.push_back(std::stoi(split[1]) - 1);
-					indices.push_back(std::stoi(split[2]) - 1);
-					indices.push_back(std::stoi(split[3]) - 1);
+
+				if (hasNormals) {
+					if (vertex.normal == OBJ_MISSING_INDEX) {
+						out.normals.insert(out.normals.end(), { 0.0f, 0.0f, 0.0f });
+					}
+					else {
+						const float* n = &model.normals[size_t(vertex.normal) * 3];
+						out.normals.insert(out.normals.end(), { n[0], n[1], n[2] });
+					}
 				}
 			}
 		}
 
+		normalize(out.positions);
 
-		input.close();
-		normalize(positions);
+		return out;
+	}
 
-		//for (auto x : indices) std::cout << x << std::endl;
+	std::vector<float> generateNormals(const std::vector<float>& positions, const std::vector<int>& indices) {
+		std::vector<float> normals(positions.size(), 0.0f);
 
-		return modelData;
+		for (size_t tri = 0; tri + 2 < indices.size(); tri += 3) {
+			const float* v1 = &positions[size_t(indices[tri]) * 3];
+			const float* v2 = &positions[size_t(indices[tri + 1]) * 3];
+			const float* v3 = &positions[size_t(indices[tri + 2]) * 3];
+
+			const float d1[3] = { v2[0] - v1[0], v2[1] - v1[1], v2[2] - v1[2] };
+			const float d2[3] = { v3[0] - v1[0], v3[1] - v1[1], v3[2] - v1[2] };
+			const float n[3] = { d1[1] * d2[2] - d1[2] * d2[1], d1[2] * d2[0] - d1[0] * d2[2], d1[0] * d2[1] - d1[1] * d2[0] };
+
+			for (size_t corner = 0; corner < 3; ++corner) {
+				float* normal = &normals[size_t(indices[tri + corner]) * 3];
+				normal[0] += n[0];
+				normal[1] += n[1];
+				normal[2] += n[2];
+			}
+		}
+
+		for (size_t i = 0; i + 2 < normals.size(); i += 3) {
+			const float length = std::sqrt(normals[i] * normals[i] + normals[i + 1] * normals[i + 1] + normals[i + 2] * normals[i + 2]);
+			if (length == 0) continue;
+			normals[i] /= length;
+			normals[i + 1] /= length;
+			normals[i + 2] /= length;
+		}
+
+		return normals;
+	}
+
+	std::optional<Mesh> loadObjCached(const std::string& path) {
+		const std::string cachePath = path + ".srmesh";
+
+		std::error_code error;
+		const auto objTime = std::filesystem::last_write_time(path, error);
+		if (error) return {};
+
+		const auto cacheTime = std::filesystem::last_write_time(cachePath, error);
+		if (!error && cacheTime >= objTime) {
+			auto mesh = loadMesh(cachePath);
+			if (mesh.has_value()) return mesh; // Caches of an older format version are rebuilt
+		}
+
+		auto model = loadObjModel(path);
+		if (!model.has_value()) return {};
+		auto& indices = model->indices;
+
+		std::vector<MeshStream> streams;
+		if (!model->texCoords.empty()) streams.push_back({ model->texCoords, 2 });
+		if (!model->normals.empty()) streams.push_back({ model->normals, 3 });
+		optimizeMesh(indices, model->positions, streams);
+
+		// Clustering reorders the triangles, the vertices are renumbered in the new order of use
+		const auto clusters = buildMeshClusters(indices, model->positions);
+		auto remap = optimizeVertexFetch(indices, model->positions.size() / 3);
+		remapVertexAttribute(model->positions, 3, remap);
+		for (auto& stream : streams) remapVertexAttribute(stream.data, stream.components, remap);
+
+		if (model->normals.empty()) model->normals = generateNormals(model->positions, indices);
+
+		std::vector<MeshAttributeData> attributes = {
+			{ MeshAttribute::POSITION, 3, model->positions },
+			{ MeshAttribute::NORMAL, 3, model->normals }
+		};
+		if (!model->texCoords.empty()) attributes.push_back({ MeshAttribute::TEXCOORD, 2, model->texCoords });
+
+		if (saveMesh(cachePath, attributes, indices, clusters)) {
+			auto mesh = loadMesh(cachePath);
+			if (mesh.has_value()) return mesh;
+		}
+
+		// The cache can not be written, keep the mesh in memory
+		auto bytes = std::make_shared<const std::vector<char>>(serializeMesh(attributes, indices, clusters));
+		return parseMesh(bytes, std::string_view(bytes->data(), bytes->size()));
 	}
 
 }
@@ -0,0 +1,39 @@
+#include "SoftwareRenderer/PipelineStatistics.h"
+
+#include <chrono>
+
+namespace sr {
+
+	void PipelineStatistics::add(const PipelineStatistics& statistics) {
+		this->shadedVertices += statistics.shadedVertices;
+
+		this->culledClusters += statistics.culledClusters;
+		this->clusterCulledTriangles += statistics.clusterCulledTriangles;
+
+		this->inputTriangles += statistics.inputTriangles;
+		this->culledTriangles += statistics.culledTriangles;
+		this->clippedTriangles += statistics.clippedTriangles;
+		this->splitTriangles += statistics.splitTriangles;
+		this->occludedTriangles += statistics.occludedTriangles;
+		this->rasterizedTriangles += statistics.rasterizedTriangles;
+
+		this->shadedFragments += statistics.shadedFragments;
+		this->earlyRejectedFragments += statistics.earlyRejectedFragments;
+		this->depthRejectedFragments += statistics.depthRejectedFragments;
+		this->writtenFragments += statistics.writtenFragments;
+		this->resolveRetries += statistics.resolveRetries;
+
+		this->vertexTime += statistics.vertexTime;
+		this->geometryTime += statistics.geometryTime;
+		this->rasterizationTime += statistics.rasterizationTime;
+		this->resolveTime += statistics.resolveTime;
+		this->frameTime += statistics.frameTime;
+
+		this->frameBufferLockWaitTime += statistics.frameBufferLockWaitTime;
+	}
+
+	uint64_t PipelineStatistics::now() {
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+}
@@ -0,0 +1,9 @@
+#include "SoftwareRenderer/Rect.h"
+
+namespace sr {
+
+	bool Rect::isEmpty() const {
+		return this->xMin >= this->xMax || this->yMin >= this->yMax;
+	}
+
+}
@@ -1,11 +1,19 @@
 
 #include <SoftwareRenderer/RenderPipeline.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
+#include <tuple>
+
 namespace sr {
 
 	RenderPipeline::RenderPipeline() :
 		bufferManager(std::make_shared<BufferManager>())
-	{}
+	{
+		this->boundTextures.fill(-1);
+	}
 
 
 	int RenderPipeline::createBufferArray() {
@@ -18,7 +26,11 @@ namespace sr {
 	}
 
 	int RenderPipeline::createIndexBuffer(const std::vector<int>& data) {
-		this->indexBufferList.emplace_back(IntegerDataBuffer<3>(data));
+		return this->createIndexBuffer(IntegerDataBuffer<3>(data));
+	}
+
+	int RenderPipeline::createIndexBuffer(const IntegerDataBuffer<3>& buffer) {
+		this->indexBufferList.push_back(buffer);
 		return this->indexBufferList.size() - 1;
 	}
 
@@ -28,15 +40,59 @@ namespace sr {
 	}
 
 
+	int RenderPipeline::createClusterBuffer(std::vector<MeshCluster> clusters) {
+		this->clusterBufferList.push_back(std::move(clusters));
+		return this->clusterBufferList.size() - 1;
+	}
+
+	void RenderPipeline::bindClusterBuffer(int bufferID) {
+		if (this->currentBufferArray == -1) return;
+		this->bufferArrays[this->currentBufferArray].setClusterBuffer(bufferID);
+	}
+
+	int RenderPipeline::createLodBuffer(MeshLodChain chain) {
+		this->lodBufferList.push_back(std::move(chain));
+		return this->lodBufferList.size() - 1;
+	}
+
+	void RenderPipeline::bindLodBuffer(int bufferID) {
+		if (this->currentBufferArray == -1) return;
+		this->bufferArrays[this->currentBufferArray].setLodBuffer(bufferID);
+	}
+
+
+	int RenderPipeline::createTexture(Texture texture) {
+		this->textureList.push_back(std::make_unique<Texture>(std::move(texture)));
+		return this->textureList.size() - 1;
+	}
+
+	void RenderPipeline::bindTexture(int unit, int textureID) {
+		if (unit < 0 || unit >= TEXTURE_MAX_UNITS) return;
+		this->boundTextures[unit] = textureID;
+		this->renderer.bindTextures(this->getTextureUnits(this->boundTextures));
+	}
+
+	TextureUnits RenderPipeline::getTextureUnits(const std::array<int, TEXTURE_MAX_UNITS>& textureIDs) const {
+		TextureUnits units = {};
+		for (size_t unit = 0; unit < units.size(); ++unit) {
+			const int id = textureIDs[unit];
+			if (id >= 0 && size_t(id) < this->textureList.size()) units[unit] = this->textureList[id].get();
+		}
+		return units;
+	}
+
+
 	void RenderPipeline::bindVertexShader(std::weak_ptr<VertexShader> vs) {
 		this->vertexShader = vs;
 	}
 
 	void RenderPipeline::bindFragmentShader(std::weak_ptr<FragmentShader> fs) {
+		this->fragmentShader = fs;
 		this->renderer.bindFragmentShader(fs);
 	}
 
 	void RenderPipeline::bindGeometryShader(std::weak_ptr<GeometryShader> gs) {
+		this->geometryShader = gs;
 		this->renderer.bindGeometryShader(gs);
 	}
 
@@ -45,6 +101,15 @@ namespace sr {
 		this->bufferArrays[this->currentBufferArray].storeInAttributeList(index, bufferID);
 	}
 
+	void RenderPipeline::storeInstanceBufferInBufferArray(int index, int bufferID) {
+		if (this->currentBufferArray == -1) return;
+		this->bufferArrays[this->currentBufferArray].storeInInstanceAttributeList(index, bufferID);
+	}
+
+	void RenderPipeline::setRenderSurface(std::weak_ptr<RenderSurface> surface) {
+		this->renderer.setRenderSurface(surface);
+	}
+
 	void RenderPipeline::setRenderSurface(std::weak_ptr<pw::PixelWindow> window) {
 		this->renderer.setRenderSurface(window);
 	}
@@ -57,6 +122,76 @@ namespace sr {
 		this->renderer.disableBackfaceCulling();
 	}
 
+	void RenderPipeline::setRasterizationMode(RasterizationMode mode) {
+		this->renderer.setRasterizationMode(mode);
+	}
+
+	void RenderPipeline::setRasterizer(RasterizerType type) {
+		this->renderer.setRasterizer(type);
+	}
+
+	void RenderPipeline::setShadingMode(ShadingMode mode) {
+		this->renderer.setShadingMode(mode);
+	}
+
+	void RenderPipeline::setDepthMode(DepthMode mode) {
+		this->depthMode = mode;
+		this->renderer.setDepthMode(mode);
+	}
+
+	void RenderPipeline::enableDepthPrepass() {
+		this->depthPrepassEnabled = true;
+	}
+
+	void RenderPipeline::disableDepthPrepass() {
+		this->depthPrepassEnabled = false;
+	}
+
+	void RenderPipeline::enableHierarchicalZ() {
+		this->renderer.enableHierarchicalZ();
+	}
+
+	void RenderPipeline::disableHierarchicalZ() {
+		this->renderer.disableHierarchicalZ();
+	}
+
+	void RenderPipeline::setThreadCount(size_t threadCount) {
+		this->renderer.setThreadCount(threadCount);
+	}
+
+	size_t RenderPipeline::getThreadCount() const {
+		return this->renderer.getThreadCount();
+	}
+
+	void RenderPipeline::enableStatistics() {
+		this->renderer.enableStatistics();
+	}
+
+	void RenderPipeline::disableStatistics() {
+		this->renderer.disableStatistics();
+	}
+
+	const PipelineStatistics& RenderPipeline::getStatistics() const {
+		return this->renderer.getStatistics();
+	}
+
+	void RenderPipeline::enableClusterCulling() {
+		this->clusterCullingEnabled = true;
+	}
+
+	void RenderPipeline::disableClusterCulling() {
+		this->clusterCullingEnabled = false;
+	}
+
+	void RenderPipeline::setCullingTransform(const lm::Matrix4x4f& objectToClip) {
+		this->cullingTransform = objectToClip;
+		this->cullingTransformValid = true;
+	}
+
+	void RenderPipeline::setLodPixelError(float pixelError) {
+		this->lodPixelError = pixelError;
+	}
+
 	void RenderPipeline::beginFrame() {
 		this->renderer.beginFrame();
 	}
@@ -65,33 +200,263 @@ namespace sr {
 		this->renderer.endFrame();
 	}
 
+	IntegerDataBuffer<3> RenderPipeline::selectIndices(const BufferArray& bufferArray, bool cullingTransformValid, const lm::Matrix4x4f& cullingTransform, size_t vertexCount, std::vector<uint8_t>& visibleVertices, bool& partial) {
+		const auto& indices = this->indexBufferList[bufferArray.getIndexBuffer()];
+		partial = false;
+
+		// Level of detail, simplified levels only shade the vertices they reference
+		if (cullingTransformValid && bufferArray.hasLodBuffer()) {
+			const auto& chain = this->lodBufferList[bufferArray.getLodBuffer()];
+			const size_t level = this->renderer.selectLod(chain, cullingTransform, this->lodPixelError);
+			if (level > 0) {
+				const auto& lod = chain.levels[level];
+				visibleVertices.assign(vertexCount, 0);
+				for (int index : lod.indices) visibleVertices[index] = 1;
+
+				partial = true;
+				return IntegerDataBuffer<3>(nullptr, lod.indices.data(), lod.indices.size());
+			}
+		}
+
+		// Cluster culling, only the vertices of visible clusters are shaded
+		if (this->clusterCullingEnabled && cullingTransformValid && bufferArray.hasClusterBuffer()) {
+			this->visibleIndices.clear();
+			visibleVertices.assign(vertexCount, 0);
+			this->renderer.cullClusters(this->clusterBufferList[bufferArray.getClusterBuffer()], indices, cullingTransform, this->visibleIndices, visibleVertices);
+
+			partial = true;
+			return IntegerDataBuffer<3>(nullptr, this->visibleIndices.data(), this->visibleIndices.size());
+		}
+
+		return indices;
+	}
+
+	void RenderPipeline::shadeVertices(const std::vector<VertexRange>& ranges) {
+		size_t totalFloats = 0;
+		for (auto& range : ranges) totalFloats = std::max(totalFloats, range.offset + range.vertexCount * range.instanceCount * range.shader->varyingLayout.getStride());
+		this->transformedVertices.resize(totalFloats + VERTEX_MAX_VARYINGS);
+
+		// Batches never span two ranges
+		std::vector<size_t> batchOffsets(ranges.size() + 1, 0);
+		for (size_t r = 0; r < ranges.size(); ++r) {
+			batchOffsets[r + 1] = batchOffsets[r] + (ranges[r].vertexCount * ranges[r].instanceCount + VERTEX_BATCH_SIZE - 1) / VERTEX_BATCH_SIZE;
+		}
+
+		SR_STATISTICS(const uint64_t vertexBegin = PipelineStatistics::now());
+		SR_STATISTICS(std::atomic<uint64_t> shadedVertices = 0);
+
+		// for every vertex of every instance do...
+		// One job per thread claims batches, so a shader instance is cloned once per thread and range, not per batch
+		const size_t batchCount = batchOffsets.back();
+		std::atomic<size_t> nextBatch = 0;
+		this->renderer.dispatch(std::min(batchCount, this->renderer.getThreadCount()), [&](size_t) {
+			std::unique_ptr<VertexShader> shader;
+			size_t shaderRange = ranges.size();
+			SR_STATISTICS(uint64_t workerVertices = 0);
+
+			for (size_t batch; (batch = nextBatch.fetch_add(1, std::memory_order_relaxed)) < batchCount;) {
+				const size_t r = size_t(std::upper_bound(batchOffsets.begin(), batchOffsets.end(), batch) - batchOffsets.begin()) - 1;
+				const auto& range = ranges[r];
+				if (r != shaderRange) {
+					shader = range.shader->clone();
+					shaderRange = r;
+				}
+				const size_t stride = shader->varyingLayout.getStride();
+
+				const size_t batchBegin = (batch - batchOffsets[r]) * VERTEX_BATCH_SIZE;
+				const size_t batchEnd = std::min(batchBegin + VERTEX_BATCH_SIZE, range.vertexCount * range.instanceCount);
+
+				size_t vertex = batchBegin % range.vertexCount;
+				shader->instanceID = batchBegin / range.vertexCount;
+
+				for (size_t i = batchBegin; i < batchEnd; ++i) {
+					if (range.visibleVertices == nullptr || range.visibleVertices[i]) {
+						shader->vertexID = vertex;
+						shader->main();
+						shader->storeOutput(this->transformedVertices.data() + range.offset + i * stride);
+						shader->reset();
+						SR_STATISTICS(workerVertices++);
+					}
+
+					if (++vertex == range.vertexCount) {
+						vertex = 0;
+						shader->instanceID++;
+					}
+				}
+			}
+
+			SR_STATISTICS(shadedVertices += workerVertices);
+		});
+
+#ifdef SR_ENABLE_STATISTICS
+		PipelineStatistics vertexStatistics;
+		vertexStatistics.shadedVertices = shadedVertices;
+		vertexStatistics.vertexTime = PipelineStatistics::now() - vertexBegin;
+		this->renderer.addStatistics(vertexStatistics);
+#endif
+	}
+
+	void RenderPipeline::renderIndexed(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceCount) {
+		if (mode == RenderMode::TRIANGLE && this->depthPrepassEnabled && this->depthMode == DepthMode::LESS) {
+			this->renderer.setDepthMode(DepthMode::DEPTH_ONLY);
+			this->renderer.renderIndexed(mode, vertices, indices, instanceCount);
+			this->renderer.setDepthMode(DepthMode::EQUAL);
+			this->renderer.renderIndexed(mode, vertices, indices, instanceCount);
+			this->renderer.setDepthMode(this->depthMode);
+			return;
+		}
+
+		this->renderer.renderIndexed(mode, vertices, indices, instanceCount);
+	}
+
 	void RenderPipeline::draw(RenderMode mode, int vertexCount) {
 		// Test if VertexShader is present
 		auto vs = this->vertexShader.lock();
-		if (vs == nullptr && currentBufferArray != -1) return;
+		if (vs == nullptr || this->currentBufferArray == -1 || vertexCount <= 0) return;
 
 		// setze buffer...
-		vs->bufferArray = this->bufferArrays[this->currentBufferArray];
-		vs->bufferManager = this->bufferManager;
-		
-		std::vector<Vertex> transformedVertices;
-		transformedVertices.reserve(vertexCount);
-
-		// for every vertex do...
-		for (size_t i = 0; i < vertexCount; ++i) {
-			vs->vertexID = i;
-			vs->main();
-			transformedVertices.push_back({ vs->out_position, vs->out_color, vs->out_normal });
-			vs->reset();
+		const auto& bufferArray = this->bufferArrays[this->currentBufferArray];
+		if (!bufferArray.hasIndexBuffer()) return;
+
+		vs->bufferArray = bufferArray;
+		vs->bufferManager = this->bufferManager.get();
+
+		bool partial = false;
+		auto indices = this->selectIndices(bufferArray, this->cullingTransformValid, this->cullingTransform, size_t(vertexCount), this->visibleVertices, partial);
+
+		this->shadeVertices({ { vs.get(), 0, size_t(vertexCount), 1, partial ? this->visibleVertices.data() : nullptr } });
+		vs->bufferManager = nullptr;
+
+		this->renderIndexed(mode, { this->transformedVertices.data(), vs->varyingLayout, size_t(vertexCount) }, indices);
+	}
+
+	void RenderPipeline::drawInstanced(RenderMode mode, int vertexCount, int instanceCount) {
+		auto vs = this->vertexShader.lock();
+		if (vs == nullptr || this->currentBufferArray == -1 || vertexCount <= 0 || instanceCount <= 0) return;
+
+		const auto& bufferArray = this->bufferArrays[this->currentBufferArray];
+		if (!bufferArray.hasIndexBuffer()) return;
+
+		vs->bufferArray = bufferArray;
+		vs->bufferManager = this->bufferManager.get();
+
+		this->shadeVertices({ { vs.get(), 0, size_t(vertexCount), size_t(instanceCount), nullptr } });
+		vs->bufferManager = nullptr;
+
+		this->renderIndexed(mode, { this->transformedVertices.data(), vs->varyingLayout, size_t(vertexCount) * size_t(instanceCount) }, this->indexBufferList[bufferArray.getIndexBuffer()], size_t(instanceCount));
+	}
+
+	void RenderPipeline::submit(const CommandBuffer& commandBuffer) {
+		this->submit(std::vector<const CommandBuffer*>{ &commandBuffer });
+	}
+
+	void RenderPipeline::submit(const std::vector<const CommandBuffer*>& commandBuffers) {
+		std::vector<const CommandBuffer::DrawCommand*> commands;
+		for (auto commandBuffer : commandBuffers) {
+			for (auto& command : commandBuffer->commands) {
+				if (command.bufferArray >= 0 && size_t(command.bufferArray) < this->bufferArrays.size() && this->bufferArrays[command.bufferArray].hasIndexBuffer()) commands.push_back(&command);
+			}
 		}
 
-		if (this->bufferArrays[this->currentBufferArray].hasIndexBuffer()) {
-			this->renderer.renderIndexed(mode, transformedVertices, this->indexBufferList[this->bufferArrays[this->currentBufferArray].getIndexBuffer()]);
+		// Draws with the same fragment stage become neighbors, their order is kept otherwise.
+		// Stages are ordered by their first draw, not by their addresses, so every run renders in the same order.
+		if (this->commandSortingEnabled) {
+			std::map<std::tuple<const FragmentShader*, std::array<int, TEXTURE_MAX_UNITS>, const GeometryShader*, RenderMode>, size_t> firstCommands;
+			std::vector<std::pair<size_t, const CommandBuffer::DrawCommand*>> keyedCommands;
+			keyedCommands.reserve(commands.size());
+			for (auto command : commands) {
+				auto key = std::make_tuple(command->fragmentShader.get(), command->textures, command->geometryShader.get(), command->mode);
+				keyedCommands.emplace_back(firstCommands.try_emplace(key, keyedCommands.size()).first->second, command);
+			}
+
+			std::stable_sort(keyedCommands.begin(), keyedCommands.end(), [](const auto& a, const auto& b) {
+				return a.first < b.first;
+			});
+			for (size_t i = 0; i < commands.size(); ++i) commands[i] = keyedCommands[i].second;
+		}
+
+		if (this->commandVisibleVertices.size() < commands.size()) this->commandVisibleVertices.resize(commands.size());
+		this->commandIndices.clear();
+
+		std::vector<VertexRange> ranges;
+		std::vector<std::array<size_t, 5>> groups; // first command, first float and count of its vertices, begin and end of the merged indices
+
+		// All draws are shaded in one vertex pass
+		size_t floatOffset = 0;
+		size_t groupEnd = 0;
+		for (size_t groupBegin = 0; groupBegin < commands.size(); groupBegin = groupEnd) {
+			const auto& first = *commands[groupBegin];
+
+			// Consecutive draws with the same fragment stage and varyings are merged into one draw
+			const auto& layout = first.vertexShader->varyingLayout;
+			groupEnd = groupBegin + 1;
+			while (groupEnd < commands.size() && commands[groupEnd]->fragmentShader == first.fragmentShader && commands[groupEnd]->textures == first.textures
+				&& commands[groupEnd]->geometryShader == first.geometryShader && commands[groupEnd]->mode == first.mode && commands[groupEnd]->vertexShader->varyingLayout == layout) groupEnd++;
+
+			const size_t groupFloatOffset = floatOffset;
+			const size_t indexBegin = this->commandIndices.size();
+			size_t vertexOffset = 0;
+			for (size_t c = groupBegin; c < groupEnd; ++c) {
+				const auto& command = *commands[c];
+				const auto& bufferArray = this->bufferArrays[command.bufferArray];
+				const size_t vertexCount = size_t(command.vertexCount);
+				const size_t instanceCount = size_t(command.instanceCount);
+
+				command.vertexShader->bufferArray = bufferArray;
+				command.vertexShader->bufferManager = this->bufferManager.get();
+
+				// Instanced draws skip culling and level of detail like drawInstanced
+				auto& visibleVertices = this->commandVisibleVertices[c];
+				bool partial = false;
+				auto indices = instanceCount == 1 ? this->selectIndices(bufferArray, command.cullingTransformValid, command.cullingTransform, vertexCount, visibleVertices, partial)
+					: this->indexBufferList[bufferArray.getIndexBuffer()];
+
+				for (size_t instance = 0; instance < instanceCount; ++instance) {
+					const int offset = int(vertexOffset + instance * vertexCount);
+					for (size_t i = 0; i < indices.getAttributeCount() * 3; ++i) this->commandIndices.push_back(indices.getData()[i] + offset);
+				}
+
+				ranges.push_back({ command.vertexShader.get(), floatOffset, vertexCount, instanceCount, partial ? visibleVertices.data() : nullptr });
+				vertexOffset += vertexCount * instanceCount;
+				floatOffset += vertexCount * instanceCount * layout.getStride();
+			}
+
+			groups.push_back({ groupBegin, groupFloatOffset, vertexOffset, indexBegin, this->commandIndices.size() });
 		}
-		else {
-			//this->renderer.render(mode, transformedVertices);
+
+		this->shadeVertices(ranges);
+		for (auto& range : ranges) range.shader->bufferManager = nullptr;
+
+		// The depth pre-pass renders the triangles of every draw before the first one is shaded
+		const bool prepass = this->depthPrepassEnabled && this->depthMode == DepthMode::LESS;
+		for (int pass = prepass ? 0 : 1; pass < 2; ++pass) {
+			for (auto [first, groupFloatOffset, groupVertexCount, indexBegin, indexEnd] : groups) {
+				const auto& command = *commands[first];
+				const VertexStream vertices = { this->transformedVertices.data() + groupFloatOffset, command.vertexShader->varyingLayout, groupVertexCount };
+				const bool triangles = command.mode == RenderMode::TRIANGLE;
+				if (pass == 0 && !triangles) continue;
+
+				if (prepass) this->renderer.setDepthMode(!triangles ? this->depthMode : pass == 0 ? DepthMode::DEPTH_ONLY : DepthMode::EQUAL);
+				this->renderer.bindFragmentShader(command.fragmentShader);
+				this->renderer.bindGeometryShader(command.geometryShader);
+				this->renderer.bindTextures(this->getTextureUnits(command.textures));
+				this->renderer.renderIndexed(command.mode, vertices, IntegerDataBuffer<3>(nullptr, this->commandIndices.data() + indexBegin, indexEnd - indexBegin));
+			}
 		}
+		this->renderer.setDepthMode(this->depthMode);
+
+		// Restore the shaders and textures bound to the pipeline
+		this->renderer.bindFragmentShader(this->fragmentShader);
+		this->renderer.bindGeometryShader(this->geometryShader);
+		this->renderer.bindTextures(this->getTextureUnits(this->boundTextures));
+	}
+
+	void RenderPipeline::enableCommandSorting() {
+		this->commandSortingEnabled = true;
+	}
 
+	void RenderPipeline::disableCommandSorting() {
+		this->commandSortingEnabled = false;
 	}
 
 }
@@ -0,0 +1,56 @@
+#include "SoftwareRenderer/RenderSurface.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace sr {
+
+	void RenderSurface::beginFrame() {
+	}
+
+	void RenderSurface::endFrame() {
+	}
+
+	void RenderSurface::clear(uint32_t color) {
+		std::fill_n(this->pixels, size_t(this->width) * this->height, color);
+	}
+
+	uint32_t* RenderSurface::getPixels() {
+		return this->pixels;
+	}
+
+	const uint32_t* RenderSurface::getPixels() const {
+		return this->pixels;
+	}
+
+	uint32_t* RenderSurface::getRow(int y) {
+		assert(!(y < 0 || y >= this->height));
+		return this->pixels + size_t(y) * this->width;
+	}
+
+	const uint32_t* RenderSurface::getRow(int y) const {
+		assert(!(y < 0 || y >= this->height));
+		return this->pixels + size_t(y) * this->width;
+	}
+
+	int RenderSurface::getWidth() const {
+		return this->width;
+	}
+
+	int RenderSurface::getHeight() const {
+		return this->height;
+	}
+
+	PixelFormat RenderSurface::getPixelFormat() const {
+		return this->pixelFormat;
+	}
+
+	void RenderSurface::setDepthFormat(DepthFormat format) {
+		this->depthFormat = format;
+	}
+
+	DepthFormat RenderSurface::getDepthFormat() const {
+		return this->depthFormat;
+	}
+
+}
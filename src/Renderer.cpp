@@ -2,6 +2,9 @@
 #include "SoftwareRenderer/Renderer.h"
 
 #include <cmath>
+#include <algorithm>
+#include <limits>
+#include <bit>
 
 #include <thread>
 #include <chrono>
@@ -24,6 +27,12 @@ namespace sr {
 		this->buffer[index++] = { x, y, color, depth };
 	}
 
+	template<size_t size>
+	void Renderer::RenderBatchContext<size>::addDeferredPixel(int x, int y, float depth, const Vertex& fragment) {
+		this->deferredFragments[index] = fragment;
+		this->buffer[index++] = { x, y, 0, depth };
+	}
+
 	template<size_t size>
 	void Renderer::RenderBatchContext<size>::reset() {
 		this->index = 0;
@@ -39,202 +48,533 @@ namespace sr {
 		return this->index;
 	}
 
+	// Resolve buffer
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "Pixels are resolved with 64 bit compare-and-swaps");
+
+	// Keys compare like the depths, -0 is turned into 0 first
+	static uint32_t getDepthKey(float depth) {
+		const uint32_t bits = std::bit_cast<uint32_t>(depth + 0.0f);
+		return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+	}
+
+	static float getKeyDepth(uint32_t key) {
+		return std::bit_cast<float>((key & 0x80000000u) ? key & 0x7FFFFFFFu : ~key);
+	}
+
+	// States of a tile of the resolve buffer
+	constexpr uint8_t RESOLVE_TILE_EMPTY = 0;
+	constexpr uint8_t RESOLVE_TILE_LOADING = 1;
+	constexpr uint8_t RESOLVE_TILE_LOADED = 2; // holds the depth and colors of the tile, stored back after the draw
+
 	// Renderer
 
-	void Renderer::renderPixel(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, int color, float depth) {
+	bool Renderer::testDepth(int x, int y, float depth) const {
+		if (this->depthMode == DepthMode::EQUAL) return this->zBuffer.get(x, y) == depth;
+		return this->zBuffer.get(x, y) > depth;
+	}
+
+	void Renderer::renderPixel(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, int color, float depth) {
+		if (batchContext.directWrite) {
+			// The pixel belongs to this context only
+			if (this->testDepth(x, y, depth)) {
+				if (this->depthMode != DepthMode::DEPTH_ONLY) {
+					fb->setPixel(x, y, color);
+					if (!this->deferredShaders.empty()) this->gBuffer.clear(x, y); // the color is final
+				}
+				if (this->depthMode != DepthMode::EQUAL) zBuffer.set(x, y, depth);
+				SR_STATISTICS(batchContext.statistics.writtenFragments++);
+			}
+			else {
+				SR_STATISTICS(batchContext.statistics.depthRejectedFragments++);
+			}
+			return;
+		}
+
 		batchContext.addPixel(x, y, color, depth);
-		if (batchContext.isFull()) {
-			// Write to framebuffer
-			auto& pixels = batchContext.getBuffer();
-			{
-				std::lock_guard<std::mutex> lock(this->frameBufferLock);
-				for (auto& p : pixels) {
-					if (zBuffer.get(p.x, p.y) > p.depth) {
+		if (batchContext.isFull()) this->flushPixels(fb, batchContext);
+	}
+
+	void Renderer::flushPixels(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext) {
+		if (this->atomicResolve) {
+			this->resolvePixels(fb, batchContext);
+			return;
+		}
+
+		// Write to framebuffer
+		{
+			SR_STATISTICS(const uint64_t waitBegin = PipelineStatistics::now());
+			std::lock_guard<std::mutex> lock(this->frameBufferLock);
+			SR_STATISTICS(batchContext.statistics.frameBufferLockWaitTime += PipelineStatistics::now() - waitBegin);
+
+			auto& buffer = batchContext.getBuffer();
+			Rect written = { std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), 0, 0 };
+			for (int i = 0; i < batchContext.getIndex(); ++i) {
+				auto& p = buffer[i];
+				if (this->testDepth(p.x, p.y, p.depth)) {
+					if (batchContext.deferredShader >= 0) {
+						this->gBuffer.set(p.x, p.y, batchContext.deferredShader, batchContext.deferredFragments[i]);
+					}
+					else if (this->depthMode != DepthMode::DEPTH_ONLY) {
 						fb->setPixel(p.x, p.y, p.color);
+						if (!this->deferredShaders.empty()) this->gBuffer.clear(p.x, p.y);
+					}
+
+					if (this->depthMode != DepthMode::EQUAL) {
 						zBuffer.set(p.x, p.y, p.depth);
+						written = { std::min(written.xMin, p.x), std::min(written.yMin, p.y), std::max(written.xMax, p.x + 1), std::max(written.yMax, p.y + 1) };
 					}
+					SR_STATISTICS(batchContext.statistics.writtenFragments++);
+				}
+				else {
+					SR_STATISTICS(batchContext.statistics.depthRejectedFragments++);
 				}
 			}
-			batchContext.reset();
+			if (this->hierarchicalZEnabled) this->zBuffer.refresh(written);
 		}
+		batchContext.reset();
 	}
 
-	// Wireframe rendering
-	void Renderer::renderLine(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int xBegin, int yBegin, int xEnd, int yEnd, int color) {
-		int width = fb->getWidth();
-		int height = fb->getHeight();
-		
-		int dx = abs(xEnd - xBegin);
-		int sx = xBegin < xEnd ? 1 : -1;
-		int dy = -std::abs(yEnd - yBegin);
-		int sy = yBegin < yEnd ? 1 : -1;
-		int err = dx + dy;
-		int e2; /* error value e_xy */
+	void Renderer::resolvePixels(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext) {
+		const size_t width = size_t(fb->getWidth());
+		const bool equal = this->depthMode == DepthMode::EQUAL;
+		const bool writeColor = this->depthMode != DepthMode::DEPTH_ONLY;
 
-		int x = xBegin;
-		int y = yBegin;
+		auto& buffer = batchContext.getBuffer();
+		int loadedTile = -1;
+		for (int i = 0; i < batchContext.getIndex(); ++i) {
+			auto& p = buffer[i];
 
-		while (1) {
-			if (x < width && x >= 0 && y < height && y >= 0) {
-				this->renderPixel(fb, batchContext, x, y, color, 0);
-				//fb->setPixel(x, y, color);
+			// Consecutive fragments mostly share a tile
+			const int tile = p.y / TILE_SIZE * this->resolveTilesX + p.x / TILE_SIZE;
+			if (tile != loadedTile) {
+				this->loadResolveTile(fb, tile);
+				loadedTile = tile;
 			}
-			if (x == xEnd && y == yEnd) break;
-			e2 = 2 * err;
-			if (e2 > dy) {
-				err += dy;
-				x += sx;
+
+			auto& pixel = this->resolveBuffer[size_t(p.y) * width + p.x];
+			const uint64_t key = getDepthKey(p.depth);
+
+			// Retried until the fragment is written or the pixel holds a nearer one
+			bool written = false;
+			uint64_t current = pixel.load(std::memory_order_relaxed);
+			while (equal ? (current >> 32) == key : (current >> 32) > key) {
+				const uint64_t color = writeColor ? uint32_t(p.color) : current & 0xFFFFFFFF;
+				if (pixel.compare_exchange_weak(current, key << 32 | color, std::memory_order_relaxed)) {
+					written = true;
+					break;
+				}
+				SR_STATISTICS(batchContext.statistics.resolveRetries++);
 			}
-			if (e2 < dx) {
-				err += dx;
-				y += sy;
+
+			if (written) {
+				SR_STATISTICS(batchContext.statistics.writtenFragments++);
+			}
+			else {
+				SR_STATISTICS(batchContext.statistics.depthRejectedFragments++);
 			}
 		}
+		batchContext.reset();
 	}
 
-	void Renderer::renderTriangleWireframe(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3) {
-		const int width = fb->getWidth();
-		const int height = fb->getHeight();
+	void Renderer::loadResolveTile(const std::shared_ptr<RenderSurface>& fb, int tile) {
+		auto& state = this->resolveTiles[tile];
+		if (state.load(std::memory_order_acquire) == RESOLVE_TILE_LOADED) return;
+
+		// The first thread loads the tile, others wait for it once
+		uint8_t expected = RESOLVE_TILE_EMPTY;
+		if (!state.compare_exchange_strong(expected, RESOLVE_TILE_LOADING, std::memory_order_acquire)) {
+			while (state.load(std::memory_order_acquire) != RESOLVE_TILE_LOADED) std::this_thread::yield();
+			return;
+		}
 
-		const auto pos1 = this->transformViewport(v1, width, height).getPosition();
-		const auto pos2 = this->transformViewport(v2, width, height).getPosition();
-		const auto pos3 = this->transformViewport(v3, width, height).getPosition();
+		const Rect rect = this->getResolveTileRect(fb, tile);
+		for (int y = rect.yMin; y < rect.yMax; ++y) {
+			const uint32_t* colors = fb->getRow(y);
+			auto* pixels = &this->resolveBuffer[size_t(y) * fb->getWidth()];
+			for (int x = rect.xMin; x < rect.xMax; ++x) pixels[x].store(uint64_t(getDepthKey(this->zBuffer.get(x, y))) << 32 | colors[x], std::memory_order_relaxed);
+		}
 
-		this->renderLine(fb, batchContext, pos1.getX(), pos1.getY(), pos2.getX(), pos2.getY(), 0xFFFFFFFF);
-		this->renderLine(fb, batchContext, pos2.getX(), pos2.getY(), pos3.getX(), pos3.getY(), 0xFFFFFFFF);
-		this->renderLine(fb, batchContext, pos3.getX(), pos3.getY(), pos1.getX(), pos1.getY(), 0xFFFFFFFF);
+		state.store(RESOLVE_TILE_LOADED, std::memory_order_release);
 	}
 
-	void Renderer::renderIndexedTriangleWireframeBatch(const std::vector<Vertex>& vertices, const IntegerDataBuffer<3>& indices, size_t batchBegin, size_t batchSize) {
-		auto fb = this->frameBuffer.lock();
-		if (fb == nullptr) return;
+	void Renderer::storeResolveTiles(const std::shared_ptr<RenderSurface>& fb) {
+		std::vector<int> tiles;
+		for (int tile = 0; tile < this->resolveTileCount; ++tile) {
+			if (this->resolveTiles[tile].load(std::memory_order_relaxed) == RESOLVE_TILE_LOADED) tiles.push_back(tile);
+		}
 
-		RenderBatchContext<BUFFER_SIZE> renderBatchContext;
+		// A resolve tile covers whole coarse depth tiles, the jobs refresh disjoint parts of the depth hierarchy
+		static_assert(TILE_SIZE % ZBUFFER_COARSE_TILE_SIZE == 0);
+		this->dispatch(tiles.size(), [this, &fb, &tiles](size_t i) {
+			const Rect rect = this->getResolveTileRect(fb, tiles[i]);
+			for (int y = rect.yMin; y < rect.yMax; ++y) {
+				uint32_t* colors = fb->getRow(y);
+				const auto* pixels = &this->resolveBuffer[size_t(y) * fb->getWidth()];
+				for (int x = rect.xMin; x < rect.xMax; ++x) {
+					const uint64_t pixel = pixels[x].load(std::memory_order_relaxed);
+					colors[x] = uint32_t(pixel);
+					this->zBuffer.set(x, y, getKeyDepth(uint32_t(pixel >> 32)));
+				}
+			}
 
-		for (size_t i = batchBegin; i < batchBegin + batchSize; ++i) {
-			auto triangleIndices = indices.getVertexAttribute(i);
+			if (this->hierarchicalZEnabled) this->zBuffer.refresh(rect);
+			this->resolveTiles[tiles[i]].store(RESOLVE_TILE_EMPTY, std::memory_order_relaxed);
+		});
+	}
 
-			const auto& v1 = vertices[triangleIndices[0]];
-			const auto& v2 = vertices[triangleIndices[1]];
-			const auto& v3 = vertices[triangleIndices[2]];
+	Rect Renderer::getResolveTileRect(const std::shared_ptr<RenderSurface>& fb, int tile) const {
+		const int x = tile % this->resolveTilesX * TILE_SIZE;
+		const int y = tile / this->resolveTilesX * TILE_SIZE;
+		return { x, y, std::min(x + TILE_SIZE, fb->getWidth()), std::min(y + TILE_SIZE, fb->getHeight()) };
+	}
 
-			auto surfaceNormal = this->getSurfaceNormal(v1, v2, v3);
+	bool Renderer::initBatchContext(RenderMode mode, RenderBatchContext<BUFFER_SIZE>& batchContext, bool needsFragmentShader) {
+		if (mode != RenderMode::TRIANGLE) return true; // Wireframes are not shaded
 
-			// Backface culling
-			auto pos = lm::Vector3f(v2.getPosition().getXY(), v2.getPosition().getW());
-			auto dp = surfaceNormal * -pos;
-			if (dp > 0 && backfaceCullingEnabled) continue;
+		auto geometryShader = this->geometryShader.lock();
+		auto fragmentShader = this->fragmentShader.lock();
 
-			// Clipping
-			auto clipped = this->clipTriangle(v1, v2, v3);
-			if (clipped.first == 0) continue;
-			const auto& verts = clipped.second;
+		// Geometry shaders still run for depth only rendering, they can move the vertices
+		if (this->depthMode == DepthMode::DEPTH_ONLY) {
+			if (geometryShader != nullptr) batchContext.gs = geometryShader->clone();
+			return true;
+		}
+
+		if (fragmentShader == nullptr) return false; // Fragmentshader is missing
 
-			this->renderTriangleWireframe(fb, renderBatchContext, verts[0], verts[1], verts[2]);
-			if (clipped.first == 2) this->renderTriangleWireframe(fb, renderBatchContext, verts[0], verts[2], verts[3]);
+		if (geometryShader != nullptr) batchContext.gs = geometryShader->clone();
+		if (needsFragmentShader && this->currentDeferredShader >= 0) {
+			batchContext.deferredShader = this->currentDeferredShader;
+			if (!batchContext.directWrite) batchContext.deferredFragments.resize(BUFFER_SIZE);
 		}
+		else if (needsFragmentShader) {
+			batchContext.fs = fragmentShader->clone();
+			batchContext.fs->textures = this->textures;
+		}
+		return true;
+	}
 
-		// Render remaining pixels
-		auto& buffer = renderBatchContext.getBuffer();
-		for (int i = 0; i < renderBatchContext.getIndex(); ++i) {
-			auto& p = buffer[i];
-			if (zBuffer.get(p.x, p.y) > p.depth) {
-				fb->setPixel(p.x, p.y, p.color);
-				zBuffer.set(p.x, p.y, p.color);
+	size_t Renderer::assembleTriangle(RenderMode mode, RenderBatchContext<BUFFER_SIZE>& batchContext, int width, int height, const Vertex& v1, const Vertex& v2, const Vertex& v3, std::array<std::array<Vertex, 3>, 2>& out) {
+		std::reference_wrapper<const Vertex> r1 = v1;
+		std::reference_wrapper<const Vertex> r2 = v2;
+		std::reference_wrapper<const Vertex> r3 = v3;
+
+		SR_STATISTICS(batchContext.statistics.inputTriangles++);
+
+		auto surfaceNormal = this->getSurfaceNormal(v1, v2, v3);
+
+		// Backface culling
+		auto pos = lm::Vector3f(v2.getPosition().getXY(), v2.getPosition().getW());
+		auto dp = surfaceNormal * -pos;
+		if (dp > 0 && backfaceCullingEnabled) {
+			SR_STATISTICS(batchContext.statistics.culledTriangles++);
+			return 0;
+		}
+
+		std::array<Vertex, 3> outVertices;
+
+		auto& gs = batchContext.gs;
+		// geometry shader
+		if (mode == RenderMode::TRIANGLE && gs != nullptr) {
+			const bool declared = v1.layout.declared;
+
+			gs->in_positions = { v1.getPosition(), v2.getPosition(), v3.getPosition() };
+			if (!declared) {
+				gs->in_colors = { v1.getColor(), v2.getColor(), v3.getColor() };
+				gs->in_normals = { v1.getNormal(), v2.getNormal(), v3.getNormal() };
+			}
+			gs->in_varyings = { v1.varyings, v2.varyings, v3.varyings };
+			gs->out_varyings = gs->in_varyings;
+			gs->in_surfaceNormal = lm::Vector3f(-surfaceNormal.getXY(), surfaceNormal.getZ());
+
+			gs->main();
+
+			for (size_t i = 0; i < 3; ++i) {
+				auto& vertex = outVertices[i];
+				vertex.position = gs->out_positions[i];
+				vertex.layout = v1.layout;
+				vertex.copyVaryings(gs->out_varyings[i].data());
+				if (!declared) {
+					vertex.setColor(gs->out_colors[i]);
+					vertex.setNormal(gs->out_normals[i]);
+				}
 			}
+
+			gs->reset();
+
+			r1 = outVertices[0];
+			r2 = outVertices[1];
+			r3 = outVertices[2];
+		}
+
+		// Flat varyings of the first vertex for the whole triangle
+		if (mode == RenderMode::TRIANGLE && v1.layout.flat > 0) {
+			if (&r1.get() != &outVertices[0]) outVertices = { r1, r2, r3 };
+			outVertices[1].copyFlatVaryings(outVertices[0]);
+			outVertices[2].copyFlatVaryings(outVertices[0]);
+
+			r1 = outVertices[0];
+			r2 = outVertices[1];
+			r3 = outVertices[2];
+		}
+
+		// Most triangles lie in front of the near plane and are not copied for clipping
+		auto inside = [](const Vertex& v) { return -v.getPosition().getW() <= v.getPosition().getZ(); };
+		if (inside(r1) && inside(r2) && inside(r3)) {
+			out[0][0] = this->transformViewport(r1, width, height);
+			out[0][1] = this->transformViewport(r2, width, height);
+			out[0][2] = this->transformViewport(r3, width, height);
+			return 1;
+		}
+
+		// Clipping
+		auto clipped = this->clipTriangle(r1, r2, r3);
+		if (clipped.first == 0) {
+			SR_STATISTICS(batchContext.statistics.clippedTriangles++);
+			return 0;
 		}
+		SR_STATISTICS(if (clipped.first == 2) batchContext.statistics.splitTriangles++);
+		const auto& verts = clipped.second;
 
+		out[0] = { this->transformViewport(verts[0], width, height), this->transformViewport(verts[1], width, height), this->transformViewport(verts[2], width, height) };
+		if (clipped.first == 2) out[1] = { out[0][0], out[0][2], this->transformViewport(verts[3], width, height) };
+
+		return clipped.first;
 	}
 
+	void Renderer::rasterizeTriangle(RenderMode mode, const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const std::array<Vertex, 3>& triangle) {
+		if (mode == RenderMode::TRIANGLE)
+			this->renderTriangle(fb, batchContext, triangle[0], triangle[1], triangle[2]);
+		else
+			this->renderTriangleWireframe(fb, batchContext, triangle[0], triangle[1], triangle[2]);
+	}
 
-	// Triangle rendering
+	// Triangle parallel rendering
 
-	void Renderer::renderIndexedTriangleBatch(const std::vector<Vertex>& vertices, const IntegerDataBuffer<3>& indices, size_t batchBegin, size_t batchSize) {
+	void Renderer::renderIndexedBatch(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceVertexCount, size_t batchBegin, size_t batchSize) {
 		auto fb = this->frameBuffer.lock();
 		if (fb == nullptr) return;
-		
+
+		const int width = fb->getWidth();
+		const int height = fb->getHeight();
+
 		RenderBatchContext<BUFFER_SIZE> renderBatchContext;
-		auto geometryShader = this->geometryShader.lock();
-		auto fragementShader = this->fragmentShader.lock();
-		
-		if (geometryShader != nullptr) renderBatchContext.gs =  geometryShader->clone();
-		if (fragementShader != nullptr)
-			renderBatchContext.fs = fragementShader->clone();
-		else
-			return; // Fragmentshader is missing
-		
+		if (!this->initBatchContext(mode, renderBatchContext, true)) return;
+		renderBatchContext.clipRect = { 0, 0, width, height };
+
+		std::array<std::array<Vertex, 3>, 2> triangles;
+
+		// Triangle i is triangle i % instanceTriangles of instance i / instanceTriangles
+		const size_t instanceTriangles = indices.getAttributeCount();
+		size_t localTriangle = batchBegin % instanceTriangles;
+		size_t vertexOffset = batchBegin / instanceTriangles * instanceVertexCount;
+
 		for (size_t i = batchBegin; i < batchBegin + batchSize; ++i) {
-			auto triangleIndices = indices.getVertexAttribute(i);
+			auto triangleIndices = indices.getVertexAttribute(localTriangle);
 
-			std::reference_wrapper<const Vertex> v1 = vertices[triangleIndices[0]];
-			std::reference_wrapper<const Vertex> v2 = vertices[triangleIndices[1]];
-			std::reference_wrapper<const Vertex> v3 = vertices[triangleIndices[2]];
+			const Vertex v1 = vertices.get(vertexOffset + triangleIndices[0]);
+			const Vertex v2 = vertices.get(vertexOffset + triangleIndices[1]);
+			const Vertex v3 = vertices.get(vertexOffset + triangleIndices[2]);
 
-			auto surfaceNormal = this->getSurfaceNormal(v1, v2, v3);
+			if (++localTriangle == instanceTriangles) {
+				localTriangle = 0;
+				vertexOffset += instanceVertexCount;
+			}
 
-			// Backface culling
-			auto pos = lm::Vector3f(v2.get().getPosition().getXY(), v2.get().getPosition().getW());
-			auto dp = surfaceNormal * -pos;
-			if (dp > 0 && backfaceCullingEnabled) continue;
+			auto count = this->assembleTriangle(mode, renderBatchContext, width, height, v1, v2, v3, triangles);
+			for (size_t t = 0; t < count; ++t) this->rasterizeTriangle(mode, fb, renderBatchContext, triangles[t]);
+		}
 
+		// Render remaining fragments and pixels
+		this->shadeFragments(fb, renderBatchContext);
+		this->flushPixels(fb, renderBatchContext);
 
-			auto& gs = renderBatchContext.gs;
-			// geometry shader
-			if (gs != nullptr) {
-				
-				gs->in_positions = { v1.get().getPosition(), v2.get().getPosition(), v3.get().getPosition() };
-				gs->in_colors = { v1.get().getColor(), v2.get().getColor(), v3.get().getColor() };
-				gs->in_normals = { v1.get().getNormal(), v2.get().getNormal(), v3.get().getNormal() };
-				gs->in_surfaceNormal = lm::Vector3f(-surfaceNormal.getXY(), surfaceNormal.getZ());
+		SR_STATISTICS(this->addStatistics(renderBatchContext.statistics));
+	}
 
-				gs->main();
+	// Tile parallel rendering
 
-				const Vertex out1 = { gs->out_positions[0], gs->out_colors[0], gs->out_normals[0] };
-				const Vertex out2 = { gs->out_positions[1], gs->out_colors[1], gs->out_normals[1] };
-				const Vertex out3 = { gs->out_positions[2], gs->out_colors[2], gs->out_normals[2] };
+	void Renderer::binIndexedBatch(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceVertexCount, size_t bin, size_t batchBegin, size_t batchSize) {
+		auto fb = this->frameBuffer.lock();
+		if (fb == nullptr) return;
 
-				gs->reset();
+		const int width = fb->getWidth();
+		const int height = fb->getHeight();
+
+		RenderBatchContext<BUFFER_SIZE> renderBatchContext;
+		if (!this->initBatchContext(mode, renderBatchContext, false)) return;
+
+		auto& binTriangles = this->binnedTriangles[bin];
+		std::array<std::array<Vertex, 3>, 2> triangles;
+
+		// Triangle i is triangle i % instanceTriangles of instance i / instanceTriangles
+		const size_t instanceTriangles = indices.getAttributeCount();
+		size_t localTriangle = batchBegin % instanceTriangles;
+		size_t vertexOffset = batchBegin / instanceTriangles * instanceVertexCount;
 
-				v1 = out1;
-				v2 = out2;
-				v3 = out3;
+		for (size_t i = batchBegin; i < batchBegin + batchSize; ++i) {
+			auto triangleIndices = indices.getVertexAttribute(localTriangle);
+
+			const Vertex v1 = vertices.get(vertexOffset + triangleIndices[0]);
+			const Vertex v2 = vertices.get(vertexOffset + triangleIndices[1]);
+			const Vertex v3 = vertices.get(vertexOffset + triangleIndices[2]);
 
+			if (++localTriangle == instanceTriangles) {
+				localTriangle = 0;
+				vertexOffset += instanceVertexCount;
 			}
 
+			auto count = this->assembleTriangle(mode, renderBatchContext, width, height, v1, v2, v3, triangles);
+			for (size_t t = 0; t < count; ++t) {
+				const auto& triangle = triangles[t];
 
-			auto clipped = this->clipTriangle(v1, v2, v3);
-			if (clipped.first == 0) continue;
-			const auto& verts = clipped.second;
+				auto bounds = this->getTriangleBounds(triangle[0], triangle[1], triangle[2], width, height);
+				if (bounds.isEmpty()) continue;
 
-			this->renderTriangle(fb, renderBatchContext, verts[0], verts[1], verts[2]);
-			if (clipped.first == 2) this->renderTriangle(fb, renderBatchContext, verts[0], verts[2], verts[3]);
+				// Hidden by previous draws, see renderTriangle for the half-space rasterizer
+				if (mode == RenderMode::TRIANGLE && this->hierarchicalZEnabled && this->rasterizerType == RasterizerType::SCANLINE && this->zBuffer.isOccluded(bounds, this->zBuffer.encode(this->getMinDepth(triangle[0], triangle[1], triangle[2])))) {
+					SR_STATISTICS(renderBatchContext.statistics.occludedTriangles++);
+					continue;
+				}
 
+				this->tileBinner.insert(bin, bounds, uint32_t(binTriangles.size()));
+				binTriangles.push_back(triangle);
+			}
 		}
 
-		// Render remaining pixels
-		{
-			std::lock_guard<std::mutex> lock(this->frameBufferLock);
-			auto& buffer = renderBatchContext.getBuffer();
-			for (int i = 0; i < renderBatchContext.getIndex(); ++i) {
-				auto& p = buffer[i];
-				if (zBuffer.get(p.x, p.y) > p.depth) {
-					fb->setPixel(p.x, p.y, p.color);
-					zBuffer.set(p.x, p.y, p.depth);
-				}
+		SR_STATISTICS(this->addStatistics(renderBatchContext.statistics));
+	}
+
+	void Renderer::renderTile(RenderMode mode, int tile) {
+		auto fb = this->frameBuffer.lock();
+		if (fb == nullptr) return;
+
+		RenderBatchContext<BUFFER_SIZE> renderBatchContext;
+		if (!this->initBatchContext(mode, renderBatchContext, true)) return;
+		renderBatchContext.clipRect = this->tileBinner.getTileRect(tile);
+		renderBatchContext.directWrite = true;
+
+		// Bins are visited in submission order, so the result matches serial rendering
+		size_t rendered = 0;
+		for (size_t bin = 0; bin < this->tileBinner.getProducerCount(); ++bin) {
+			const auto& binTriangles = this->binnedTriangles[bin];
+			for (auto index : this->tileBinner.getBin(bin, tile)) {
+				this->rasterizeTriangle(mode, fb, renderBatchContext, binTriangles[index]);
+
+				// The depth hierarchy of this tile is owned by this thread
+				if (this->hierarchicalZEnabled && ++rendered % HIERARCHICAL_Z_REFRESH_INTERVAL == 0) this->zBuffer.refresh(renderBatchContext.clipRect);
 			}
 		}
 
+		this->shadeFragments(fb, renderBatchContext);
+		if (this->hierarchicalZEnabled) this->zBuffer.refresh(renderBatchContext.clipRect);
+
+		SR_STATISTICS(this->addStatistics(renderBatchContext.statistics));
 	}
 
-	void Renderer::renderTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3) {
-		const int width = fb->getWidth();
-		const int height = fb->getHeight();
-		
-		const auto tv1 = this->transformViewport(v1, width, height);
-		const auto tv2 = this->transformViewport(v2, width, height);
-		const auto tv3 = this->transformViewport(v3, width, height);
+	Rect Renderer::getTriangleBounds(const Vertex& v1, const Vertex& v2, const Vertex& v3, int width, int height) const {
+		const auto& p1 = v1.getPosition();
+		const auto& p2 = v2.getPosition();
+		const auto& p3 = v3.getPosition();
+
+		float xMin = std::min({ p1.getX(), p2.getX(), p3.getX() });
+		float yMin = std::min({ p1.getY(), p2.getY(), p3.getY() });
+		float xMax = std::max({ p1.getX(), p2.getX(), p3.getX() });
+		float yMax = std::max({ p1.getY(), p2.getY(), p3.getY() });
+
+		// Conservative, covers pixel centers as well as truncated wireframe coordinates
+		Rect bounds{};
+		bounds.xMin = int(std::clamp(std::floor(xMin), 0.0f, float(width)));
+		bounds.yMin = int(std::clamp(std::floor(yMin), 0.0f, float(height)));
+		bounds.xMax = int(std::clamp(std::floor(xMax) + 1.0f, 0.0f, float(width)));
+		bounds.yMax = int(std::clamp(std::floor(yMax) + 1.0f, 0.0f, float(height)));
+		return bounds;
+	}
+
+	float Renderer::getMinDepth(const Vertex& v1, const Vertex& v2, const Vertex& v3) const {
+		return std::min({ v1.getPosition().getZ(), v2.getPosition().getZ(), v3.getPosition().getZ() });
+	}
+
+	// Wireframe rendering
+	void Renderer::renderLine(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int xBegin, int yBegin, int xEnd, int yEnd, int color) {
+		const auto& clip = batchContext.clipRect;
+
+		int dx = abs(xEnd - xBegin);
+		int sx = xBegin < xEnd ? 1 : -1;
+		int dy = -std::abs(yEnd - yBegin);
+		int sy = yBegin < yEnd ? 1 : -1;
+		int err = dx + dy;
+		int e2; /* error value e_xy */
 
-		std::array<std::reference_wrapper<const Vertex>, 3> sorted = this->sortVerticesY(tv1, tv2, tv3);
+		int x = xBegin;
+		int y = yBegin;
+		const float depth = this->zBuffer.encode(0.0f);
+
+		while (1) {
+			if (x < clip.xMax && x >= clip.xMin && y < clip.yMax && y >= clip.yMin) {
+				this->renderPixel(fb, batchContext, x, y, color, depth);
+			}
+			if (x == xEnd && y == yEnd) break;
+			e2 = 2 * err;
+			if (e2 > dy) {
+				err += dy;
+				x += sx;
+			}
+			if (e2 < dx) {
+				err += dx;
+				y += sy;
+			}
+		}
+	}
+
+	void Renderer::renderTriangleWireframe(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3) {
+		const auto& pos1 = v1.getPosition();
+		const auto& pos2 = v2.getPosition();
+		const auto& pos3 = v3.getPosition();
+
+		SR_STATISTICS(batchContext.statistics.rasterizedTriangles++);
+
+		this->renderLine(fb, batchContext, pos1.getX(), pos1.getY(), pos2.getX(), pos2.getY(), 0xFFFFFFFF);
+		this->renderLine(fb, batchContext, pos2.getX(), pos2.getY(), pos3.getX(), pos3.getY(), 0xFFFFFFFF);
+		this->renderLine(fb, batchContext, pos3.getX(), pos3.getY(), pos1.getX(), pos1.getY(), 0xFFFFFFFF);
+	}
+
+
+	// Triangle rendering
+
+	void Renderer::renderTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& v1, const Vertex& v2, const Vertex& v3) {
+		// Vertices are in screen space.
+		// The half-space rasterizer covers pixels of the snapped triangle, whose depth may lie in front of every vertex,
+		// so only its own blocks are tested against the hierarchy, with a bound of the depth plane.
+		if (this->hierarchicalZEnabled && this->rasterizerType == RasterizerType::SCANLINE) {
+			const auto& clip = batchContext.clipRect;
+			auto bounds = this->getTriangleBounds(v1, v2, v3, clip.xMax, clip.yMax);
+			bounds.xMin = std::max(bounds.xMin, clip.xMin);
+			bounds.yMin = std::max(bounds.yMin, clip.yMin);
+
+			if (this->zBuffer.isOccluded(bounds, this->zBuffer.encode(this->getMinDepth(v1, v2, v3)))) {
+				SR_STATISTICS(batchContext.statistics.occludedTriangles++);
+				return;
+			}
+		}
+
+		SR_STATISTICS(batchContext.statistics.rasterizedTriangles++);
+
+		if (batchContext.fs != nullptr && batchContext.fs->derivativesUsed) batchContext.triangleDerivatives = this->getDerivatives(v1, v2, v3);
+
+		if (this->rasterizerType == RasterizerType::HALF_SPACE) {
+			HalfSpaceRasterizer rasterizer;
+			if (rasterizer.setup(v1, v2, v3, batchContext.clipRect)) {
+				rasterizer.rasterize(this->zBuffer, this->hierarchicalZEnabled, [this, &fb, &batchContext](int x, int y, const Vertex& fragment) {
+					this->shadeFragment(fb, batchContext, x, y, fragment);
+				});
+				return;
+			}
+			// Triangles outside of the guard band fall back to the scanline rasterizer
+		}
+
+		std::array<std::reference_wrapper<const Vertex>, 3> sorted = this->sortVerticesY(v1, v2, v3);
 
 		// generate 4th vertex
 
@@ -278,15 +618,15 @@ namespace sr {
 
 	}
 
-	void Renderer::renderFlatTopTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target) {
+	void Renderer::renderFlatTopTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target) {
 
 		float dy = target.getPosition().getY() - base1.getPosition().getY();
 
 		const auto dir1 = 1.0f/dy * (target - base1);
 		const auto dir2 = 1.0f/dy * (target - base2);
 
-		int yBegin = std::max(int(std::ceil(base1.getPosition().getY() - 0.5f)), 0);
-		int yEnd = std::min(int(std::ceil(target.getPosition().getY() - 0.5f)), fb->getHeight());
+		int yBegin = std::max(int(std::ceil(base1.getPosition().getY() - 0.5f)), batchContext.clipRect.yMin);
+		int yEnd = std::min(int(std::ceil(target.getPosition().getY() - 0.5f)), batchContext.clipRect.yMax);
 
 		const auto edge1 = base1 + ((float(yBegin) + 0.5f - base1.getPosition().getY()) * dir1);
 		const auto edge2 = base2 + ((float(yBegin) + 0.5f - base2.getPosition().getY()) * dir2);
@@ -295,15 +635,15 @@ namespace sr {
 
 	}
 
-	void Renderer::renderFlatBottomTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target) {
+	void Renderer::renderFlatBottomTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, const Vertex& base1, const Vertex& base2, const Vertex& target) {
 
 		float dy = base1.getPosition().getY() - target.getPosition().getY();
 
 		const auto dir1 = 1.0f / dy * (base1 - target);
 		const auto dir2 = 1.0f / dy * (base2 - target);
 
-		int yBegin = std::max(int(std::ceil(target.getPosition().getY() - 0.5f)), 0);
-		int yEnd = std::min(int(std::ceil(base1.getPosition().getY() - 0.5f)), fb->getHeight());
+		int yBegin = std::max(int(std::ceil(target.getPosition().getY() - 0.5f)), batchContext.clipRect.yMin);
+		int yEnd = std::min(int(std::ceil(base1.getPosition().getY() - 0.5f)), batchContext.clipRect.yMax);
 
 
 		const auto edge1 = target + ((float(yBegin) + 0.5f - target.getPosition().getY()) * dir1);
@@ -314,36 +654,32 @@ namespace sr {
 
 	}
 
-	void Renderer::renderFlatTriangle(const std::shared_ptr<pw::PixelWindow>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int yBegin, int yEnd, Vertex edge1, Vertex edge2, const Vertex& dir1, const Vertex& dir2) {
+	void Renderer::renderFlatTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int yBegin, int yEnd, const Vertex& edge1, const Vertex& edge2, const Vertex& dir1, const Vertex& dir2) {
+		switch (this->zBuffer.getFormat()) {
+		case DepthFormat::UNORM16: this->renderFlatTriangle<DepthFormat::UNORM16>(fb, batchContext, yBegin, yEnd, edge1, edge2, dir1, dir2); break;
+		case DepthFormat::UNORM24: this->renderFlatTriangle<DepthFormat::UNORM24>(fb, batchContext, yBegin, yEnd, edge1, edge2, dir1, dir2); break;
+		default: this->renderFlatTriangle<DepthFormat::FLOAT32>(fb, batchContext, yBegin, yEnd, edge1, edge2, dir1, dir2); break;
+		}
+	}
+
+	template<DepthFormat Format>
+	void Renderer::renderFlatTriangle(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int yBegin, int yEnd, Vertex edge1, Vertex edge2, const Vertex& dir1, const Vertex& dir2) {
 		for (int y = yBegin; y < yEnd ; ++y) {
-			int xBegin = std::max(int(std::ceil(edge1.getPosition().getX() - 0.5f)), 0);
-			int xEnd = std::min(int(std::ceil(edge2.getPosition().getX() - 0.5f)), fb->getWidth());
+			int xBegin = std::max(int(std::ceil(edge1.getPosition().getX() - 0.5f)), batchContext.clipRect.xMin);
+			int xEnd = std::min(int(std::ceil(edge2.getPosition().getX() - 0.5f)), batchContext.clipRect.xMax);
 			
 
 			float dx = edge2.getPosition().getX() - edge1.getPosition().getX();
 			auto xStep = 1.0f / dx * (edge2 - edge1);
 
 			auto line = edge1 + (float(xBegin) + 0.5f - edge1.getPosition().getX()) * xStep;
+			const auto* zRow = this->zBuffer.getRow<Format>(y);
 
 			for (int x = xBegin; x < xEnd ; ++x) {
 				// z is between -1 and 1
 
 				// Z-Test
-				if (this->zBuffer.get(x, y) < line.getPosition().getZ()) continue;
-
-				auto& fs = batchContext.fs;
-
-
-				fs->in_color = line.getColor();
-				fs->in_position = line.getPosition();
-				fs->in_normal = line.getNormal();
-				fs->main();
-
-				int color = this->convertColor(fs->out_color);
-				
-				//fb->setPixel(x, y, color);
-				this->renderPixel(fb, batchContext, x, y, color, line.getPosition().getZ());
-				
+				if (!(ZBuffer::load<Format>(zRow, x) < ZBuffer::encode<Format>(line.getPosition().getZ()))) this->shadeFragment(fb, batchContext, x, y, line);
 
 				line = line + xStep;
 			}
@@ -354,9 +690,143 @@ namespace sr {
 
 	}
 
+	void Renderer::shadeFragment(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, const Vertex& fragment) {
+		if (this->depthMode == DepthMode::DEPTH_ONLY) {
+			this->renderPixel(fb, batchContext, x, y, 0, this->zBuffer.encode(fragment.getPosition().getZ()));
+			return;
+		}
+
+		// Only the visible surface is shaded, the depth buffer is not written in this mode
+		if (this->depthMode == DepthMode::EQUAL && this->zBuffer.get(x, y) != this->zBuffer.encode(fragment.getPosition().getZ())) {
+			SR_STATISTICS(batchContext.statistics.earlyRejectedFragments++);
+			return;
+		}
+
+		if (batchContext.deferredShader >= 0) {
+			this->renderDeferredPixel(fb, batchContext, x, y, fragment);
+			return;
+		}
+
+		const size_t index = batchContext.shadingCount++;
+		batchContext.shadingInputs[index] = fragment;
+		batchContext.shadingPositions[index] = { x, y };
+		if (batchContext.fs->derivativesUsed) batchContext.shadingDerivatives[index] = batchContext.triangleDerivatives;
+		if (batchContext.shadingCount == FRAGMENT_BATCH_SIZE) this->shadeFragments(fb, batchContext);
+	}
+
+	void Renderer::shadeFragments(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext) {
+		const size_t count = batchContext.shadingCount;
+		if (count == 0) return;
+
+		const VaryingDerivatives* derivatives = batchContext.fs->derivativesUsed ? batchContext.shadingDerivatives.data() : nullptr;
+		batchContext.fs->shadeFragments(batchContext.shadingInputs.data(), derivatives, count, batchContext.shadingColors.data());
+		SR_STATISTICS(batchContext.statistics.shadedFragments += count);
+
+		const auto format = fb->getPixelFormat();
+		for (size_t i = 0; i < count; ++i) {
+			const auto& position = batchContext.shadingPositions[i];
+			this->renderPixel(fb, batchContext, position[0], position[1], this->convertColor(batchContext.shadingColors[i], format), this->zBuffer.encode(batchContext.shadingInputs[i].getPosition().getZ()));
+		}
+
+		batchContext.shadingCount = 0;
+	}
+
+
+	void Renderer::renderDeferredPixel(const std::shared_ptr<RenderSurface>& fb, RenderBatchContext<BUFFER_SIZE>& batchContext, int x, int y, const Vertex& fragment) {
+		const float depth = this->zBuffer.encode(fragment.getPosition().getZ());
+
+		if (batchContext.directWrite) {
+			if (this->testDepth(x, y, depth)) {
+				this->gBuffer.set(x, y, batchContext.deferredShader, fragment);
+				if (this->depthMode != DepthMode::EQUAL) zBuffer.set(x, y, depth);
+				SR_STATISTICS(batchContext.statistics.writtenFragments++);
+			}
+			else {
+				SR_STATISTICS(batchContext.statistics.depthRejectedFragments++);
+			}
+			return;
+		}
+
+		batchContext.addDeferredPixel(x, y, depth, fragment);
+		if (batchContext.isFull()) this->flushPixels(fb, batchContext);
+	}
+
+	void Renderer::resolveDeferred(const std::shared_ptr<RenderSurface>& fb) {
+		if (this->deferredShaders.empty()) return;
+
+		SR_STATISTICS(const uint64_t resolveBegin = PipelineStatistics::now());
+
+		const int width = this->gBuffer.getWidth();
+		const int height = this->gBuffer.getHeight();
+		const auto format = fb->getPixelFormat();
+
+		// Every visible pixel is shaded exactly once
+		// One job per thread claims blocks of rows, so a shader is cloned once per thread, not per block
+		const size_t blocks = size_t(height + DEFERRED_RESOLVE_ROWS - 1) / DEFERRED_RESOLVE_ROWS;
+		std::atomic<size_t> nextBlock = 0;
+		this->dispatch(std::min(blocks, this->getThreadCount()), [this, &fb, &nextBlock, blocks, width, height, format](size_t) {
+			std::vector<std::unique_ptr<FragmentShader>> shaders(this->deferredShaders.size()); // cloned on first use
+			SR_STATISTICS(PipelineStatistics resolveStatistics);
+
+			std::array<lm::Vector4f, FRAGMENT_BATCH_SIZE> colors;
+			std::array<VaryingDerivatives, FRAGMENT_BATCH_SIZE> derivatives;
+
+			// Derivatives may read the rows next to the block, the G-buffer is only cleared once every block is done
+			for (size_t block; (block = nextBlock.fetch_add(1, std::memory_order_relaxed)) < blocks;) {
+				const int yBegin = int(block) * DEFERRED_RESOLVE_ROWS;
+				const int yEnd = std::min(yBegin + DEFERRED_RESOLVE_ROWS, height);
+				for (int y = yBegin; y < yEnd; ++y) {
+					for (int x = 0; x < width;) {
+						const int shader = this->gBuffer.getShader(x, y);
+						if (shader < 0) {
+							++x;
+							continue;
+						}
+
+						// Neighboring pixels of the same shader are shaded as one batch, their fragments are adjacent in the G-buffer
+						int xEnd = x + 1;
+						while (xEnd < width && xEnd - x < FRAGMENT_BATCH_SIZE && this->gBuffer.getShader(xEnd, y) == shader) xEnd++;
+
+						auto& fs = shaders[shader];
+						if (fs == nullptr) fs = this->deferredShaders[shader]->clone();
+
+						if (fs->derivativesUsed) {
+							for (int i = x; i < xEnd; ++i) derivatives[i - x] = this->gBuffer.getDerivatives(i, y);
+						}
+
+						fs->shadeFragments(&this->gBuffer.getFragment(x, y), fs->derivativesUsed ? derivatives.data() : nullptr, size_t(xEnd - x), colors.data());
+						SR_STATISTICS(resolveStatistics.shadedFragments += xEnd - x);
+
+						for (int i = x; i < xEnd; ++i) fb->setPixel(i, y, this->convertColor(colors[i - x], format));
+						x = xEnd;
+					}
+				}
+			}
+
+			SR_STATISTICS(this->addStatistics(resolveStatistics));
+		});
+
+		this->dispatch(blocks, [this, width, height](size_t block) {
+			const int yBegin = int(block) * DEFERRED_RESOLVE_ROWS;
+			const int yEnd = std::min(yBegin + DEFERRED_RESOLVE_ROWS, height);
+			for (int y = yBegin; y < yEnd; ++y) {
+				for (int x = 0; x < width; ++x) {
+					if (this->gBuffer.getShader(x, y) >= 0) this->gBuffer.clear(x, y);
+				}
+			}
+		});
+
+		this->deferredShaders.clear();
+
+#ifdef SR_ENABLE_STATISTICS
+		PipelineStatistics resolveStatistics;
+		resolveStatistics.resolveTime = PipelineStatistics::now() - resolveBegin;
+		this->addStatistics(resolveStatistics);
+#endif
+	}
 
 	Vertex Renderer::transformViewport(const Vertex& vert, int viewportWidth, int viewportHeight) const {
-		Vertex out{};
+		Vertex out = vert;
 
 		const auto& pos = vert.getPosition();
 		const auto scale = 1.0f / pos.getW();
@@ -366,9 +836,6 @@ namespace sr {
 		out.position[2] = pos.getZ() * scale;
 		out.position[3] = pos.getW() * scale;
 
-		out.color = vert.color;
-		out.normal = vert.normal;
-
 		return out;
 	}
 
@@ -383,22 +850,17 @@ namespace sr {
 	}
 
 	Vertex Renderer::lerp(const Vertex& v1, const Vertex& v2, float alpha) const {
-		Vertex out{};
-
-		out.position = alpha * v1.getPosition() + (1 - alpha) * v2.getPosition();
-		out.color = alpha * v1.getColor() + (1 - alpha) * v2.getColor();
-		out.normal = alpha * v1.getNormal() + (1 - alpha) * v2.getNormal();
-
-		return out;
+		return alpha * v1 + (1 - alpha) * v2;
 	}
 
-	int Renderer::convertColor(const lm::Vector4f& color) const {
+	int Renderer::convertColor(const lm::Vector4f& color, PixelFormat format) const {
 		auto c = 255.0f * color;
 
 		int r = int(c.getX()) & 0xFF;
 		int g = int(c.getY()) & 0xFF;
 		int b = int(c.getZ()) & 0xFF;
 		int a = int(c.getW()) & 0xFF;
+		if (format == PixelFormat::BGRA8) return a << 24 | r << 16 | g << 8 | b; // rgba -> argb
 		return a << 24 | b << 16 | g << 8 | r; // rbga -> abgr
 	}
 
@@ -450,18 +912,67 @@ namespace sr {
 		return lm::cross((v2.getPosition() - v1.getPosition()).getXYZ(), (v3.getPosition() - v1.getPosition()).getXYZ());
 	}
 
+	VaryingDerivatives Renderer::getDerivatives(const Vertex& v1, const Vertex& v2, const Vertex& v3) const {
+		VaryingDerivatives derivatives = {};
+
+		const auto& p1 = v1.getPosition();
+		const auto& p2 = v2.getPosition();
+		const auto& p3 = v3.getPosition();
+
+		const float dx1 = p2.getX() - p1.getX();
+		const float dy1 = p2.getY() - p1.getY();
+		const float dx2 = p3.getX() - p1.getX();
+		const float dy2 = p3.getY() - p1.getY();
+
+		const float area = dx1 * dy2 - dx2 * dy1;
+		if (area == 0.0f) return derivatives;
+
+		// Gradients of the attribute planes
+		const float scale = 1.0f / area;
+		for (size_t i = 0; i < v1.layout.smooth; ++i) {
+			const float d1 = v2.varyings[i] - v1.varyings[i];
+			const float d2 = v3.varyings[i] - v1.varyings[i];
+			derivatives.dx[i] = scale * (dy2 * d1 - dy1 * d2);
+			derivatives.dy[i] = scale * (dx1 * d2 - dx2 * d1);
+		}
+
+		return derivatives;
+	}
+
+	void Renderer::checkResolveBufferSize() {
+		auto fb = this->frameBuffer.lock();
+		if (fb == nullptr) return;
+
+		const int tilesX = (fb->getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+		const int tileCount = tilesX * ((fb->getHeight() + TILE_SIZE - 1) / TILE_SIZE);
+		const size_t size = size_t(fb->getWidth()) * fb->getHeight();
+		if (size == this->resolveBufferSize && tilesX == this->resolveTilesX && tileCount == this->resolveTileCount) return;
+
+		this->resolveBuffer = std::make_unique<std::atomic<uint64_t>[]>(size);
+		this->resolveBufferSize = size;
+		this->resolveTiles = std::make_unique<std::atomic<uint8_t>[]>(size_t(tileCount));
+		this->resolveTilesX = tilesX;
+		this->resolveTileCount = tileCount;
+	}
+
 	void Renderer::checkZBufferSize() {
 		auto fb = this->frameBuffer.lock();
 		if (fb == nullptr) return;
 
-		if (fb->getWidth() == this->zBuffer.getWidth() && fb->getHeight() == this->zBuffer.getHeight()) return;
-		this->zBuffer.resize(fb->getWidth(), fb->getHeight());
+		if (fb->getWidth() == this->zBuffer.getWidth() && fb->getHeight() == this->zBuffer.getHeight() && fb->getDepthFormat() == this->zBuffer.getFormat()) return;
+		this->zBuffer.resize(fb->getWidth(), fb->getHeight(), fb->getDepthFormat());
 	}
 
 	// Public
 
+	void Renderer::setRenderSurface(std::weak_ptr<RenderSurface> surface) {
+		this->windowSurface = nullptr;
+		this->frameBuffer = surface;
+	}
+
 	void Renderer::setRenderSurface(std::weak_ptr<pw::PixelWindow> window) {
-		this->frameBuffer = window;
+		this->windowSurface = std::make_shared<WindowSurface>(window);
+		this->frameBuffer = this->windowSurface;
 	}
 
 	void Renderer::enableBackfaceCulling() {
@@ -480,73 +991,210 @@ namespace sr {
 		this->geometryShader = gs;
 	}
 
-	void Renderer::renderIndexed(RenderMode mode, const std::vector<Vertex>& vertices, const IntegerDataBuffer<3>& indices) {
+	void Renderer::bindTextures(const TextureUnits& textures) {
+		this->textures = textures;
+	}
+
+	void Renderer::setRasterizationMode(RasterizationMode mode) {
+		this->rasterizationMode = mode;
+	}
+
+	void Renderer::setRasterizer(RasterizerType type) {
+		this->rasterizerType = type;
+	}
+
+	void Renderer::setShadingMode(ShadingMode mode) {
+		this->shadingMode = mode;
+	}
+
+	void Renderer::setDepthMode(DepthMode mode) {
+		this->depthMode = mode;
+	}
+
+	void Renderer::enableHierarchicalZ() {
+		this->hierarchicalZEnabled = true;
+	}
+
+	void Renderer::disableHierarchicalZ() {
+		this->hierarchicalZEnabled = false;
+	}
+
+	void Renderer::setThreadCount(size_t threadCount) {
+		this->renderPool = std::make_unique<ThreadPool>(threadCount);
+	}
+
+	size_t Renderer::getThreadCount() const {
+		return this->renderPool->getThreadCount();
+	}
+
+	void Renderer::enableStatistics() {
+		this->statisticsEnabled = true;
+	}
+
+	void Renderer::disableStatistics() {
+		this->statisticsEnabled = false;
+		this->statistics = {};
+	}
+
+	const PipelineStatistics& Renderer::getStatistics() const {
+		return this->statistics;
+	}
+
+	void Renderer::addStatistics([[maybe_unused]] const PipelineStatistics& statistics) {
+#ifdef SR_ENABLE_STATISTICS
+		if (!this->statisticsEnabled) return;
+
+		std::lock_guard<std::mutex> lock(this->statisticsLock);
+		this->frameStatistics.add(statistics);
+#endif
+	}
+
+	void Renderer::cullClusters(const std::vector<MeshCluster>& clusters, const IntegerDataBuffer<3>& indices, const lm::Matrix4x4f& objectToClip, std::vector<int>& visibleIndices, std::vector<uint8_t>& visibleVertices) {
 		auto fb = this->frameBuffer.lock();
 		if (fb == nullptr) return;
 
+		SR_STATISTICS(PipelineStatistics cullStatistics);
 
-		if (mode == RenderMode::TRIANGLE) {
-			// Insert Multithreading
-			//this->renderIndexedTriangleBatch(vertices, indices, 0, indices.getAttributeCount());
+		ClusterCuller culler(objectToClip, fb->getWidth(), fb->getHeight(), this->backfaceCullingEnabled);
+		const int* data = indices.getData();
+		const size_t triangleCount = indices.getAttributeCount();
 
-			
-			int maxBatchSize = 100;
-			int batches = indices.getAttributeCount() / maxBatchSize;
-			auto mainBatchSize = indices.getAttributeCount() - size_t(batches) * maxBatchSize;
+		for (auto& cluster : clusters) {
+			if (cluster.triangleOffset >= triangleCount) continue;
+			const size_t end = std::min<size_t>(size_t(cluster.triangleOffset) + cluster.triangleCount, triangleCount);
 
-			auto batchRunner = [this, &vertices, &indices](int batchBegin, int batchSize) {
-				for (int i = 0; i < 1; ++i) {
-					this->renderIndexedTriangleBatch(vertices, indices, batchBegin, batchSize);
-				}
-			};
+			if (!culler.isVisible(cluster)) {
+				SR_STATISTICS(cullStatistics.culledClusters++);
+				SR_STATISTICS(cullStatistics.clusterCulledTriangles += end - cluster.triangleOffset);
+				continue;
+			}
 
-			for (int i = 0; i < batches; ++i) {
-				this->renderPool.addJob([i, maxBatchSize, &batchRunner] {
-					batchRunner(i * maxBatchSize, maxBatchSize);
-				});
+			for (size_t i = size_t(cluster.triangleOffset) * 3; i < end * 3; ++i) {
+				visibleIndices.push_back(data[i]);
+				visibleVertices[data[i]] = 1;
 			}
+		}
 
-			batchRunner(batches * maxBatchSize, mainBatchSize); // Run the rest of the work on the main thread
-			while (this->renderPool.isBusy());
-			
+		SR_STATISTICS(this->addStatistics(cullStatistics));
+	}
+
+	size_t Renderer::selectLod(const MeshLodChain& chain, const lm::Matrix4x4f& objectToClip, float pixelError) {
+		auto fb = this->frameBuffer.lock();
+		if (fb == nullptr) return 0;
+
+		return sr::selectLod(chain, objectToClip, fb->getWidth(), fb->getHeight(), pixelError);
+	}
 
+	void Renderer::renderIndexed(RenderMode mode, const VertexStream& vertices, const IntegerDataBuffer<3>& indices, size_t instanceCount) {
+		auto fb = this->frameBuffer.lock();
+		if (fb == nullptr || indices.getAttributeCount() == 0 || instanceCount == 0) return;
+
+		// Deferred draws keep a copy of their fragment shader until the G-buffer is resolved
+		this->currentDeferredShader = -1;
+		if (mode == RenderMode::TRIANGLE && this->shadingMode == ShadingMode::DEFERRED && this->depthMode != DepthMode::DEPTH_ONLY) {
+			auto fs = this->fragmentShader.lock();
+			if (fs == nullptr) return;
+
+			if (this->gBuffer.getWidth() != fb->getWidth() || this->gBuffer.getHeight() != fb->getHeight()) this->gBuffer.resize(fb->getWidth(), fb->getHeight());
+			this->currentDeferredShader = int(this->deferredShaders.size());
+			this->deferredShaders.push_back(fs->clone());
+			this->deferredShaders.back()->textures = this->textures;
 		}
-		else if (mode == RenderMode::TRIANGLE_WIREFRAME) {
-			int maxBatchSize = 2500;
-			int batches = indices.getAttributeCount() / maxBatchSize;
-			auto mainBatchSize = indices.getAttributeCount() - size_t(batches) * maxBatchSize;
-			
-			auto batchRunner = [this, &vertices, &indices](int batchBegin, int batchSize) {
-				for (int i = 0; i < 1; ++i) {
-					this->renderIndexedTriangleWireframeBatch(vertices, indices, batchBegin, batchSize);
-				}
-			};
 
-			for (int i = 0; i < batches; ++i) {
-				this->renderPool.addJob([i, maxBatchSize, &batchRunner] {
-					batchRunner(i * maxBatchSize, maxBatchSize);
-				});
+		SR_STATISTICS(PipelineStatistics stageStatistics);
+		SR_STATISTICS(uint64_t stageBegin = PipelineStatistics::now());
+
+		// All instances are scheduled as one workload
+		const size_t triangleCount = indices.getAttributeCount() * instanceCount;
+		const size_t instanceVertexCount = vertices.size / instanceCount;
+
+		if (this->rasterizationMode == RasterizationMode::TRIANGLE_BATCHES || this->rasterizationMode == RasterizationMode::TRIANGLE_BATCHES_ATOMIC) {
+			const size_t maxBatchSize = mode == RenderMode::TRIANGLE ? 100 : 2500;
+			const size_t batches = (triangleCount + maxBatchSize - 1) / maxBatchSize;
+
+			// G-buffer writes do not fit into a pixel of the resolve buffer, frames with deferred draws take the lock
+			this->atomicResolve = this->rasterizationMode == RasterizationMode::TRIANGLE_BATCHES_ATOMIC && this->deferredShaders.empty();
+			if (this->atomicResolve) this->checkResolveBufferSize();
+
+			this->dispatch(batches, [this, mode, maxBatchSize, triangleCount, instanceVertexCount, &vertices, &indices](size_t batch) {
+				const size_t batchBegin = batch * maxBatchSize;
+				this->renderIndexedBatch(mode, vertices, indices, instanceVertexCount, batchBegin, std::min(maxBatchSize, triangleCount - batchBegin));
+			});
+
+			if (this->atomicResolve) {
+				this->storeResolveTiles(fb);
+				this->atomicResolve = false;
 			}
 
-			batchRunner(batches * maxBatchSize, mainBatchSize); // Run the rest of the work on the main thread
-			while (this->renderPool.isBusy());
+			SR_STATISTICS(stageStatistics.rasterizationTime = PipelineStatistics::now() - stageBegin);
+		}
+		else if (this->rasterizationMode == RasterizationMode::SCREEN_TILES) {
+			// Geometry: cull, clip and sort the triangles into screen tiles
+			const size_t minBatchSize = 256;
+			const size_t maxBins = 64;
+			const size_t bins = std::clamp<size_t>((triangleCount + minBatchSize - 1) / minBatchSize, 1, maxBins);
+			const size_t batchSize = (triangleCount + bins - 1) / bins;
+
+			this->tileBinner.resize(fb->getWidth(), fb->getHeight(), bins);
+			this->binnedTriangles.resize(bins);
+			for (auto& triangles : this->binnedTriangles) triangles.clear();
+
+			this->dispatch(bins, [this, mode, batchSize, triangleCount, instanceVertexCount, &vertices, &indices](size_t bin) {
+				const size_t batchBegin = std::min(bin * batchSize, triangleCount);
+				this->binIndexedBatch(mode, vertices, indices, instanceVertexCount, bin, batchBegin, std::min(batchSize, triangleCount - batchBegin));
+			});
+
+			SR_STATISTICS(stageStatistics.geometryTime = PipelineStatistics::now() - stageBegin);
+			SR_STATISTICS(stageBegin = PipelineStatistics::now());
+
+			// Raster: every tile is owned by one thread, no locking required
+			std::vector<int> tiles;
+			for (int tile = 0; tile < this->tileBinner.getTileCount(); ++tile) {
+				if (!this->tileBinner.isTileEmpty(tile)) tiles.push_back(tile);
+			}
+
+			this->dispatch(tiles.size(), [this, mode, &tiles](size_t i) {
+				this->renderTile(mode, tiles[i]);
+			});
 
+			SR_STATISTICS(stageStatistics.rasterizationTime = PipelineStatistics::now() - stageBegin);
 		}
+
+		SR_STATISTICS(this->addStatistics(stageStatistics));
 	}
 
 	void Renderer::beginFrame() {
 		auto fb = this->frameBuffer.lock();
 		if (fb == nullptr) return;
 		fb->beginFrame();
-		fb->setBackgroundColor(0x00000000);
+		fb->clear(0x00000000);
 		this->checkZBufferSize();
 		this->zBuffer.reset();
+
+		// Fragments of a frame that was never ended
+		if (!this->deferredShaders.empty()) {
+			this->gBuffer.resize(this->gBuffer.getWidth(), this->gBuffer.getHeight());
+			this->deferredShaders.clear();
+		}
+
+#ifdef SR_ENABLE_STATISTICS
+		this->frameStatistics = {};
+		this->frameBegin = PipelineStatistics::now();
+#endif
 	}
 
 	void Renderer::endFrame() {
 		auto fb = this->frameBuffer.lock();
 		if (fb == nullptr) return;
+		this->resolveDeferred(fb);
 		fb->endFrame();
+
+#ifdef SR_ENABLE_STATISTICS
+		if (this->statisticsEnabled) {
+			this->frameStatistics.frameTime = PipelineStatistics::now() - this->frameBegin;
+			this->statistics = this->frameStatistics;
+		}
+#endif
 	}
 
 }
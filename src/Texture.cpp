@@ -0,0 +1,717 @@
+#include "SoftwareRenderer/Texture.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+
+#include "SoftwareRenderer/MappedFile.h"
+
+namespace sr {
+
+	constexpr uint32_t TEXTURE_FILE_MAX_SIZE = 1 << 16; // texels per side of a level
+
+	class TextureFileHeader {
+	public:
+		char magic[4];
+		uint32_t version;
+		uint32_t endianTag;
+		uint32_t format;
+		uint32_t filter;
+		uint32_t wrap;
+		uint32_t levelCount;
+		uint32_t reserved;
+	};
+
+	class TextureFileLevel {
+	public:
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	static_assert(sizeof(TextureFileHeader) == 32 && sizeof(TextureFileLevel) == 24);
+
+	// Offsets of the texels of a tile in Morton order, x bits at even and y bits at odd positions
+	static_assert(TEXTURE_TILE_SIZE == 8, "Tiles are addressed with 3 bits per axis");
+	constexpr std::array<uint32_t, TEXTURE_TILE_SIZE> MORTON_BITS = { 0, 1, 4, 5, 16, 17, 20, 21 };
+
+	static lm::Vector4f unpackTexel(uint32_t texel) {
+		constexpr float scale = 1.0f / 255.0f;
+		return { float(texel & 0xFF) * scale, float(texel >> 8 & 0xFF) * scale, float(texel >> 16 & 0xFF) * scale, float(texel >> 24) * scale };
+	}
+
+	static simd::vfloat unpackChannel(simd::vint texels, int channel) {
+		return simd::toFloat(simd::bitAnd(simd::shiftRight(texels, 8 * channel), simd::set1(0xFF)));
+	}
+
+	// Block compression
+
+	static_assert(TEXTURE_BLOCK_SIZE == 4, "Blocks hold 16 texels with 2 and 3 bit indices");
+	static_assert(TEXTURE_BLOCK_CACHE_SIZE == 64, "Decoded blocks are cached by 3 bits of their x and y coordinates");
+
+	class DecodedBlock {
+	public:
+		uint64_t level; // id of the level, 0 for an unused entry
+		size_t block;
+		uint32_t texels[16];
+	};
+
+	static thread_local std::array<DecodedBlock, TEXTURE_BLOCK_CACHE_SIZE> decodedBlocks;
+	static std::atomic<uint64_t> nextLevelId = 1;
+
+	static uint32_t packTexel(uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+		return r | g << 8 | b << 16 | a << 24;
+	}
+
+	static void expandColor(uint32_t color, uint32_t rgb[3]) {
+		const uint32_t r = color >> 11;
+		const uint32_t g = color >> 5 & 0x3F;
+		const uint32_t b = color & 0x1F;
+		rgb[0] = r << 3 | r >> 2;
+		rgb[1] = g << 2 | g >> 4;
+		rgb[2] = b << 3 | b >> 2;
+	}
+
+	// Colors of the indices of a color block. With alpha, ascending endpoints select 3 colors and transparent black.
+	static void decodeColorPalette(uint64_t block, bool alpha, uint32_t palette[4]) {
+		const uint32_t c0 = uint32_t(block & 0xFFFF);
+		const uint32_t c1 = uint32_t(block >> 16 & 0xFFFF);
+		uint32_t a[3], b[3];
+		expandColor(c0, a);
+		expandColor(c1, b);
+
+		palette[0] = packTexel(a[0], a[1], a[2], 255);
+		palette[1] = packTexel(b[0], b[1], b[2], 255);
+		if (c0 > c1 || !alpha) {
+			palette[2] = packTexel((2 * a[0] + b[0]) / 3, (2 * a[1] + b[1]) / 3, (2 * a[2] + b[2]) / 3, 255);
+			palette[3] = packTexel((a[0] + 2 * b[0]) / 3, (a[1] + 2 * b[1]) / 3, (a[2] + 2 * b[2]) / 3, 255);
+		}
+		else {
+			palette[2] = packTexel((a[0] + b[0]) / 2, (a[1] + b[1]) / 2, (a[2] + b[2]) / 2, 255);
+			palette[3] = 0;
+		}
+	}
+
+	// Alphas of the indices of an alpha block, ascending endpoints select 6 alphas, 0 and 255
+	static void decodeAlphaPalette(uint64_t block, uint32_t palette[8]) {
+		const uint32_t a0 = uint32_t(block & 0xFF);
+		const uint32_t a1 = uint32_t(block >> 8 & 0xFF);
+
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1) {
+			for (uint32_t i = 2; i < 8; ++i) palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+		}
+		else {
+			for (uint32_t i = 2; i < 6; ++i) palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	static void decodeBlock(TextureFormat format, const uint64_t* block, uint32_t texels[16]) {
+		const uint64_t color = format == TextureFormat::BC3 ? block[1] : block[0];
+		uint32_t palette[4];
+		decodeColorPalette(color, format == TextureFormat::BC1, palette);
+		for (int i = 0; i < 16; ++i) texels[i] = palette[color >> (32 + 2 * i) & 3];
+		if (format != TextureFormat::BC3) return;
+
+		uint32_t alphas[8];
+		decodeAlphaPalette(block[0], alphas);
+		for (int i = 0; i < 16; ++i) texels[i] = (texels[i] & 0x00FFFFFF) | alphas[block[0] >> (16 + 3 * i) & 7] << 24;
+	}
+
+	static uint32_t getColorDistance(uint32_t t1, uint32_t t2) {
+		uint32_t distance = 0;
+		for (int shift = 0; shift < 24; shift += 8) {
+			const int difference = int(t1 >> shift & 0xFF) - int(t2 >> shift & 0xFF);
+			distance += uint32_t(difference * difference);
+		}
+		return distance;
+	}
+
+	static uint32_t quantizeColor(uint32_t texel) {
+		const uint32_t r = ((texel & 0xFF) * 31 + 127) / 255;
+		const uint32_t g = ((texel >> 8 & 0xFF) * 63 + 127) / 255;
+		const uint32_t b = ((texel >> 16 & 0xFF) * 31 + 127) / 255;
+		return r << 11 | g << 5 | b;
+	}
+
+	// Endpoints are the extreme colors along the principal axis of the block, every texel takes the nearest palette color.
+	// With alpha, texels below 0.5 are transparent and the others are fitted with 3 colors.
+	static uint64_t encodeColorBlock(const uint32_t texels[16], bool alpha) {
+		bool transparent[16];
+		int opaque = 0;
+		float mean[3] = {};
+		for (int i = 0; i < 16; ++i) {
+			transparent[i] = alpha && (texels[i] >> 24) < 128;
+			if (transparent[i]) continue;
+			++opaque;
+			for (int c = 0; c < 3; ++c) mean[c] += float(texels[i] >> (8 * c) & 0xFF);
+		}
+		if (opaque == 0) return 0xFFFFFFFF00000000ull; // both endpoints black, every index transparent
+		for (int c = 0; c < 3; ++c) mean[c] /= float(opaque);
+
+		float covariance[3][3] = {};
+		for (int i = 0; i < 16; ++i) {
+			if (transparent[i]) continue;
+			float d[3];
+			for (int c = 0; c < 3; ++c) d[c] = float(texels[i] >> (8 * c) & 0xFF) - mean[c];
+			for (int r = 0; r < 3; ++r) {
+				for (int c = 0; c < 3; ++c) covariance[r][c] += d[r] * d[c];
+			}
+		}
+
+		// Power iteration from the channel with the largest variance, a few steps find the dominant axis well enough for 4 colors
+		int channel = 0;
+		for (int c = 1; c < 3; ++c) {
+			if (covariance[c][c] > covariance[channel][channel]) channel = c;
+		}
+		float axis[3] = { covariance[channel][0], covariance[channel][1], covariance[channel][2] };
+		for (int step = 0; step < 8; ++step) {
+			float next[3];
+			for (int r = 0; r < 3; ++r) next[r] = covariance[r][0] * axis[0] + covariance[r][1] * axis[1] + covariance[r][2] * axis[2];
+			const float length = std::max(std::abs(next[0]), std::max(std::abs(next[1]), std::abs(next[2])));
+			if (length == 0.0f) break;
+			for (int c = 0; c < 3; ++c) axis[c] = next[c] / length;
+		}
+
+		uint32_t first = 0, last = 0;
+		float minProjection = INFINITY, maxProjection = -INFINITY;
+		for (int i = 0; i < 16; ++i) {
+			if (transparent[i]) continue;
+			float projection = 0.0f;
+			for (int c = 0; c < 3; ++c) projection += float(texels[i] >> (8 * c) & 0xFF) * axis[c];
+			if (projection < minProjection) {
+				minProjection = projection;
+				last = texels[i];
+			}
+			if (projection > maxProjection) {
+				maxProjection = projection;
+				first = texels[i];
+			}
+		}
+
+		uint32_t c0 = quantizeColor(first);
+		uint32_t c1 = quantizeColor(last);
+		const bool threeColors = opaque < 16;
+		if (threeColors ? c0 > c1 : c0 < c1) std::swap(c0, c1);
+
+		uint64_t block = c0 | c1 << 16;
+		uint32_t palette[4];
+		decodeColorPalette(block, alpha, palette);
+		const uint32_t colors = (c0 > c1 || !alpha) ? 4 : 3;
+
+		for (int i = 0; i < 16; ++i) {
+			uint32_t index = 3;
+			if (!transparent[i]) {
+				index = 0;
+				for (uint32_t j = 1; j < colors; ++j) {
+					if (getColorDistance(texels[i], palette[j]) < getColorDistance(texels[i], palette[index])) index = j;
+				}
+			}
+			block |= uint64_t(index) << (32 + 2 * i);
+		}
+		return block;
+	}
+
+	static uint64_t encodeAlphaBlock(const uint32_t texels[16]) {
+		uint32_t a0 = 0, a1 = 255;
+		for (int i = 0; i < 16; ++i) {
+			a0 = std::max(a0, texels[i] >> 24);
+			a1 = std::min(a1, texels[i] >> 24);
+		}
+
+		uint64_t block = a0 | a1 << 8;
+		if (a0 == a1) return block;
+
+		uint32_t palette[8];
+		decodeAlphaPalette(block, palette);
+		for (int i = 0; i < 16; ++i) {
+			const int alpha = int(texels[i] >> 24);
+			uint32_t index = 0;
+			for (uint32_t j = 1; j < 8; ++j) {
+				if (std::abs(alpha - int(palette[j])) < std::abs(alpha - int(palette[index]))) index = j;
+			}
+			block |= uint64_t(index) << (16 + 3 * i);
+		}
+		return block;
+	}
+
+	// Texture
+
+	uint32_t Texture::Level::get(int x, int y) const {
+		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
+		if (this->format != TextureFormat::RGBA8) return this->getCompressed(x, y);
+
+		const size_t tile = size_t(y >> 3) * this->tilesX + size_t(x >> 3);
+		return this->texels[tile * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE + (MORTON_BITS[x & 7] | MORTON_BITS[y & 7] << 1)];
+	}
+
+	uint32_t Texture::Level::getCompressed(int x, int y) const {
+		const int blockX = x / TEXTURE_BLOCK_SIZE;
+		const int blockY = y / TEXTURE_BLOCK_SIZE;
+		const size_t block = size_t(blockY) * this->tilesX + size_t(blockX);
+
+		// Blocks within 8x8 blocks of each other never evict each other, the id spreads the levels of a trilinear sample
+		DecodedBlock& entry = decodedBlocks[(size_t(blockX & 7) | size_t(blockY & 7) << 3) ^ size_t(this->id & (TEXTURE_BLOCK_CACHE_SIZE - 1))];
+		if (entry.level != this->id || entry.block != block) {
+			const size_t words = this->format == TextureFormat::BC3 ? 2 : 1;
+			decodeBlock(this->format, &this->blocks[block * words], entry.texels);
+			entry.level = this->id;
+			entry.block = block;
+		}
+		return entry.texels[(y % TEXTURE_BLOCK_SIZE) * TEXTURE_BLOCK_SIZE + x % TEXTURE_BLOCK_SIZE];
+	}
+
+	size_t Texture::Level::getByteSize() const {
+		return this->texels.size() * sizeof(uint32_t) + this->blocks.size() * sizeof(uint64_t);
+	}
+
+	Texture::Texture(int width, int height, const std::vector<uint32_t>& texels, bool mipmaps, TextureFormat format) : format(format) {
+		if (width <= 0 || height <= 0) return;
+		assert(texels.size() >= size_t(width) * height);
+
+		this->addLevel(width, height, texels.data());
+		if (!mipmaps) return;
+
+		// Every texel of a level averages 2x2 texels of the previous one, odd sizes repeat the last row or column
+		std::vector<uint32_t> rows(texels.begin(), texels.begin() + size_t(width) * height);
+		while (width > 1 || height > 1) {
+			const int levelWidth = std::max(width / 2, 1);
+			const int levelHeight = std::max(height / 2, 1);
+
+			std::vector<uint32_t> levelRows(size_t(levelWidth) * levelHeight);
+			for (int y = 0; y < levelHeight; ++y) {
+				const uint32_t* row0 = &rows[size_t(2 * y) * width];
+				const uint32_t* row1 = &rows[size_t(std::min(2 * y + 1, height - 1)) * width];
+				for (int x = 0; x < levelWidth; ++x) {
+					const int x0 = 2 * x;
+					const int x1 = std::min(2 * x + 1, width - 1);
+
+					uint32_t texel = 0;
+					for (int shift = 0; shift < 32; shift += 8) {
+						const uint32_t sum = (row0[x0] >> shift & 0xFF) + (row0[x1] >> shift & 0xFF) + (row1[x0] >> shift & 0xFF) + (row1[x1] >> shift & 0xFF);
+						texel |= ((sum + 2) / 4) << shift;
+					}
+					levelRows[size_t(y) * levelWidth + x] = texel;
+				}
+			}
+
+			this->addLevel(levelWidth, levelHeight, levelRows.data());
+			rows = std::move(levelRows);
+			width = levelWidth;
+			height = levelHeight;
+		}
+	}
+
+	void Texture::addLevel(int width, int height, const uint32_t* rows) {
+		if (this->format != TextureFormat::RGBA8) {
+			constexpr int blockSize = TEXTURE_BLOCK_SIZE;
+			const int blocksX = (width + blockSize - 1) / blockSize;
+			const int blocksY = (height + blockSize - 1) / blockSize;
+
+			// Blocks over the edge of the level repeat the last row or column
+			std::vector<uint64_t> blocks;
+			blocks.reserve(size_t(blocksX) * blocksY * (this->format == TextureFormat::BC3 ? 2 : 1));
+			for (int blockY = 0; blockY < blocksY; ++blockY) {
+				for (int blockX = 0; blockX < blocksX; ++blockX) {
+					uint32_t texels[blockSize * blockSize];
+					for (int i = 0; i < blockSize * blockSize; ++i) {
+						const int x = std::min(blockX * blockSize + i % blockSize, width - 1);
+						const int y = std::min(blockY * blockSize + i / blockSize, height - 1);
+						texels[i] = rows[size_t(y) * width + x];
+					}
+
+					if (this->format == TextureFormat::BC3) blocks.push_back(encodeAlphaBlock(texels));
+					blocks.push_back(encodeColorBlock(texels, this->format == TextureFormat::BC1));
+				}
+			}
+
+			this->addLevel(width, height, std::move(blocks));
+			return;
+		}
+
+		constexpr int tileSize = TEXTURE_TILE_SIZE;
+
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.tilesX = (width + tileSize - 1) / tileSize;
+		const int tilesY = (height + tileSize - 1) / tileSize;
+		level.texels.resize(size_t(level.tilesX) * tilesY * tileSize * tileSize);
+
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				const size_t tile = size_t(y / tileSize) * level.tilesX + size_t(x / tileSize);
+				level.texels[tile * tileSize * tileSize + (MORTON_BITS[x % tileSize] | MORTON_BITS[y % tileSize] << 1)] = rows[size_t(y) * width + x];
+			}
+		}
+
+		this->levels.push_back(std::move(level));
+	}
+
+	void Texture::addLevel(int width, int height, std::vector<uint64_t> blocks) {
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.tilesX = (width + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE;
+		level.format = this->format;
+		level.id = nextLevelId++;
+		level.blocks = std::move(blocks);
+
+		this->levels.push_back(std::move(level));
+	}
+
+	int Texture::wrapCoordinate(int coordinate, int size) const {
+		if (unsigned(coordinate) < unsigned(size)) return coordinate;
+		if (this->wrap == TextureWrap::CLAMP) return std::clamp(coordinate, 0, size - 1);
+
+		coordinate %= size;
+		return coordinate < 0 ? coordinate + size : coordinate;
+	}
+
+	void Texture::selectLevels(float lod, size_t& level, size_t& nextLevel, float& weight) const {
+		const float last = float(this->levels.size() - 1);
+		lod = std::min(std::max(0.0f, lod), last); // NaN selects the first level
+
+		weight = 0.0f;
+		if (this->filter != TextureFilter::TRILINEAR) {
+			level = nextLevel = size_t(std::min(std::floor(lod + 0.5f), last));
+			return;
+		}
+
+		level = size_t(lod);
+		nextLevel = std::min(level + 1, this->levels.size() - 1);
+		weight = lod - float(level);
+	}
+
+	lm::Vector4f Texture::sampleNearest(const Level& level, float u, float v) const {
+		if (this->wrap == TextureWrap::REPEAT) {
+			u -= std::floor(u);
+			v -= std::floor(v);
+		}
+
+		const int x = int(std::min(std::max(0.0f, u * float(level.width)), float(level.width - 1)));
+		const int y = int(std::min(std::max(0.0f, v * float(level.height)), float(level.height - 1)));
+		return unpackTexel(level.get(x, y));
+	}
+
+	lm::Vector4f Texture::sampleBilinear(const Level& level, float u, float v) const {
+		if (this->wrap == TextureWrap::REPEAT) {
+			u -= std::floor(u);
+			v -= std::floor(v);
+		}
+
+		// Texel centers are at half integers
+		const float fx = std::min(std::max(-1.0f, u * float(level.width) - 0.5f), float(level.width));
+		const float fy = std::min(std::max(-1.0f, v * float(level.height) - 0.5f), float(level.height));
+		const float x0f = std::floor(fx);
+		const float y0f = std::floor(fy);
+		const float ax = fx - x0f;
+		const float ay = fy - y0f;
+
+		const int x0 = this->wrapCoordinate(int(x0f), level.width);
+		const int x1 = this->wrapCoordinate(int(x0f) + 1, level.width);
+		const int y0 = this->wrapCoordinate(int(y0f), level.height);
+		const int y1 = this->wrapCoordinate(int(y0f) + 1, level.height);
+
+		const auto c00 = unpackTexel(level.get(x0, y0));
+		const auto c10 = unpackTexel(level.get(x1, y0));
+		const auto c01 = unpackTexel(level.get(x0, y1));
+		const auto c11 = unpackTexel(level.get(x1, y1));
+
+		const auto top = c00 + ax * (c10 - c00);
+		const auto bottom = c01 + ax * (c11 - c01);
+		return top + ay * (bottom - top);
+	}
+
+	void Texture::sampleLanes(const size_t* levels, const simd::vfloat uv[2], simd::vfloat color[4]) const {
+		constexpr int lanes = simd::LANES;
+
+		alignas(32) float widths[lanes];
+		alignas(32) float heights[lanes];
+		for (int lane = 0; lane < lanes; ++lane) {
+			widths[lane] = float(this->levels[levels[lane]].width);
+			heights[lane] = float(this->levels[levels[lane]].height);
+		}
+		const simd::vfloat width = simd::load(widths);
+		const simd::vfloat height = simd::load(heights);
+
+		simd::vfloat u = uv[0];
+		simd::vfloat v = uv[1];
+		if (this->wrap == TextureWrap::REPEAT) {
+			u = simd::sub(u, simd::floor(u));
+			v = simd::sub(v, simd::floor(v));
+		}
+
+		// Coordinates and weights are computed for all lanes, only the texel fetches are done per lane
+		alignas(32) int32_t xs[lanes];
+		alignas(32) int32_t ys[lanes];
+		alignas(32) int32_t texels[4][lanes];
+		const simd::vfloat one = simd::set1(1.0f);
+
+		if (this->filter == TextureFilter::NEAREST) {
+			simd::store(xs, simd::truncate(simd::min(simd::max(simd::mul(u, width), simd::set1(0.0f)), simd::sub(width, one))));
+			simd::store(ys, simd::truncate(simd::min(simd::max(simd::mul(v, height), simd::set1(0.0f)), simd::sub(height, one))));
+			for (int lane = 0; lane < lanes; ++lane) texels[0][lane] = int32_t(this->levels[levels[lane]].get(xs[lane], ys[lane]));
+
+			const simd::vint texel = simd::load(texels[0]);
+			for (int channel = 0; channel < 4; ++channel) color[channel] = simd::mul(unpackChannel(texel, channel), simd::set1(1.0f / 255.0f));
+			return;
+		}
+
+		const simd::vfloat fx = simd::min(simd::max(simd::sub(simd::mul(u, width), simd::set1(0.5f)), simd::set1(-1.0f)), width);
+		const simd::vfloat fy = simd::min(simd::max(simd::sub(simd::mul(v, height), simd::set1(0.5f)), simd::set1(-1.0f)), height);
+		const simd::vfloat x0f = simd::floor(fx);
+		const simd::vfloat y0f = simd::floor(fy);
+		const simd::vfloat ax = simd::sub(fx, x0f);
+		const simd::vfloat ay = simd::sub(fy, y0f);
+
+		simd::store(xs, simd::truncate(x0f));
+		simd::store(ys, simd::truncate(y0f));
+		for (int lane = 0; lane < lanes; ++lane) {
+			const Level& level = this->levels[levels[lane]];
+			const int x0 = this->wrapCoordinate(xs[lane], level.width);
+			const int x1 = this->wrapCoordinate(xs[lane] + 1, level.width);
+			const int y0 = this->wrapCoordinate(ys[lane], level.height);
+			const int y1 = this->wrapCoordinate(ys[lane] + 1, level.height);
+
+			texels[0][lane] = int32_t(level.get(x0, y0));
+			texels[1][lane] = int32_t(level.get(x1, y0));
+			texels[2][lane] = int32_t(level.get(x0, y1));
+			texels[3][lane] = int32_t(level.get(x1, y1));
+		}
+
+		const simd::vint t00 = simd::load(texels[0]);
+		const simd::vint t10 = simd::load(texels[1]);
+		const simd::vint t01 = simd::load(texels[2]);
+		const simd::vint t11 = simd::load(texels[3]);
+		for (int channel = 0; channel < 4; ++channel) {
+			const simd::vfloat c00 = unpackChannel(t00, channel);
+			const simd::vfloat c01 = unpackChannel(t01, channel);
+			const simd::vfloat top = simd::add(c00, simd::mul(ax, simd::sub(unpackChannel(t10, channel), c00)));
+			const simd::vfloat bottom = simd::add(c01, simd::mul(ax, simd::sub(unpackChannel(t11, channel), c01)));
+			color[channel] = simd::mul(simd::add(top, simd::mul(ay, simd::sub(bottom, top))), simd::set1(1.0f / 255.0f));
+		}
+	}
+
+	void Texture::setFilter(TextureFilter filter) {
+		this->filter = filter;
+	}
+
+	void Texture::setWrap(TextureWrap wrap) {
+		this->wrap = wrap;
+	}
+
+	TextureFilter Texture::getFilter() const {
+		return this->filter;
+	}
+
+	TextureWrap Texture::getWrap() const {
+		return this->wrap;
+	}
+
+	int Texture::getWidth(size_t level) const {
+		return level < this->levels.size() ? this->levels[level].width : 0;
+	}
+
+	int Texture::getHeight(size_t level) const {
+		return level < this->levels.size() ? this->levels[level].height : 0;
+	}
+
+	size_t Texture::getLevelCount() const {
+		return this->levels.size();
+	}
+
+	TextureFormat Texture::getFormat() const {
+		return this->format;
+	}
+
+	size_t Texture::getByteSize() const {
+		size_t size = 0;
+		for (auto& level : this->levels) size += level.getByteSize();
+		return size;
+	}
+
+	uint32_t Texture::getTexel(int x, int y, size_t level) const {
+		assert(level < this->levels.size());
+		const Level& l = this->levels[level];
+		return l.get(this->wrapCoordinate(x, l.width), this->wrapCoordinate(y, l.height));
+	}
+
+	lm::Vector4f Texture::sample(const lm::Vector2f& uv) const {
+		return this->sampleLevel(uv, 0.0f);
+	}
+
+	lm::Vector4f Texture::sample(const lm::Vector2f& uv, const lm::Vector2f& dx, const lm::Vector2f& dy) const {
+		if (this->levels.empty()) return {};
+
+		const float width = float(this->levels[0].width);
+		const float height = float(this->levels[0].height);
+		const float dxu = dx[0] * width;
+		const float dxv = dx[1] * height;
+		const float dyu = dy[0] * width;
+		const float dyv = dy[1] * height;
+
+		// log2 of the longer footprint axis, squared lengths are halved in the logarithm
+		const float footprint = std::max(dxu * dxu + dxv * dxv, dyu * dyu + dyv * dyv);
+		return this->sampleLevel(uv, 0.5f * std::log2(footprint));
+	}
+
+	lm::Vector4f Texture::sampleLevel(const lm::Vector2f& uv, float lod) const {
+		if (this->levels.empty()) return {};
+
+		size_t level, nextLevel;
+		float weight;
+		this->selectLevels(lod, level, nextLevel, weight);
+
+		if (this->filter == TextureFilter::NEAREST) return this->sampleNearest(this->levels[level], uv[0], uv[1]);
+
+		const auto color = this->sampleBilinear(this->levels[level], uv[0], uv[1]);
+		if (weight == 0.0f) return color;
+		return color + weight * (this->sampleBilinear(this->levels[nextLevel], uv[0], uv[1]) - color);
+	}
+
+	void Texture::sample(const simd::vfloat uv[2], const simd::vfloat dx[2], const simd::vfloat dy[2], simd::vfloat color[4]) const {
+		constexpr int lanes = simd::LANES;
+		if (this->levels.empty()) {
+			for (int channel = 0; channel < 4; ++channel) color[channel] = simd::set1(0.0f);
+			return;
+		}
+
+		const simd::vfloat width = simd::set1(float(this->levels[0].width));
+		const simd::vfloat height = simd::set1(float(this->levels[0].height));
+		const simd::vfloat dxu = simd::mul(dx[0], width);
+		const simd::vfloat dxv = simd::mul(dx[1], height);
+		const simd::vfloat dyu = simd::mul(dy[0], width);
+		const simd::vfloat dyv = simd::mul(dy[1], height);
+		const simd::vfloat footprint = simd::max(simd::add(simd::mul(dxu, dxu), simd::mul(dxv, dxv)), simd::add(simd::mul(dyu, dyu), simd::mul(dyv, dyv)));
+
+		alignas(32) float lods[lanes];
+		simd::store(lods, simd::mul(simd::log(footprint), simd::set1(0.5f * 1.44269504088896341f)));
+
+		size_t levels[lanes];
+		size_t nextLevels[lanes];
+		alignas(32) float weights[lanes];
+		bool blend = false;
+		for (int lane = 0; lane < lanes; ++lane) {
+			this->selectLevels(lods[lane], levels[lane], nextLevels[lane], weights[lane]);
+			blend |= weights[lane] != 0.0f;
+		}
+
+		this->sampleLanes(levels, uv, color);
+		if (!blend) return;
+
+		simd::vfloat next[4];
+		this->sampleLanes(nextLevels, uv, next);
+		const simd::vfloat weight = simd::load(weights);
+		for (int channel = 0; channel < 4; ++channel) color[channel] = simd::add(color[channel], simd::mul(weight, simd::sub(next[channel], color[channel])));
+	}
+
+	// Texture file
+
+	std::vector<char> serializeTexture(const Texture& texture) {
+		if (texture.levels.empty()) return {};
+
+		TextureFileHeader header = {};
+		std::memcpy(header.magic, "SRTF", 4);
+		header.version = TEXTURE_FILE_VERSION;
+		header.endianTag = FILE_ENDIAN_TAG;
+		header.format = uint32_t(texture.format);
+		header.filter = uint32_t(texture.filter);
+		header.wrap = uint32_t(texture.wrap);
+		header.levelCount = uint32_t(texture.levels.size());
+
+		std::vector<TextureFileLevel> table(texture.levels.size());
+		size_t offset = alignFileOffset(sizeof(header) + table.size() * sizeof(TextureFileLevel));
+		for (size_t i = 0; i < table.size(); ++i) {
+			const auto& level = texture.levels[i];
+			const size_t size = level.format == TextureFormat::RGBA8 ? size_t(level.width) * level.height * sizeof(uint32_t) : level.getByteSize();
+			table[i] = { uint32_t(level.width), uint32_t(level.height), offset, size };
+			offset = alignFileOffset(offset + size);
+		}
+
+		std::vector<char> bytes(offset, 0);
+		std::memcpy(bytes.data(), &header, sizeof(header));
+		std::memcpy(bytes.data() + sizeof(header), table.data(), table.size() * sizeof(TextureFileLevel));
+
+		// RGBA8 levels are stored in rows, independent of the tiling
+		for (size_t i = 0; i < table.size(); ++i) {
+			const auto& level = texture.levels[i];
+			char* data = bytes.data() + table[i].offset;
+			if (level.format != TextureFormat::RGBA8) {
+				std::memcpy(data, level.blocks.data(), level.blocks.size() * sizeof(uint64_t));
+				continue;
+			}
+
+			for (int y = 0; y < level.height; ++y) {
+				for (int x = 0; x < level.width; ++x) {
+					const uint32_t texel = level.get(x, y);
+					std::memcpy(data + (size_t(y) * level.width + x) * sizeof(uint32_t), &texel, sizeof(texel));
+				}
+			}
+		}
+
+		return bytes;
+	}
+
+	std::optional<Texture> parseTexture(std::string_view bytes) {
+		TextureFileHeader header;
+		if (bytes.size() < sizeof(header)) return {};
+		std::memcpy(&header, bytes.data(), sizeof(header));
+
+		if (std::memcmp(header.magic, "SRTF", 4) != 0) return {};
+		if (header.version != TEXTURE_FILE_VERSION || header.endianTag != FILE_ENDIAN_TAG) return {};
+		if (header.format > uint32_t(TextureFormat::BC3) || header.filter > uint32_t(TextureFilter::TRILINEAR) || header.wrap > uint32_t(TextureWrap::CLAMP)) return {};
+		if (header.levelCount == 0 || header.levelCount > (bytes.size() - sizeof(header)) / sizeof(TextureFileLevel)) return {};
+
+		Texture texture;
+		texture.format = TextureFormat(header.format);
+		texture.filter = TextureFilter(header.filter);
+		texture.wrap = TextureWrap(header.wrap);
+
+		const uint64_t blockBytes = texture.format == TextureFormat::BC1 ? 8 : 16;
+		for (uint32_t i = 0; i < header.levelCount; ++i) {
+			TextureFileLevel level;
+			std::memcpy(&level, bytes.data() + sizeof(header) + i * sizeof(TextureFileLevel), sizeof(level));
+			if (level.width == 0 || level.height == 0 || level.width > TEXTURE_FILE_MAX_SIZE || level.height > TEXTURE_FILE_MAX_SIZE) return {};
+
+			// Every level has to lie within the file
+			const uint64_t blocks = uint64_t((level.width + 3) / 4) * ((level.height + 3) / 4);
+			const uint64_t size = texture.format == TextureFormat::RGBA8 ? uint64_t(level.width) * level.height * sizeof(uint32_t) : blocks * blockBytes;
+			if (level.size != size || level.offset > bytes.size() || level.size > bytes.size() - level.offset) return {};
+
+			const char* data = bytes.data() + level.offset;
+			if (texture.format == TextureFormat::RGBA8) {
+				std::vector<uint32_t> rows(size / sizeof(uint32_t));
+				std::memcpy(rows.data(), data, size);
+				texture.addLevel(int(level.width), int(level.height), rows.data());
+			}
+			else {
+				std::vector<uint64_t> levelBlocks(size / sizeof(uint64_t));
+				std::memcpy(levelBlocks.data(), data, size);
+				texture.addLevel(int(level.width), int(level.height), std::move(levelBlocks));
+			}
+		}
+
+		return texture;
+	}
+
+	bool saveTexture(const std::string& path, const Texture& texture) {
+		auto bytes = serializeTexture(texture);
+		if (bytes.empty()) return false;
+		return writeFileAtomically(path, std::string_view(bytes.data(), bytes.size()));
+	}
+
+	// Levels are copied out of the mapping, the file is closed after loading
+	std::optional<Texture> loadTexture(const std::string& path) {
+		MappedFile file(path);
+		if (!file.isOpen()) return {};
+		return parseTexture(file.getView());
+	}
+
+}
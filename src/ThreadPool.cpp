@@ -0,0 +1,209 @@
+#include "SoftwareRenderer/ThreadPool.h"
+
+#include <algorithm>
+
+namespace sr {
+
+	// Queue owned by this thread, used for nested submissions
+	static thread_local const ThreadPool* currentPool = nullptr;
+	static thread_local size_t currentQueue = 0;
+
+	// JobQueue
+
+	bool ThreadPool::JobQueue::push(const Job& job) {
+		const int64_t b = this->bottom.load(std::memory_order_relaxed);
+		const int64_t t = this->top.load(std::memory_order_acquire);
+		if (b - t >= int64_t(this->slots.size())) return false; // Full
+
+		auto& slot = this->slots[size_t(b) & (this->slots.size() - 1)];
+		slot.group.store(job.group, std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_release);
+		this->bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool ThreadPool::JobQueue::pop(Job& job) {
+		const int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+		this->bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = this->top.load(std::memory_order_relaxed);
+
+		if (t > b) {
+			// Empty
+			this->bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		auto& slot = this->slots[size_t(b) & (this->slots.size() - 1)];
+		job.group = slot.group.load(std::memory_order_relaxed);
+
+		if (t == b) {
+			// Last job, race against thieves
+			const bool won = this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			this->bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	bool ThreadPool::JobQueue::steal(Job& job) {
+		int64_t t = this->top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t b = this->bottom.load(std::memory_order_acquire);
+		if (t >= b) return false;
+
+		auto& slot = this->slots[size_t(t) & (this->slots.size() - 1)];
+		job.group = slot.group.load(std::memory_order_relaxed);
+
+		return this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	// ThreadPool
+
+	ThreadPool::ThreadPool(size_t threadCount) {
+		static_assert((THREAD_POOL_QUEUE_SIZE & (THREAD_POOL_QUEUE_SIZE - 1)) == 0);
+
+		if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+		const size_t workerCount = threadCount - 1; // The submitting thread works as well
+
+		for (size_t i = 0; i <= workerCount; ++i) this->queues.push_back(std::make_unique<JobQueue>());
+		for (size_t i = 0; i < workerCount; ++i) this->threads.emplace_back(&ThreadPool::ThreadProc, this, i);
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(this->sleepLock);
+			this->terminated = true;
+		}
+		this->resumeCondition.notify_all();
+		for (auto& t : this->threads) t.join();
+	}
+
+	void ThreadPool::ThreadProc(size_t id) {
+		currentPool = this;
+		currentQueue = id;
+
+		while (true) {
+			Job job;
+			if (this->findJob(id, job)) {
+				this->execute(job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(this->sleepLock);
+			this->sleepingThreads++;
+			this->resumeCondition.wait(lock, [this] {
+				return this->pendingJobs.load() > 0 || this->terminated;
+			});
+			this->sleepingThreads--;
+
+			if (this->terminated) return;
+		}
+	}
+
+	bool ThreadPool::findJob(size_t queueID, Job& job) {
+		if (this->queues[queueID]->pop(job)) {
+			this->pendingJobs--;
+			return true;
+		}
+
+		// Steal, starting at the next queue to spread the thieves
+		const size_t queueCount = this->queues.size();
+		for (size_t i = 1; i < queueCount; ++i) {
+			if (this->queues[(queueID + i) % queueCount]->steal(job)) {
+				this->pendingJobs--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void ThreadPool::execute(const Job& job) {
+		auto group = job.group;
+		size_t index;
+		while ((index = group->nextJob.fetch_add(1, std::memory_order_relaxed)) < group->jobCount) group->function(group->context, index);
+
+		// The submitting thread may return as soon as remaining is 0, the group must not be touched after the last decrement
+		if (group->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+		{
+			std::lock_guard<std::mutex> lock(this->completionLock);
+		}
+		this->completionCondition.notify_all();
+	}
+
+	void ThreadPool::wakeThreads() {
+		if (this->sleepingThreads.load() == 0) return;
+
+		// Taking the lock orders the notification after a worker's predicate check
+		{
+			std::lock_guard<std::mutex> lock(this->sleepLock);
+		}
+		this->resumeCondition.notify_all();
+	}
+
+	void ThreadPool::run(size_t jobCount, void (*function)(void* context, size_t index), void* context) {
+		if (jobCount == 0) return;
+
+		if (this->threads.empty() || jobCount == 1) {
+			for (size_t i = 0; i < jobCount; ++i) function(context, i);
+			return;
+		}
+
+		// Workers submit to their own queue, every other thread to the shared external queue.
+		// An external thread owns that queue until it returns, nested submissions reuse it.
+		const bool isOwner = currentPool == this;
+		const size_t queueID = isOwner ? currentQueue : this->queues.size() - 1;
+
+		const ThreadPool* previousPool = currentPool;
+		const size_t previousQueue = currentQueue;
+
+		std::unique_lock<std::mutex> externalGuard(this->externalLock, std::defer_lock);
+		if (!isOwner) {
+			externalGuard.lock();
+			currentPool = this;
+			currentQueue = queueID;
+		}
+
+		// One runner per thread is enough, every runner claims jobs until none are left
+		const size_t runners = std::min(jobCount, this->getThreadCount());
+
+		JobGroup group;
+		group.function = function;
+		group.context = context;
+		group.jobCount = jobCount;
+		group.nextJob = 0;
+		group.remaining = runners;
+
+		auto& queue = *this->queues[queueID];
+
+		size_t pushed = 0;
+		while (pushed < runners && queue.push({ &group })) pushed++;
+
+		this->pendingJobs += int64_t(pushed);
+		this->wakeThreads();
+
+		// Runners which did not fit into the full queue run here, after the others are published
+		for (size_t i = pushed; i < runners; ++i) this->execute({ &group });
+
+		// Help until nothing is left to take
+		Job job;
+		while (group.remaining.load(std::memory_order_acquire) != 0 && this->findJob(queueID, job)) this->execute(job);
+
+		// Park until the remaining runners are done
+		{
+			std::unique_lock<std::mutex> lock(this->completionLock);
+			this->completionCondition.wait(lock, [&group] {
+				return group.remaining.load(std::memory_order_acquire) == 0;
+			});
+		}
+
+		currentPool = previousPool;
+		currentQueue = previousQueue;
+	}
+
+	size_t ThreadPool::getThreadCount() const {
+		return this->threads.size() + 1;
+	}
+
+}
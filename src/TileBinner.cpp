@@ -0,0 +1,79 @@
+#include "SoftwareRenderer/TileBinner.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace sr {
+
+	TileBinner::TileBinner(int tileSize) : tileSize(tileSize) {}
+
+	void TileBinner::resize(int width, int height, size_t producerCount) {
+		this->width = width;
+		this->height = height;
+		this->tilesX = (width + this->tileSize - 1) / this->tileSize;
+		this->tilesY = (height + this->tileSize - 1) / this->tileSize;
+		this->producerCount = producerCount;
+
+		// Keep the allocated bins alive between frames
+		this->bins.resize(producerCount * this->getTileCount());
+		this->clear();
+	}
+
+	void TileBinner::clear() {
+		for (auto& bin : this->bins) bin.clear();
+	}
+
+	void TileBinner::insert(size_t producer, const Rect& bounds, uint32_t item) {
+		assert(producer < this->producerCount);
+		if (bounds.isEmpty()) return;
+
+		const int txBegin = std::max(bounds.xMin, 0) / this->tileSize;
+		const int tyBegin = std::max(bounds.yMin, 0) / this->tileSize;
+		const int txEnd = std::min((bounds.xMax - 1) / this->tileSize + 1, this->tilesX);
+		const int tyEnd = std::min((bounds.yMax - 1) / this->tileSize + 1, this->tilesY);
+
+		const size_t offset = producer * this->getTileCount();
+		for (int ty = tyBegin; ty < tyEnd; ++ty) {
+			for (int tx = txBegin; tx < txEnd; ++tx) {
+				this->bins[offset + size_t(ty) * this->tilesX + tx].push_back(item);
+			}
+		}
+	}
+
+	const std::vector<uint32_t>& TileBinner::getBin(size_t producer, int tile) const {
+		assert(producer < this->producerCount && tile < this->getTileCount());
+		return this->bins[producer * this->getTileCount() + tile];
+	}
+
+	bool TileBinner::isTileEmpty(int tile) const {
+		for (size_t producer = 0; producer < this->producerCount; ++producer) {
+			if (!this->getBin(producer, tile).empty()) return false;
+		}
+		return true;
+	}
+
+	Rect TileBinner::getTileRect(int tile) const {
+		const int tx = tile % this->tilesX;
+		const int ty = tile / this->tilesX;
+
+		Rect rect{};
+		rect.xMin = tx * this->tileSize;
+		rect.yMin = ty * this->tileSize;
+		rect.xMax = std::min(rect.xMin + this->tileSize, this->width);
+		rect.yMax = std::min(rect.yMin + this->tileSize, this->height);
+		return rect;
+	}
+
+	int TileBinner::getTileSize() const {
+		return this->tileSize;
+	}
+
+	int TileBinner::getTileCount() const {
+		return this->tilesX * this->tilesY;
+	}
+
+	size_t TileBinner::getProducerCount() const {
+		return this->producerCount;
+	}
+
+}
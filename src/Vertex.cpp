@@ -6,53 +6,20 @@ namespace sr {
 		return this->position;
 	}
 
-	const lm::Vector4f& Vertex::getColor() const {
-		return this->color;
+	lm::Vector4f Vertex::getColor() const {
+		return { this->varyings[0], this->varyings[1], this->varyings[2], this->varyings[3] };
 	}
 
-	const lm::Vector3f& Vertex::getNormal() const {
-		return this->normal;
+	lm::Vector3f Vertex::getNormal() const {
+		return { this->varyings[4], this->varyings[5], this->varyings[6] };
 	}
 
-	Vertex operator+(const Vertex& v1, const Vertex& v2) {
-		Vertex res;
-
-		res.color = v1.color + v2.color;
-		res.position = v1.position + v2.position;
-		res.normal = v1.normal + v2.normal;
-
-		return res;
+	void Vertex::setColor(const lm::Vector4f& color) {
+		for (size_t i = 0; i < 4; ++i) this->varyings[i] = color[i];
 	}
 
-	Vertex operator-(const Vertex& v1, const Vertex& v2) {
-		Vertex res;
-
-		res.color = v1.color - v2.color;
-		res.position = v1.position - v2.position;
-		res.normal = v1.normal - v2.normal;
-
-		return res;
+	void Vertex::setNormal(const lm::Vector3f& normal) {
+		for (size_t i = 0; i < 3; ++i) this->varyings[4 + i] = normal[i];
 	}
 
-	 Vertex operator-(const Vertex& v) {
-		 Vertex res;
-
-		 res.color = -v.color;
-		 res.position = -v.position;
-		 res.normal = -v.normal;
-
-		 return res;
-	}
-
-	Vertex operator*(float scalar, const Vertex& v) {
-		Vertex res;
-
-		res.color = scalar * v.color;
-		res.position = scalar * v.position;
-		res.normal = scalar * v.normal;
-
-		return res;
-	}
-
-
 }
@@ -1,11 +1,33 @@
 #include "SoftwareRenderer/VertexShader.h"
 
+#include <algorithm>
+
 namespace sr {
 
 	void VertexShader::reset() {
 		out_position = {};
 		out_color = {};
 		out_normal = {};
+		std::fill_n(out_varyings.begin(), varyingLayout.smooth + varyingLayout.flat, 0.0f);
+	}
+
+	void VertexShader::declareVaryings(size_t smooth, size_t flat) {
+		assert(smooth + flat <= VERTEX_MAX_VARYINGS);
+		this->varyingLayout.smooth = uint8_t(smooth);
+		this->varyingLayout.flat = uint8_t(flat);
+		this->varyingLayout.declared = true;
+	}
+
+	void VertexShader::storeOutput(float* packed) const {
+		for (size_t i = 0; i < 4; ++i) packed[i] = this->out_position[i];
+
+		if (this->varyingLayout.declared) {
+			std::copy_n(this->out_varyings.begin(), this->varyingLayout.smooth + this->varyingLayout.flat, packed + 4);
+		}
+		else {
+			for (size_t i = 0; i < 4; ++i) packed[4 + i] = this->out_color[i];
+			for (size_t i = 0; i < 3; ++i) packed[8 + i] = this->out_normal[i];
+		}
 	}
 
 }
@@ -0,0 +1,37 @@
+#include "SoftwareRenderer/WindowSurface.h"
+
+#include <algorithm>
+
+namespace sr {
+
+	WindowSurface::WindowSurface(std::weak_ptr<pw::PixelWindow> window) : ColorBuffer(0, 0, PixelFormat::RGBA8) {
+		this->window = window;
+	}
+
+	void WindowSurface::beginFrame() {
+		auto w = this->window.lock();
+		if (w == nullptr) return;
+
+		w->beginFrame();
+
+		// Follow the window size
+		if (w->getWidth() != this->width || w->getHeight() != this->height) this->resize(w->getWidth(), w->getHeight());
+	}
+
+	void WindowSurface::endFrame() {
+		auto w = this->window.lock();
+		if (w == nullptr) return;
+
+		// The window may have been resized during the frame
+		const int width = std::min(this->width, w->getWidth());
+		const int height = std::min(this->height, w->getHeight());
+
+		for (int y = 0; y < height; ++y) {
+			const uint32_t* row = this->getRow(y);
+			for (int x = 0; x < width; ++x) w->setPixel(x, y, int(row[x]));
+		}
+
+		w->endFrame();
+	}
+
+}
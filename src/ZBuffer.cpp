@@ -2,38 +2,188 @@
 
 #include <cassert>
 #include <limits>
+#include <algorithm>
 
 #include <iostream>
 
 namespace sr {
 
-	ZBuffer::ZBuffer(int width, int height) : width(width), height(height) {
-		this->buffer = std::make_unique<float[]>(size_t(width) * height);
-		this->reset();
+	static size_t getValueSize(DepthFormat format) {
+		return format == DepthFormat::UNORM16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+
+	ZBuffer::ZBuffer(int width, int height, DepthFormat format) {
+		this->resize(width, height, format);
 	}
 
-	void ZBuffer::resize(int width, int height) {
+	void ZBuffer::resize(int width, int height, DepthFormat format) {
 		this->width = width;
 		this->height = height;
-		this->buffer = std::make_unique<float[]>(size_t(width) * height);
+		this->format = format;
+		this->buffer = std::make_unique<std::byte[]>(size_t(width) * height * getValueSize(format));
+
+		this->tilesX = (width + ZBUFFER_TILE_SIZE - 1) / ZBUFFER_TILE_SIZE;
+		this->tilesY = (height + ZBUFFER_TILE_SIZE - 1) / ZBUFFER_TILE_SIZE;
+		this->coarseTilesX = (width + ZBUFFER_COARSE_TILE_SIZE - 1) / ZBUFFER_COARSE_TILE_SIZE;
+		this->coarseTilesY = (height + ZBUFFER_COARSE_TILE_SIZE - 1) / ZBUFFER_COARSE_TILE_SIZE;
+
+		this->tileMax = std::make_unique<std::atomic<float>[]>(size_t(this->tilesX) * this->tilesY);
+		this->tileDirty = std::make_unique<bool[]>(size_t(this->tilesX) * this->tilesY);
+		this->coarseTileMax = std::make_unique<std::atomic<float>[]>(size_t(this->coarseTilesX) * this->coarseTilesY);
+
 		this->reset();
 	}
 
+	float ZBuffer::encode(float depth) const {
+		switch (this->format) {
+		case DepthFormat::UNORM16: return encode<DepthFormat::UNORM16>(depth);
+		case DepthFormat::UNORM24: return encode<DepthFormat::UNORM24>(depth);
+		default: return encode<DepthFormat::FLOAT32>(depth);
+		}
+	}
+
 	float ZBuffer::get(int x, int y) const {
 		assert(this->buffer != nullptr);
 		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
-		return this->buffer[size_t(y) * this->width + x];
+		switch (this->format) {
+		case DepthFormat::UNORM16: return load<DepthFormat::UNORM16>(this->getRow<DepthFormat::UNORM16>(y), x);
+		case DepthFormat::UNORM24: return load<DepthFormat::UNORM24>(this->getRow<DepthFormat::UNORM24>(y), x);
+		default: return load<DepthFormat::FLOAT32>(this->getRow<DepthFormat::FLOAT32>(y), x);
+		}
 	}
 
 	void ZBuffer::set(int x, int y, float value) {
 		assert(this->buffer != nullptr);
 		assert(!(x < 0 || x >= this->width || y < 0 || y >= this->height));
-		this->buffer[size_t(y) * this->width + x] = value;
+		const size_t offset = size_t(y) * this->width;
+		switch (this->format) {
+		case DepthFormat::UNORM16: store<DepthFormat::UNORM16>(reinterpret_cast<uint16_t*>(this->buffer.get()) + offset, x, value); break;
+		case DepthFormat::UNORM24: store<DepthFormat::UNORM24>(reinterpret_cast<uint32_t*>(this->buffer.get()) + offset, x, value); break;
+		default: store<DepthFormat::FLOAT32>(reinterpret_cast<float*>(this->buffer.get()) + offset, x, value); break;
+		}
+		this->tileDirty[size_t(y / ZBUFFER_TILE_SIZE) * this->tilesX + x / ZBUFFER_TILE_SIZE] = true;
+	}
+
+	template<DepthFormat Format>
+	void ZBuffer::fill() {
+		using Type = typename DepthFormatTraits<Format>::Type;
+		std::fill_n(reinterpret_cast<Type*>(this->buffer.get()), size_t(this->width) * this->height, Type(getClearValue<Format>()));
 	}
 
 	void ZBuffer::reset() {
-		int pixelCount = this->width * this->height;
-		for (int i = 0; i < pixelCount; ++i) this->buffer[i] = std::numeric_limits<float>::infinity();
+		float clearValue;
+		switch (this->format) {
+		case DepthFormat::UNORM16: this->fill<DepthFormat::UNORM16>(); clearValue = getClearValue<DepthFormat::UNORM16>(); break;
+		case DepthFormat::UNORM24: this->fill<DepthFormat::UNORM24>(); clearValue = getClearValue<DepthFormat::UNORM24>(); break;
+		default: this->fill<DepthFormat::FLOAT32>(); clearValue = getClearValue<DepthFormat::FLOAT32>(); break;
+		}
+
+		int tileCount = this->tilesX * this->tilesY;
+		for (int i = 0; i < tileCount; ++i) {
+			this->tileMax[i].store(clearValue, std::memory_order_relaxed);
+			this->tileDirty[i] = false;
+		}
+
+		int coarseTileCount = this->coarseTilesX * this->coarseTilesY;
+		for (int i = 0; i < coarseTileCount; ++i) this->coarseTileMax[i].store(clearValue, std::memory_order_relaxed);
+	}
+
+	template<DepthFormat Format>
+	float ZBuffer::getRowMax(int y, int xBegin, int xEnd) const {
+		const auto* row = this->getRow<Format>(y);
+		float value = -std::numeric_limits<float>::infinity();
+		for (int x = xBegin; x < xEnd; ++x) value = std::max(value, load<Format>(row, x));
+		return value;
+	}
+
+	void ZBuffer::refreshTile(int tileX, int tileY) {
+		const size_t tile = size_t(tileY) * this->tilesX + tileX;
+
+		const int xBegin = tileX * ZBUFFER_TILE_SIZE;
+		const int yBegin = tileY * ZBUFFER_TILE_SIZE;
+		const int xEnd = std::min(xBegin + ZBUFFER_TILE_SIZE, this->width);
+		const int yEnd = std::min(yBegin + ZBUFFER_TILE_SIZE, this->height);
+
+		float value = -std::numeric_limits<float>::infinity();
+		for (int y = yBegin; y < yEnd; ++y) {
+			switch (this->format) {
+			case DepthFormat::UNORM16: value = std::max(value, this->getRowMax<DepthFormat::UNORM16>(y, xBegin, xEnd)); break;
+			case DepthFormat::UNORM24: value = std::max(value, this->getRowMax<DepthFormat::UNORM24>(y, xBegin, xEnd)); break;
+			default: value = std::max(value, this->getRowMax<DepthFormat::FLOAT32>(y, xBegin, xEnd)); break;
+			}
+		}
+
+		this->tileMax[tile].store(value, std::memory_order_relaxed);
+		this->tileDirty[tile] = false;
+	}
+
+	void ZBuffer::refreshCoarseTile(int coarseX, int coarseY) {
+		constexpr int ratio = ZBUFFER_COARSE_TILE_SIZE / ZBUFFER_TILE_SIZE;
+
+		const int txEnd = std::min((coarseX + 1) * ratio, this->tilesX);
+		const int tyEnd = std::min((coarseY + 1) * ratio, this->tilesY);
+
+		float value = -std::numeric_limits<float>::infinity();
+		for (int ty = coarseY * ratio; ty < tyEnd; ++ty) {
+			for (int tx = coarseX * ratio; tx < txEnd; ++tx) value = std::max(value, this->tileMax[size_t(ty) * this->tilesX + tx].load(std::memory_order_relaxed));
+		}
+
+		this->coarseTileMax[size_t(coarseY) * this->coarseTilesX + coarseX].store(value, std::memory_order_relaxed);
+	}
+
+	void ZBuffer::refresh(const Rect& rect) {
+		constexpr int ratio = ZBUFFER_COARSE_TILE_SIZE / ZBUFFER_TILE_SIZE;
+		if (rect.isEmpty()) return;
+
+		const int txBegin = std::max(rect.xMin, 0) / ZBUFFER_TILE_SIZE;
+		const int tyBegin = std::max(rect.yMin, 0) / ZBUFFER_TILE_SIZE;
+		const int txEnd = std::min((rect.xMax - 1) / ZBUFFER_TILE_SIZE + 1, this->tilesX);
+		const int tyEnd = std::min((rect.yMax - 1) / ZBUFFER_TILE_SIZE + 1, this->tilesY);
+
+		for (int cy = tyBegin / ratio; cy * ratio < tyEnd; ++cy) {
+			for (int cx = txBegin / ratio; cx * ratio < txEnd; ++cx) {
+				bool changed = false;
+
+				for (int ty = std::max(cy * ratio, tyBegin); ty < std::min((cy + 1) * ratio, tyEnd); ++ty) {
+					for (int tx = std::max(cx * ratio, txBegin); tx < std::min((cx + 1) * ratio, txEnd); ++tx) {
+						if (!this->tileDirty[size_t(ty) * this->tilesX + tx]) continue;
+						this->refreshTile(tx, ty);
+						changed = true;
+					}
+				}
+
+				if (changed) this->refreshCoarseTile(cx, cy);
+			}
+		}
+	}
+
+	float ZBuffer::getTileMax(int tileX, int tileY) const {
+		return this->tileMax[size_t(tileY) * this->tilesX + tileX].load(std::memory_order_relaxed);
+	}
+
+	bool ZBuffer::isOccluded(const Rect& rect, float value) const {
+		constexpr int ratio = ZBUFFER_COARSE_TILE_SIZE / ZBUFFER_TILE_SIZE;
+		if (rect.isEmpty()) return true;
+
+		const int txBegin = std::max(rect.xMin, 0) / ZBUFFER_TILE_SIZE;
+		const int tyBegin = std::max(rect.yMin, 0) / ZBUFFER_TILE_SIZE;
+		const int txEnd = std::min((rect.xMax - 1) / ZBUFFER_TILE_SIZE + 1, this->tilesX);
+		const int tyEnd = std::min((rect.yMax - 1) / ZBUFFER_TILE_SIZE + 1, this->tilesY);
+
+		for (int cy = tyBegin / ratio; cy * ratio < tyEnd; ++cy) {
+			for (int cx = txBegin / ratio; cx * ratio < txEnd; ++cx) {
+				// The whole coarse tile is in front
+				if (value > this->coarseTileMax[size_t(cy) * this->coarseTilesX + cx].load(std::memory_order_relaxed)) continue;
+
+				for (int ty = std::max(cy * ratio, tyBegin); ty < std::min((cy + 1) * ratio, tyEnd); ++ty) {
+					for (int tx = std::max(cx * ratio, txBegin); tx < std::min((cx + 1) * ratio, txEnd); ++tx) {
+						if (!(value > this->getTileMax(tx, ty))) return false;
+					}
+				}
+			}
+		}
+
+		return true;
 	}
 
 	int ZBuffer::getWidth() const {
@@ -44,5 +194,8 @@ namespace sr {
 		return this->height;
 	}
 
-}
+	DepthFormat ZBuffer::getFormat() const {
+		return this->format;
+	}
 
+}